@@ -24,6 +24,18 @@
 //#include <fstream.h>
 #include <fstream>
 #include <string>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <atomic>
+#include <future>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
 
 #include <locale>
 
@@ -40,12 +52,100 @@
 // requested key does not allready exist.
 #define AUTOCREATE_KEYS         (1L<<2)
 
+// MMAP_LOAD
+// When set, Load() maps the file into memory and parses it in place, in a
+// single pass, rather than reading it a line at a time through a stream. If
+// the file cannot be mapped (or on platforms without mmap) Load() quietly
+// falls back to the stream reader.
+#define MMAP_LOAD               (1L<<3)
+
+// ATOMIC_SAVE
+// When set, Save() never rewrites the file in place. It writes a temporary
+// file alongside it and then renames that over the original, so that a crash
+// part way through leaves the old file intact, and anyone reading the file
+// sees either all of the old contents or all of the new.
+#define ATOMIC_SAVE             (1L<<4)
+
+// SYNC_SAVE
+// When set, Save() flushes the file to disk (fsync) before returning. With
+// ATOMIC_SAVE this is done before the rename, and the directory is flushed
+// after it, so that the new contents are durable once Save() returns.
+#define SYNC_SAVE               (1L<<5)
+
+// INCREMENTAL_SAVE
+// When set, Save() appends only the keys and sections that have changed since
+// the file was last loaded or saved, as extra [section] blocks at the end of
+// the file, rather than rewriting all of it. Load() merges those blocks back
+// in, so the file reloads to the same contents either way. Save() still falls
+// back to a full rewrite, which also compacts the appended blocks away, when
+// a change cannot be expressed that way (deleted keys or sections, emptied
+// or newly given values, comments on existing sections, keys in the default
+// section), when the file was changed behind our back, once the appended
+// blocks outgrow the file they were appended to, and whenever ATOMIC_SAVE is
+// set.
+#define INCREMENTAL_SAVE        (1L<<6)
+
+// THREAD_SAFE
+// When set, the object may be shared between threads. Every public method
+// then takes the object's lock: methods that only read take it shared, so
+// any number of them can run at once, and methods that change anything take
+// it exclusively. Each call is atomic with respect to every other: a reader
+// sees a section, key or value either entirely as it was before a write or
+// entirely as it is after, never part way through. Load() parses the file
+// before taking the lock, so readers are only held up while the result is
+// merged in. Set this before the object is shared, and leave it set.
+#define THREAD_SAFE             (1L<<7)
+
+// PARALLEL_LOAD
+// When set along with MMAP_LOAD, Load() splits a big file at section headers
+// into up to one chunk per hardware thread, each at least PARALLEL_CHUNK_LEN
+// long, parses the chunks at once, and stitches the results together in file
+// order. The result, comments included, is just what a single pass would
+// have given. Files loaded through the stream reader are parsed in one pass.
+#define PARALLEL_LOAD           (1L<<8)
+
+// ASYNC_SAVE
+// When set, an object destroyed with unsaved changes renders them and hands
+// them to a background writer that outlives it, rather than waiting for the
+// disk; the writer finishes every save handed to it before the program
+// exits. See also SaveAsync(), which needs no flag.
+#define ASYNC_SAVE              (1L<<9)
+
+// LAZY_LOAD
+// When set along with MMAP_LOAD, Load() only finds the section headers, and
+// the comments that go with them, and leaves the keys of each section to be
+// parsed from a copy of the file the first time the section is looked up. A
+// program that reads a few sections of a big file then pays for little more
+// than those. Anything that goes through every section (Save(), Sections(),
+// KeyCount(), Publish(), the queries, and reloading) parses the rest first.
+// The file is copied out of its mapping as it is loaded, so it may be
+// replaced or rewritten in place at any time after. The copy is kept until
+// every section has been parsed. It takes the place of PARALLEL_LOAD.
+#define LAZY_LOAD               (1L<<10)
+
 // MAX_BUFFER_LEN
-// Used simply as a max size of some internal buffers. Determines the maximum
-// length of a line that will be read from or written to the file or the
-// report output.
+// Used simply as the size of the stack buffers that WriteLn() and Report()
+// format into. Longer output is formatted on the heap instead, so this no
+// longer limits the length of a line read, written or reported.
 #define MAX_BUFFER_LEN				512
 
+// LOAD_CHUNK_LEN
+// The number of bytes the stream reader used by Load() reads from the file at
+// a time. Lines may be any length; a line that spans chunks is reassembled.
+#define LOAD_CHUNK_LEN				65536
+
+// PARALLEL_CHUNK_LEN
+// The least number of bytes a PARALLEL_LOAD gives each thread to parse. Files
+// of less than twice this are parsed in one pass.
+#define PARALLEL_CHUNK_LEN			(1L<<22)
+
+// CDATAFILE_STATS
+// Define this when building (-DCDATAFILE_STATS), for every file that includes
+// this one, to have each CDataFile count its lookups, allocations and bytes
+// read and written, and time its loads and saves (see GetStats() and
+// SetStatsCallback()). Left undefined, none of it is compiled in at all, and
+// those methods do not exist.
+
 
 // eDebugLevel
 // Used by our Report function to classify levels of reporting and severity
@@ -71,9 +171,19 @@ enum e_DebugLevel
 	E_FATAL,
 	// notice that all processing should be stopped immediately after the
 	// log is written.
-	E_CRITICAL
+	E_CRITICAL,
+	// not a level of report, but a level for SetReportLevel() that lets
+	// none through at all.
+	E_NONE
 };
 
+// ReportSink
+// Takes each message that Report() lets through, with its level, in place of
+// the standard output (see SetReportSink). The message has no level tag or
+// newline, and is only good for the length of the call. It may be called by
+// several threads at once.
+typedef std::function<void(e_DebugLevel DebugLevel, const char* szMessage)> ReportSink;
+
 
 //typedef std::string t_Str;
 
@@ -98,6 +208,79 @@ const std::string EqualIndicators   = std::string("=:");
 // the head and tail of strings.
 const std::string WhiteSpace = std::string(" \t\n\r");
 
+// st_strref
+// A non-owning reference to a run of characters. The lookup methods take their
+// names as a t_StrRef, so that a string literal, a const char*, a std::string
+// (or, under C++17, a std::string_view) can be passed without building a
+// temporary std::string. The characters are not copied, so they must outlive
+// the call, and they need not be null terminated.
+typedef struct st_strref
+{
+	const char*		pStr;
+	std::size_t		nLen;
+
+	st_strref() : pStr(""), nLen(0) {}
+	st_strref(const char* szStr) : pStr(szStr ? szStr : ""), nLen(szStr ? strlen(szStr) : 0) {}
+	st_strref(const char* szStr, std::size_t nLength) : pStr(szStr), nLen(nLength) {}
+	st_strref(const std::string& szStr) : pStr(szStr.data()), nLen(szStr.size()) {}
+#if __cplusplus >= 201703L
+	st_strref(std::string_view szStr) : pStr(szStr.data()), nLen(szStr.size()) {}
+#endif
+
+} t_StrRef;
+
+// FoldCase
+// Lowercases an ASCII letter, and leaves any other character alone. Names are
+// compared and hashed through this (as strcasecmp would in the "C" locale)
+// rather than tolower(), so that the result does not depend on the locale,
+// and so that HashName() can work hashes out at compile time.
+inline constexpr char FoldCase(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+// HashName
+// HashNoCase, for a string literal, at compile time. Used to hash the names
+// in a t_Binding (see CDataSchema.h) once, when the program is built.
+inline constexpr std::size_t HashName(const char* szName, unsigned long long nHash = 14695981039346656037ULL)
+{
+	return (*szName == '\0') ? (std::size_t)nHash
+							 : HashName(szName + 1, (nHash ^ (unsigned char)FoldCase(*szName)) * 1099511628211ULL);
+}
+
+// st_valuecache
+// Holds the typed forms of a key's value once GetInt(), GetFloat() or
+// GetBool() have parsed it, so that later calls need not parse it again.
+// nValid says which forms are held. Readers sharing the lock may fill it in
+// at the same time, hence the atomics; anything that changes the value holds
+// the lock exclusively, and empties the cache. A copy starts out empty.
+typedef struct st_valuecache
+{
+	enum { CACHED_INT = 1, CACHED_FLOAT = 2, CACHED_BOOL = 4 };
+
+	std::atomic<unsigned int>	nValid;
+	std::atomic<int>			nInt;
+	std::atomic<float>			fFloat;
+	std::atomic<bool>			bBool;
+
+	st_valuecache() : nValid(0), nInt(0), fFloat(0), bBool(false)
+	{
+	}
+
+	// noexcept, so that a KeyList still moves keys rather than copying them
+	// when it grows.
+	st_valuecache(const st_valuecache&) noexcept : nValid(0), nInt(0), fFloat(0), bBool(false)
+	{
+	}
+
+	st_valuecache& operator=(const st_valuecache&)
+	{
+		nValid.store(0);
+		return *this;
+	}
+
+} t_ValueCache;
+
 // st_key
 // This structure stores the definition of a key. A key is a named identifier
 // that is associated with a value. It may or may not have a comment.  All comments
@@ -107,12 +290,26 @@ typedef struct st_key
 	std::string		szKey;
 	std::string		szValue;
 	std::string		szComment;
+	bool			bDirty;		// Changed since the last load or save
+	bool			bDeleted;	// A tombstone, left for Compact() to remove
+	mutable t_ValueCache	Cache;	// szValue, parsed
 
 	st_key()
 	{
 		szKey = std::string("");
 		szValue = std::string("");
 		szComment = std::string("");
+		bDirty = false;
+		bDeleted = false;
+	}
+
+	// For building a key in place, as by KeyList::emplace_back(); strings
+	// passed with std::move are moved in rather than copied.
+	st_key(std::string szName, std::string szVal, std::string szComm = std::string(""))
+		: szKey(std::move(szName)), szValue(std::move(szVal)), szComment(std::move(szComm))
+	{
+		bDirty = false;
+		bDeleted = false;
 	}
 
 } t_Key;
@@ -120,6 +317,110 @@ typedef struct st_key
 typedef std::vector<t_Key> KeyList;
 typedef KeyList::iterator KeyItor;
 
+// CHashIndex
+// Maps the case insensitive hash of a name (see HashNoCase) to the position of
+// the named item in its list. Several names may share a hash, so every hit
+// must still be confirmed with CompareNoCase. The index is a single flat
+// table of (hash, position) slots, found by linear probing, so a lookup
+// streams through one run of memory, and only touches the names in the list
+// whose hashes match in full. It is kept at most half full.
+//
+// To visit every position held under a hash;
+//
+//   std::size_t nSlot = Index.Start(nHash), nPos;
+//   while ( Index.Next(nHash, nSlot, nPos) )
+//       ...
+class CHashIndex
+{
+public:
+				CHashIndex();
+
+				// Insert: Adds a position under the given hash.
+	void		Insert(std::size_t nHash, std::size_t nPos);
+				// Erase: Removes the position from those held under the hash, if
+				// it is there. The rest of its run is shifted back over the gap,
+				// so that no probe is cut short.
+	void		Erase(std::size_t nHash, std::size_t nPos);
+				// Reserve: Makes room for nCount positions in all, so that adding
+				// them one at a time need not regrow the table.
+	void		Reserve(std::size_t nCount);
+				// Clear: Removes every position, keeping the table's memory.
+	void		Clear();
+				// Swap: Exchanges the positions held. Both indexes count it as a
+				// change, and neither count goes back (see Changes()).
+	void		Swap(CHashIndex& Other);
+	std::size_t	Size() const { return m_nCount; }
+				// Changes: A count that goes up with every change to the index,
+				// for telling whether something worked out from it, such as a
+				// t_NameOrder, is still up to date.
+	std::size_t	Changes() const { return m_nChanges; }
+
+				// Start: Returns the slot a probe for nHash starts from.
+	std::size_t	Start(std::size_t nHash) const
+	{
+		return nHash & m_nMask;
+	}
+
+				// Next: Finds the next position held under nHash, from nSlot on.
+				// Returns false once there are no more.
+	bool		Next(std::size_t nHash, std::size_t& nSlot, std::size_t& nPos) const
+	{
+		if ( m_Slots.empty() )
+			return false;
+
+		for (;;)
+		{
+			const t_Slot& Slot = m_Slots[nSlot];
+
+			nSlot = (nSlot + 1) & m_nMask;
+
+			if ( Slot.nPos == EMPTY_SLOT )
+				return false;
+
+			if ( Slot.nHash == nHash )
+			{
+				nPos = Slot.nPos;
+				return true;
+			}
+		}
+	}
+
+private:
+	enum { MIN_SLOTS = 8 };
+	static const std::size_t EMPTY_SLOT = (std::size_t)-1;
+
+	struct t_Slot
+	{
+		std::size_t	nHash;
+		std::size_t	nPos;		// EMPTY_SLOT when free
+	};
+
+	void		Grow(std::size_t nSlots);
+
+	std::vector<t_Slot>	m_Slots;	// A power of two of them, or none
+	std::size_t	m_nMask;		// m_Slots.size() - 1
+	std::size_t	m_nCount;		// Slots in use
+	std::size_t	m_nChanges;		// See Changes()
+};
+
+typedef CHashIndex HashIndex;
+
+// st_nameorder
+// The positions of a list's items, sorted by name, ignoring case, so that
+// the names starting with a prefix can be found by binary search. It is made
+// when first needed, and again whenever the list's index has changed since.
+typedef struct st_nameorder
+{
+	std::vector<std::size_t>	Positions;
+	std::size_t		nChanges;	// The index's Changes() when Positions were sorted
+
+	st_nameorder()
+	{
+		nChanges = 0;
+	}
+
+} t_NameOrder;
+
 // st_section
 // This structure stores the definition of a section. A section contains any number
 // of keys (see st_keys), and may or may not have a comment. Like keys, all
@@ -129,12 +430,24 @@ typedef struct st_section
 	std::string		szName;
 	std::string		szComment;
 	KeyList		    Keys;
+	HashIndex		KeyIndex;	// Positions of Keys, by key name
+	t_NameOrder		KeyOrder;	// Positions of Keys, sorted by key name
+	bool			bDirty;		// It, or one of its keys, changed since the last load or save
+	bool			bNew;		// Created since the last load or save
+	bool			bDeleted;	// A tombstone, left for Compact() to remove
+	std::size_t		nDeleted;	// Tombstones among Keys
+	std::vector<t_StrRef>	Deferred;	// Its lines in a loaded file, yet to be parsed (see LAZY_LOAD)
 
 	st_section()
 	{
 		szName = std::string("");
 		szComment = std::string("");
 		Keys.clear();
+		KeyIndex.Clear();
+		bDirty = false;
+		bNew = false;
+		bDeleted = false;
+		nDeleted = 0;
 	}
 
 } t_Section;
@@ -142,15 +455,349 @@ typedef struct st_section
 typedef std::vector<t_Section> SectionList;
 typedef SectionList::iterator SectionItor;
 
+// CViewRange
+// The items from pBegin to pEnd, each seen through a VIEW, for range based
+// for loops over sections and keys without copying any of them;
+//
+//   for (CSectionView Section : File.Sections())
+//       for (CKeyView Key : Section.Keys())
+//           ...
+//
+// A range is only good until the sections or keys it covers next change.
+template <class VIEW, class ITEM>
+class CViewRange
+{
+public:
+	class iterator
+	{
+	public:
+					iterator(const ITEM* pItem) : m_pItem(pItem) {}
+
+		VIEW		operator*() const { return VIEW(m_pItem); }
+		iterator&	operator++() { m_pItem++; return *this; }
+		bool		operator==(const iterator& Other) const { return m_pItem == Other.m_pItem; }
+		bool		operator!=(const iterator& Other) const { return m_pItem != Other.m_pItem; }
+
+	private:
+		const ITEM*	m_pItem;
+	};
+
+				CViewRange(const ITEM* pBegin, const ITEM* pEnd) : m_pBegin(pBegin), m_pEnd(pEnd) {}
+
+	iterator	begin() const { return iterator(m_pBegin); }
+	iterator	end() const { return iterator(m_pEnd); }
+	std::size_t	Size() const { return m_pEnd - m_pBegin; }
+	bool		Empty() const { return m_pBegin == m_pEnd; }
+	VIEW		operator[](std::size_t nPos) const { return VIEW(m_pBegin + nPos); }
+
+private:
+	const ITEM*	m_pBegin;
+	const ITEM*	m_pEnd;
+};
+
+// CKeyView
+// A key, as seen while iterating. Its text is referred to, not copied.
+class CKeyView
+{
+public:
+				CKeyView(const t_Key* pKey) : m_pKey(pKey) {}
+
+	t_StrRef	Name() const { return m_pKey->szKey; }
+	t_StrRef	Value() const { return m_pKey->szValue; }
+	t_StrRef	Comment() const { return m_pKey->szComment; }
+
+private:
+	const t_Key*	m_pKey;
+};
+
+typedef CViewRange<CKeyView, t_Key> KeyRange;
+
+// CSectionView
+// A section, as seen while iterating, with a range over its keys in the
+// order they are saved in.
+class CSectionView
+{
+public:
+				CSectionView(const t_Section* pSection) : m_pSection(pSection) {}
+
+	t_StrRef	Name() const { return m_pSection->szName; }
+	t_StrRef	Comment() const { return m_pSection->szComment; }
+	std::size_t	KeyCount() const { return m_pSection->Keys.size(); }
+	KeyRange	Keys() const
+	{
+		const t_Key* pKeys = m_pSection->Keys.data();
+
+		return KeyRange(pKeys, pKeys + m_pSection->Keys.size());
+	}
+
+private:
+	const t_Section*	m_pSection;
+};
+
+typedef CViewRange<CSectionView, t_Section> SectionRange;
+
+typedef std::vector<CKeyView> KeyViewList;
+typedef std::vector<CSectionView> SectionViewList;
+
+// MakeSectionRange
+// A range over every section of the list.
+inline SectionRange MakeSectionRange(const SectionList& Sections)
+{
+	return SectionRange(Sections.data(), Sections.data() + Sections.size());
+}
+
+// st_filestamp
+// Identifies one version of a file on disk by its size, modification time and
+// file number. If a file's stamp changes, the file has been rewritten.
+typedef struct st_filestamp
+{
+	unsigned long long	nSize;
+	unsigned long long	nTime;
+	unsigned long long	nInode;
+
+	st_filestamp()
+	{
+		nSize = 0;
+		nTime = 0;
+		nInode = 0;
+	}
+
+	bool operator==(const st_filestamp& Other) const
+	{
+		return nSize == Other.nSize && nTime == Other.nTime && nInode == Other.nInode;
+	}
+
+} t_FileStamp;
+
+// st_pendingsave
+// A save, rendered and ready to write: either all of the file, or the blocks
+// INCREMENTAL_SAVE appends to it.
+typedef struct st_pendingsave
+{
+	std::string		szFileName;
+	std::string		szBuffer;
+	bool			bAppend;		// szBuffer is appended to the file, rather than replacing it
+	bool			bAtomic;		// As ATOMIC_SAVE
+	bool			bSync;			// As SYNC_SAVE
+
+	st_pendingsave()
+	{
+		bAppend = false;
+		bAtomic = false;
+		bSync = false;
+	}
+
+} t_PendingSave;
+
+
+// st_change
+// Describes one key whose value was changed when a watched file was reloaded
+// (see CDataFile::StartWatching). A key that was added has an empty
+// szOldValue, and a key that was removed has an empty szNewValue. Keys
+// without a value are never saved, so neither case is ambiguous.
+typedef struct st_change
+{
+	std::string		szSection;
+	std::string		szKey;
+	std::string		szOldValue;
+	std::string		szNewValue;
+
+	st_change()
+	{
+		szSection = std::string("");
+		szKey = std::string("");
+		szOldValue = std::string("");
+		szNewValue = std::string("");
+	}
+
+} t_Change;
+
+typedef std::vector<t_Change> ChangeList;
+
+// e_BindType
+// The type of the field a t_Binding reads into or writes from.
+enum e_BindType
+{
+	BIND_INT = 0,		// int, as by GetInt/SetInt
+	BIND_FLOAT,			// float, as by GetFloat/SetFloat
+	BIND_BOOL,			// bool, as by GetBool/SetBool
+	BIND_STRING			// std::string, as by GetString/SetValue
+};
+
+// st_binding
+// Binds one key to a variable, for CDataFile::ReadBindings() and
+// WriteBindings(), usually by way of CDataSchema (see CDataSchema.h). The
+// hashes are those HashNoCase() gives for the names, worked out ahead of time
+// with HashName().
+typedef struct st_binding
+{
+	t_StrRef		szSection;
+	t_StrRef		szKey;
+	std::size_t		nSectionHash;
+	std::size_t		nKeyHash;
+	e_BindType		Type;
+	void*			pValue;			// The variable, of the type given by Type
+
+	st_binding()
+	{
+		nSectionHash = HashName("");
+		nKeyHash = HashName("");
+		Type = BIND_STRING;
+		pValue = NULL;
+	}
+
+} t_Binding;
+
+// st_batchstring
+// A string queued in a CDataBatch, by its place in the batch's text.
+typedef struct st_batchstring
+{
+	std::size_t		nAt;
+	std::size_t		nLen;
+
+} t_BatchString;
+
+// st_batchvalue
+// One value queued in a CDataBatch, to be set by CDataFile::SetValues().
+typedef struct st_batchvalue
+{
+	t_BatchString	Section;
+	t_BatchString	Key;
+	t_BatchString	Value;
+	t_BatchString	Comment;
+
+} t_BatchValue;
+
+typedef std::vector<t_BatchValue> BatchList;
+
+// st_keyhandle
+// A key, looked up once by name (see CDataFile::GetHandle) so that it can be
+// read and written after that without hashing or comparing names. The handle
+// holds the key's position, and the layout generation of the CDataFile at the
+// time it was looked up. Until something moves keys around (deleting a key or
+// section, clearing, or a reload), the position is used as it stands. After
+// that the handle is quietly looked up by name again, the first time it is
+// used. A handle (but not the CDataFile) should only be used by one thread at
+// a time, as using it may update it.
+typedef struct st_keyhandle
+{
+	std::string		szSection;
+	std::string		szKey;
+	const void*		pOwner;			// The CDataFile it was looked up in
+	unsigned long long	nGeneration;	// Its layout generation at the time
+	std::size_t		nSection;		// The key's position, if it was found
+	std::size_t		nKey;
+
+	st_keyhandle()
+	{
+		szSection = std::string("");
+		szKey = std::string("");
+		pOwner = NULL;
+		nGeneration = 0;
+		nSection = 0;
+		nKey = 0;
+	}
+
+} t_KeyHandle;
+
+#ifdef CDATAFILE_STATS
+// e_Stat
+// The counters kept under CDATAFILE_STATS. Each of STAT_LOADS and STAT_SAVES
+// is followed by its total time and then its longest.
+enum e_Stat
+{
+	STAT_SECTION_LOOKUPS = 0,
+	STAT_SECTION_MISSES,
+	STAT_KEY_LOOKUPS,
+	STAT_KEY_MISSES,
+	STAT_COMPARES,
+	STAT_ALLOCATIONS,
+	STAT_BYTES_PARSED,
+	STAT_BYTES_WRITTEN,
+	STAT_LOADS,
+	STAT_LOAD_NS,
+	STAT_MAX_LOAD_NS,
+	STAT_SAVES,
+	STAT_SAVE_NS,
+	STAT_MAX_SAVE_NS,
+	STAT_COUNT
+};
+
+// st_datastats
+// What a CDataFile has counted since it was made, or its stats last reset.
+// Lookups are those made by the public methods on behalf of their callers;
+// those made while parsing a file are not counted, but the sections and keys
+// it creates are.
+typedef struct st_datastats
+{
+	unsigned long long	nSectionLookups;	// Sections looked up by name
+	unsigned long long	nSectionMisses;		// Of them, those not found
+	unsigned long long	nKeyLookups;		// Keys looked up by name
+	unsigned long long	nKeyMisses;			// Of them, those not found
+	unsigned long long	nCompares;			// Names whose hashes matched, compared in full
+	unsigned long long	nAllocations;		// Sections and keys created, and values and
+											// lists that outgrew their storage
+	unsigned long long	nBytesParsed;		// Text read by loads
+	unsigned long long	nBytesWritten;		// Text written by Save() and SaveAsync()
+	unsigned long long	nLoads;				// Load(), LoadFiles() and Reload() calls
+	unsigned long long	nLoadNs;			// Nanoseconds spent in them, in all
+	unsigned long long	nMaxLoadNs;			// The longest of them
+	unsigned long long	nSaves;				// Save() calls, and saves by SaveAsync()
+	unsigned long long	nSaveNs;
+	unsigned long long	nMaxSaveNs;
+
+	st_datastats()
+	{
+		nSectionLookups = nSectionMisses = nKeyLookups = nKeyMisses = 0;
+		nCompares = nAllocations = nBytesParsed = nBytesWritten = 0;
+		nLoads = nLoadNs = nMaxLoadNs = nSaves = nSaveNs = nMaxSaveNs = 0;
+	}
+
+} t_DataStats;
+#endif
 
 
 /// General Purpose Utility Functions ///////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////
 //void	Report(e_DebugLevel DebugLevel, char *fmt, ...);
 void	Report(e_DebugLevel DebugLevel, const char *fmt, ...);
+		// SetReportLevel: Has Report() drop, before formatting them, messages
+		// of less than the given level. Everything is reported by default.
+void	SetReportLevel(e_DebugLevel MinLevel);
+e_DebugLevel	GetReportLevel();
+		// IsReported: Returns true if a message of the given level would be
+		// reported, for callers whose arguments are costly to work out.
+bool	IsReported(e_DebugLevel DebugLevel);
+		// SetReportSink: Sends what is reported to Sink, rather than to the
+		// standard output; an empty Sink sends it back there. The standard
+		// output is not flushed after each message.
+void	SetReportSink(ReportSink Sink);
+		// ReportTag: Returns the tag the standard output gives messages of
+		// the level, such as "<info> ".
+const char*	ReportTag(e_DebugLevel DebugLevel);
+#ifndef WIN32
+		// SyslogSink: Returns a sink that passes messages on to syslog(), at
+		// the nearest priority. Call openlog() first to name the program.
+ReportSink	SyslogSink();
+#endif
 std::string	GetNextWord(std::string& CommandLine);
-int		CompareNoCase(std::string str1, std::string str2);
+int		CompareNoCase(t_StrRef str1, t_StrRef str2);
+		// MatchNoCase: Returns true if szName matches szPattern, ignoring
+		// case, where a '*' in the pattern stands for any run of characters
+		// (none included) and a '?' for any one character.
+bool	MatchNoCase(t_StrRef szPattern, t_StrRef szName);
+std::size_t	HashNoCase(t_StrRef str);
+		// ValueAsInt, ValueAsFloat, ValueAsBool: Convert a value as GetInt(),
+		// GetFloat() and GetBool() do, for everything that keeps values
+		// converted (CDataFile, CDataSnapshot and CDataImage) to share.
+int		ValueAsInt(const std::string& szValue);
+float	ValueAsFloat(const std::string& szValue);
+bool	ValueAsBool(const std::string& szValue);
 void	Trim(std::string& szStr);
+t_StrRef	TrimRef(t_StrRef szStr);
+std::size_t	CommentLen(t_StrRef szComment);
+void	AppendComment(std::string& szOut, t_StrRef szComment);
+bool	GetFileStamp(const std::string& szFileName, t_FileStamp& Stamp);
 //int		WriteLn(fstream& stream, char* fmt, ...);
 int		WriteLn(std::fstream& stream, const char* fmt, ...);
 
@@ -158,6 +805,266 @@ int		WriteLn(std::fstream& stream, const char* fmt, ...);
 /// Class Definitions ///////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////
 
+// CReportRing
+// Keeps the last messages reported, up to a fixed number, for a program to
+// show or log when it chooses rather than as they happen. Install it with
+// SetReportSink(Ring.Sink()), and keep it alive while it is the sink.
+class CReportRing
+{
+public:
+				CReportRing(std::size_t nCapacity = 256);
+
+				// Sink: Returns a sink that adds each message to the ring.
+	ReportSink	Sink();
+				// Add: Adds a message, tagged as ReportTag() tags it, in place
+				// of the oldest if the ring is full.
+	void		Add(e_DebugLevel DebugLevel, const char* szMessage);
+				// GetMessages: Returns the messages held, oldest first.
+	std::vector<std::string>	GetMessages();
+				// Dropped: Returns the number of messages pushed out so far.
+	unsigned long long	Dropped();
+	void		Clear();
+
+private:
+	std::mutex	m_Mutex;
+	std::vector<std::string>	m_Messages;	// Used as a ring, from m_nNext on
+	std::size_t	m_nCapacity;
+	std::size_t	m_nNext;		// Where the next message goes, once full
+	unsigned long long	m_nDropped;
+};
+
+// CRWLock
+// A shared/exclusive (reader/writer) lock, for C++11, which has no
+// std::shared_mutex. Writers are preferred: once a writer is waiting, new
+// readers wait behind it, so a steady stream of readers cannot starve it.
+// Neither mode is recursive. Copying a CRWLock gives a new, unlocked lock.
+class CRWLock
+{
+public:
+				CRWLock();
+				CRWLock(const CRWLock&);
+	CRWLock&	operator=(const CRWLock&);
+
+	void		LockShared();
+	void		UnlockShared();
+	void		Lock();
+	void		Unlock();
+
+private:
+	std::mutex	m_Mutex;
+	std::condition_variable	m_Readers;	// Signalled when readers may enter
+	std::condition_variable	m_Writers;	// Signalled when a writer may enter
+	int			m_nReaders;		// Readers holding the lock
+	int			m_nWaiting;		// Writers waiting for it
+	bool		m_bWriter;		// A writer holds the lock
+};
+
+// CDataSnapshot
+// An immutable copy of the sections and keys of a CDataFile, as published by
+// CDataFile::Publish() and CDataFile::Reload(). A snapshot never changes once
+// it is made, so any number of threads may read it at once without locking,
+// for as long as they hold a SnapshotPtr to it. Publishing a newer snapshot
+// does not affect readers of an older one; it is freed when the last of
+// them lets go. The read methods behave just like those of CDataFile.
+class CDataSnapshot
+{
+// Methods
+public:
+				CDataSnapshot(SectionList Sections, HashIndex SectionIndex);
+
+	std::string		GetValue(t_StrRef szKey, t_StrRef szSection = t_StrRef()) const;
+	std::string		GetString(t_StrRef szKey, t_StrRef szSection = t_StrRef()) const;
+	float		GetFloat(t_StrRef szKey, t_StrRef szSection = t_StrRef()) const;
+	int			GetInt(t_StrRef szKey, t_StrRef szSection = t_StrRef()) const;
+	bool		GetBool(t_StrRef szKey, t_StrRef szSection = t_StrRef()) const;
+	bool		CheckSectionName(t_StrRef szSectionName) const;
+	int			SectionCount() const;
+	int			KeyCount() const;
+				// Sections: Returns a range over the sections, and through them
+				// the keys, of the snapshot, which never change.
+	SectionRange	Sections() const;
+
+protected:
+	const t_Key*		GetKey(t_StrRef szKey, t_StrRef szSection) const;
+	const t_Section*	GetSection(t_StrRef szSection) const;
+
+// Data
+protected:
+	SectionList	m_Sections;
+	HashIndex	m_SectionIndex;
+	std::size_t	m_nKeys;		// In all of m_Sections
+
+	friend class CDataFile;
+};
+
+typedef std::shared_ptr<const CDataSnapshot> SnapshotPtr;
+
+
+// CFileWatcher
+// Runs a background thread that calls a check function each time a file may
+// have changed. On Linux it is woken by inotify events for the file, which
+// it watches through its directory so that a file replaced by rename (see
+// ATOMIC_SAVE) is still followed. Elsewhere, or should inotify be
+// unavailable, it simply polls. Either way the check is also made at least
+// once every poll interval. Copying a CFileWatcher gives one that is stopped.
+class CFileWatcher
+{
+public:
+				CFileWatcher();
+				CFileWatcher(const CFileWatcher&);
+	CFileWatcher&	operator=(const CFileWatcher&);
+				~CFileWatcher();
+
+				// Start: Starts (or restarts) watching the named file, calling
+				// Check from the background thread. nPollMs is the longest that
+				// may pass between checks, in milliseconds.
+	void		Start(const std::string& szFileName, std::function<void()> Check,
+					  unsigned int nPollMs);
+				// Stop: Stops watching, and waits for the thread to finish, unless
+				// called from Check itself.
+	void		Stop();
+
+private:
+	void		Run();
+	bool		Wait();
+
+	std::thread	m_Thread;
+	std::mutex	m_Mutex;
+	std::condition_variable	m_Wake;	// Signalled by Stop(), when polling
+	bool		m_bStop;
+	std::function<void()>	m_Check;
+	std::string	m_szName;		// The file's name within its directory
+	unsigned int	m_nPollMs;
+	int			m_nNotify;		// The inotify descriptor, or -1 when polling
+	int			m_Pipe[2];		// Written by Stop() to wake an inotify wait
+};
+
+
+// CSaveWriter
+// Runs a background thread that calls a save function whenever asked to, for
+// CDataFile::SaveAsync(), and for the saves of objects destroyed with
+// ASYNC_SAVE set. Every request made before the thread gets round to
+// it is served by the one call, and shares its result, so a burst of
+// requests costs a single save. It also holds the mutex that keeps saves to
+// its object's file from overlapping. Copying a CSaveWriter gives one that is
+// idle.
+class CSaveWriter
+{
+public:
+				CSaveWriter();
+				CSaveWriter(const CSaveWriter&);
+	CSaveWriter&	operator=(const CSaveWriter&);
+				~CSaveWriter();
+
+				// Request: Asks for Save to be called from the background thread,
+				// starting it if need be, and returns the result of the call that
+				// will serve the request.
+	std::shared_future<bool>	Request(std::function<bool()> Save);
+				// Stop: Waits for any call under way, and stops the thread. A
+				// request still waiting to be served is handed back in Pending,
+				// for the caller to keep, and true returned.
+	bool		Stop(std::promise<bool>& Pending);
+				// SaveMutex: Held by each save to the file, from start to finish.
+	std::mutex&	SaveMutex() { return m_Saving; }
+
+private:
+	void		Run();
+
+	std::thread	m_Thread;
+	std::mutex	m_Mutex;
+	std::condition_variable	m_Wake;	// Signalled by Request() and Stop()
+	bool		m_bStop;
+	bool		m_bPending;		// m_Pending waits to be served
+	std::promise<bool>	m_Pending;
+	std::shared_future<bool>	m_Future;	// m_Pending's result
+	std::function<bool()>	m_Save;
+	std::mutex	m_Saving;
+};
+
+
+// CMappedFile
+// A file mapped read-only into memory for as long as the object lives. An
+// empty file opens, with nothing mapped. A CMappedFile cannot be copied.
+class CMappedFile
+{
+public:
+				CMappedFile();
+				~CMappedFile();
+
+				// Open: Maps the named file, replacing any mapped before. Returns
+				// false, without reporting, if it cannot be opened or mapped (or
+				// on platforms without mmap).
+	bool		Open(const std::string& szFileName);
+				// Close: Unmaps the file, if one is mapped.
+	void		Close();
+	const char*	Data() const { return m_pData; }
+	std::size_t	Size() const { return m_nSize; }
+
+private:
+				CMappedFile(const CMappedFile&);
+	CMappedFile&	operator=(const CMappedFile&);
+
+	const char*	m_pData;		// NULL when nothing is mapped
+	std::size_t	m_nSize;
+};
+
+// st_deferred
+// What LAZY_LOAD leaves to be parsed: the copy of the file that the Deferred
+// lines of some sections lie in, and how many sections have any. nSections is
+// only ever lowered while Mutex is held, which is also held while a section
+// is parsed; once it reaches zero, every section can be read without it. A
+// copy of this shares the text, but has a mutex of its own.
+typedef struct st_deferred
+{
+	std::shared_ptr<const std::string>	pText;
+	std::atomic<std::size_t>	nSections;
+	std::recursive_mutex	Mutex;
+	bool			bClean;		// Keys parsed now are as saved, not changes to save
+
+	st_deferred() : nSections(0), bClean(false)
+	{
+	}
+
+	st_deferred(const st_deferred& Other)
+		: pText(Other.pText), nSections(Other.nSections.load()), bClean(Other.bClean)
+	{
+	}
+
+	st_deferred& operator=(const st_deferred& Other)
+	{
+		pText = Other.pText;
+		nSections.store(Other.nSections.load());
+		bClean = Other.bClean;
+		return *this;
+	}
+
+	void Swap(st_deferred& Other)
+	{
+		pText.swap(Other.pText);
+		nSections.store(Other.nSections.exchange(nSections.load()));
+		std::swap(bClean, Other.bClean);
+	}
+
+} t_Deferred;
+
+class CDataFile;
+class CDataImage;
+class CDataBatch;
+
+// ChangeCallback
+// Called by a watching CDataFile with the keys that changed in a reload.
+typedef std::function<void(CDataFile& File, const ChangeList& Changes)> ChangeCallback;
+
+#ifdef CDATAFILE_STATS
+// StatsCallback
+// Called at the end of each load and save (see CDataFile::SetStatsCallback)
+// with what was done ("Load", "LoadFiles", "Reload", "Save" or "SaveAsync"),
+// the file (the first, for LoadFiles), whether it worked, the bytes parsed or
+// written, and how long it took.
+typedef std::function<void(const char* szOperation, const std::string& szFileName, bool bOk,
+						   unsigned long long nBytes, unsigned long long nNanoseconds)> StatsCallback;
+#endif
+
 
 // CDataFile
 class CDataFile
@@ -167,63 +1074,207 @@ public:
 				// Constructors & Destructors
 				/////////////////////////////////////////////////////////////////
 				CDataFile();
-				CDataFile(std::string szFileName);
+				CDataFile(const std::string& szFileName);
 	virtual		~CDataFile();
 
 				// File handling methods
 				/////////////////////////////////////////////////////////////////
-	bool		Load(std::string szFileName);
+				// Load: Loads the file, merging it into what is already here.
+				// What is loaded is as it is on disk, so it is not dirty, and
+				// loading alone leaves the destructor nothing to save. Unless it
+				// is our own file (see SetFileName()) loaded into an empty
+				// object, the next Save() writes the file whole.
+	bool		Load(const std::string& szFileName);
+				// LoadFiles: Loads each file, with the same result as calling
+				// Load() on each in turn, but parses them all at once, on up to
+				// nThreads threads (0 for one per processor core). They are then
+				// merged, under a single hold of the lock, in the order given:
+				// where several files set the same key the last one wins, and a
+				// section keeps the comment of the first file to name it.
+				// Returns false if any file could not be loaded; the others are
+				// loaded regardless.
+	bool		LoadFiles(const std::vector<std::string>& Files, unsigned int nThreads = 0);
+				// LoadDirectory: LoadFiles() on every file in the directory whose
+				// name ends with szSuffix, in order of name. Returns false if the
+				// directory could not be read, or any file in it loaded.
+	bool		LoadDirectory(const std::string& szDirectory, const std::string& szSuffix = ".ini",
+							  unsigned int nThreads = 0);
 	bool		Save();
+				// SaveAsync: Saves the file, as Save() does, from a background
+				// thread, and returns at once with the result to come. The file
+				// is rendered when the writer gets to it, so saves asked for while
+				// one waits are all served by it. Changes made after the file is
+				// rendered are left for the next save. Needs THREAD_SAFE, as the
+				// save runs alongside other calls; without it, this is Save().
+	std::shared_future<bool>	SaveAsync();
+				// Reload: Rereads the file, replacing everything in memory with
+				// its contents (where Load() merges them in), then publishes a
+				// snapshot of them. Unsaved changes are lost. Returns false, and
+				// changes nothing, if the file could not be read.
+	bool		Reload();
+
+				// Compiled image methods
+				/////////////////////////////////////////////////////////////////
+
+				// SaveImage: Writes a compiled image of the sections and keys (see
+				// CDataImage.h) to szImageFile, replacing it atomically. If what
+				// is in memory is just what is in our file, the image records the
+				// file's stamp, so that LoadCompiled() will take it for the file.
+	bool		SaveImage(const std::string& szImageFile);
+				// LoadImage: As Load(), from a compiled image rather than text.
+	bool		LoadImage(const std::string& szImageFile);
+				// LoadCompiled: As Load(), but from the file's compiled image,
+				// szFileName + IMAGE_SUFFIX, if that was compiled from the file as
+				// it is now. Otherwise the text is loaded, and the image compiled
+				// again from it, for next time.
+	bool		LoadCompiled(const std::string& szFileName);
+				// PublishShared: Compiles an image, as SaveImage() does, and
+				// publishes it in POSIX shared memory under szName, such as
+				// "/CrapSim", for other processes to attach to and read in place
+				// (see CSharedImage in CDataImage.h). Each call publishes a new
+				// generation, which attached readers move on to with Refresh();
+				// a watched file can be republished from its change callback.
+	bool		PublishShared(const std::string& szName);
+
+				// Snapshot methods
+				/////////////////////////////////////////////////////////////////
+
+				// Publish: Makes a snapshot of the sections and keys as they are
+				// now, and publishes it. Changes made since the last Publish()
+				// or Reload() only reach snapshot readers once this is called.
+	void		Publish();
+				// GetSnapshot: Returns the last snapshot published, or NULL if
+				// there has not been one. This is a single atomic load and
+				// never waits on the lock, even while a reload is under way.
+	SnapshotPtr	GetSnapshot();
+
+				// Watching methods
+				/////////////////////////////////////////////////////////////////
+
+				// StartWatching: Watches the file for changes from a background
+				// thread. When it changes, other than by our own Save(), it is
+				// reloaded as by Reload() and OnChange is called, from that
+				// thread and without our lock held, with the keys whose values
+				// changed (if any did). Unsaved changes are lost in a reload.
+				// nPollMs is the longest, in milliseconds, that a change may go
+				// unnoticed. Sets THREAD_SAFE, as the object is then shared with
+				// the watching thread.
+	void		StartWatching(ChangeCallback OnChange, unsigned int nPollMs = 1000);
+				// StopWatching: Stops watching the file. Safe to call from
+				// OnChange, though the object must not be destroyed from there.
+	void		StopWatching();
 
 				// Data handling methods
 				/////////////////////////////////////////////////////////////////
 
 				// GetValue: Our default access method. Returns the raw t_Str value
 				// Note that this returns keys specific to the given section only.
-	std::string		GetValue(std::string szKey, std::string szSection = std::string(""));
+	std::string		GetValue(t_StrRef szKey, t_StrRef szSection = t_StrRef());
+				// GetValueRef: Returns the value as it is kept, without copying
+				// it. It stays good only until the key is next changed, the file
+				// is loaded or anything is deleted, so do not use it on an object
+				// other threads may be writing to.
+	t_StrRef	GetValueRef(t_StrRef szKey, t_StrRef szSection = t_StrRef());
 				// GetString: Returns the value as a t_Str
-	std::string		GetString(std::string szKey, std::string szSection = std::string(""));
+	std::string		GetString(t_StrRef szKey, t_StrRef szSection = t_StrRef());
 				// GetFloat: Return the value as a float
-	float		GetFloat(std::string szKey, std::string szSection = std::string(""));
+	float		GetFloat(t_StrRef szKey, t_StrRef szSection = t_StrRef());
 				// GetInt: Return the value as an int
-	int			GetInt(std::string szKey, std::string szSection = std::string(""));
+	int			GetInt(t_StrRef szKey, t_StrRef szSection = t_StrRef());
 				// GetBool: Return the value as a bool
-	bool		GetBool(std::string szKey, std::string szSection = std::string(""));
+	bool		GetBool(t_StrRef szKey, t_StrRef szSection = t_StrRef());
 
                 // CheckSectionName: Return true if section name exists; false if not (Maddalone)
-	bool        CheckSectionName(std::string szSectionName);
+	bool        CheckSectionName(t_StrRef szSectionName);
 
 				// SetValue: Sets the value of a given key. Will create the
 				// key if it is not found and AUTOCREATE_KEYS is active.
-	bool		SetValue(std::string szKey, std::string szValue,
-						 std::string szComment = std::string(""), std::string szSection = std::string(""));
+	bool		SetValue(t_StrRef szKey, t_StrRef szValue,
+						 t_StrRef szComment = t_StrRef(), t_StrRef szSection = t_StrRef());
+				// SetValue: As above, but moves the value into the key, rather
+				// than copying it, when it is passed as a temporary or with
+				// std::move.
+	bool		SetValue(t_StrRef szKey, std::string&& szValue,
+						 t_StrRef szComment = t_StrRef(), t_StrRef szSection = t_StrRef());
+	bool		SetValue(t_StrRef szKey, const char* szValue,
+						 t_StrRef szComment = t_StrRef(), t_StrRef szSection = t_StrRef());
 
 				// SetFloat: Sets the value of a given key. Will create the
 				// key if it is not found and AUTOCREATE_KEYS is active.
-	bool		SetFloat(std::string szKey, float fValue,
-						 std::string szComment = std::string(""), std::string szSection = std::string(""));
+	bool		SetFloat(t_StrRef szKey, float fValue,
+						 t_StrRef szComment = t_StrRef(), t_StrRef szSection = t_StrRef());
 
 				// SetInt: Sets the value of a given key. Will create the
 				// key if it is not found and AUTOCREATE_KEYS is active.
-	bool		SetInt(std::string szKey, int nValue,
-						 std::string szComment = std::string(""), std::string szSection = std::string(""));
+	bool		SetInt(t_StrRef szKey, int nValue,
+						 t_StrRef szComment = t_StrRef(), t_StrRef szSection = t_StrRef());
 
 				// SetBool: Sets the value of a given key. Will create the
 				// key if it is not found and AUTOCREATE_KEYS is active.
-	bool		SetBool(std::string szKey, bool bValue,
-						 std::string szComment = std::string(""), std::string szSection = std::string(""));
+	bool		SetBool(t_StrRef szKey, bool bValue,
+						 t_StrRef szComment = t_StrRef(), t_StrRef szSection = t_StrRef());
 
 				// Sets the comment for a given key.
-	bool		SetKeyComment(std::string szKey, std::string szComment, std::string szSection = std::string(""));
+	bool		SetKeyComment(t_StrRef szKey, t_StrRef szComment, t_StrRef szSection = t_StrRef());
 
 				// Sets the comment for a given section
-	bool		SetSectionComment(std::string szSection, std::string szComment);
+	bool		SetSectionComment(t_StrRef szSection, t_StrRef szComment);
 
-				// DeleteKey: Deletes a given key from a specific section
-	bool		DeleteKey(std::string szKey, std::string szFromSection = std::string(""));
+				// DeleteKey: Deletes a given key from a specific section. No other
+				// key moves, so deleting many keys costs time in proportion to
+				// their number, and handles to other keys stay good.
+	bool		DeleteKey(t_StrRef szKey, t_StrRef szFromSection = t_StrRef());
 
 				// DeleteSection: Deletes a given section.
-	bool		DeleteSection(std::string szSection);
+	bool		DeleteSection(t_StrRef szSection);
+
+				// Binding methods
+				/////////////////////////////////////////////////////////////////
+
+				// ReadBindings: Reads each key into the variable its binding
+				// names, all under one hold of the lock. Bindings for the same
+				// section should be kept together, as the section is only looked
+				// up again when it changes. Variables whose keys are not found
+				// are left alone. Returns false if any key was not found.
+	bool		ReadBindings(const t_Binding* pBindings, std::size_t nBindings);
+				// WriteBindings: Sets each key from the variable its binding
+				// names, all under one hold of the lock, creating keys and
+				// sections as SetValue() would. Existing keys keep their
+				// comments. Returns false if any key could not be set.
+	bool		WriteBindings(const t_Binding* pBindings, std::size_t nBindings);
+
+				// Batch methods
+				/////////////////////////////////////////////////////////////////
+
+				// SetValues: Sets each value queued in the batch, in order, with
+				// the same result as calling SetValue() on each in turn, but
+				// under one hold of the lock. New keys are added to the end of
+				// their sections without being looked for among each other;
+				// repeats are settled, and the new keys indexed, once per section
+				// at the end. Returns false if any value could not be set.
+	bool		SetValues(const CDataBatch& Batch);
+
+				// Key handle methods
+				/////////////////////////////////////////////////////////////////
+
+				// GetHandle: Looks up a key, returning a handle to it for use
+				// with the methods below. The key need not exist yet; a handle
+				// to a missing key is looked up by name each time it is used,
+				// until the key turns up.
+	t_KeyHandle	GetHandle(t_StrRef szKey, t_StrRef szSection = t_StrRef());
+				// GetValue, GetString, GetFloat, GetInt, GetBool: As above,
+				// for the key the handle refers to.
+	std::string		GetValue(t_KeyHandle& Handle);
+	std::string		GetString(t_KeyHandle& Handle);
+	float		GetFloat(t_KeyHandle& Handle);
+	int			GetInt(t_KeyHandle& Handle);
+	bool		GetBool(t_KeyHandle& Handle);
+				// SetValue, SetFloat, SetInt, SetBool: As above, for the key the
+				// handle refers to.
+	bool		SetValue(t_KeyHandle& Handle, t_StrRef szValue, t_StrRef szComment = t_StrRef());
+	bool		SetFloat(t_KeyHandle& Handle, float fValue, t_StrRef szComment = t_StrRef());
+	bool		SetInt(t_KeyHandle& Handle, int nValue, t_StrRef szComment = t_StrRef());
+	bool		SetBool(t_KeyHandle& Handle, bool bValue, t_StrRef szComment = t_StrRef());
 
 				// Key/Section handling methods
 				/////////////////////////////////////////////////////////////////
@@ -231,33 +1282,95 @@ public:
 				// CreateKey: Creates a new key in the requested section. The
 	            // Section will be created if it does not exist and the
 				// AUTOCREATE_SECTIONS bit is set.
-	bool		CreateKey(std::string szKey, std::string szValue,
-		                  std::string szComment = std::string(""), std::string szSection = std::string(""));
+	bool		CreateKey(t_StrRef szKey, t_StrRef szValue,
+		                  t_StrRef szComment = t_StrRef(), t_StrRef szSection = t_StrRef());
+				// CreateKey: As above, moving the value in as SetValue() does.
+	bool		CreateKey(t_StrRef szKey, std::string&& szValue,
+		                  t_StrRef szComment = t_StrRef(), t_StrRef szSection = t_StrRef());
+	bool		CreateKey(t_StrRef szKey, const char* szValue,
+		                  t_StrRef szComment = t_StrRef(), t_StrRef szSection = t_StrRef());
 				// CreateSection: Creates the new section if it does not allready
 				// exist. Section is created with no keys.
-	bool		CreateSection(std::string szSection, std::string szComment = std::string(""));
+	bool		CreateSection(t_StrRef szSection, t_StrRef szComment = t_StrRef());
 				// CreateSection: Creates the new section if it does not allready
-				// exist, and copies the keys passed into it into the new section.
-	bool		CreateSection(std::string szSection, std::string szComment, KeyList Keys);
+				// exist, and gives it the keys passed. Pass them with std::move
+				// to have the list taken over, rather than copied.
+	bool		CreateSection(t_StrRef szSection, t_StrRef szComment, KeyList Keys);
 
 				// Utility Methods
 				/////////////////////////////////////////////////////////////////
 				// SectionCount: Returns the number of valid sections in the database.
 	int			SectionCount();
 				// KeyCount: Returns the total number of keys, across all sections.
+				// The count is kept as keys come and go, so this costs nothing.
 	int			KeyCount();
+				// Sections: Returns a range over the sections, in the order they
+				// are saved in, starting with the default (unnamed) section if
+				// there is one. Like GetValueRef(), it is only good until the
+				// next change, so do not use it on an object other threads may be
+				// writing to; iterate over a snapshot (GetSnapshot()) instead.
+	SectionRange	Sections();
+
+				// Query methods
+				/////////////////////////////////////////////////////////////////
+
+				// The names are found by binary search over a sorted order of
+				// them, made the first time a list is queried, and again after
+				// it changes. Matches come back ordered by name, ignoring case,
+				// and are good until the next change, as with Sections().
+
+				// SectionsWithPrefix: Returns the sections whose names start with
+				// szPrefix, ignoring case.
+	SectionViewList	SectionsWithPrefix(t_StrRef szPrefix);
+				// KeysWithPrefix: Returns the keys of the section whose names
+				// start with szPrefix, ignoring case.
+	KeyViewList	KeysWithPrefix(t_StrRef szPrefix, t_StrRef szSection = t_StrRef());
+				// FindSections: Returns the sections whose names match szPattern
+				// (see MatchNoCase), such as "Player*". Only the names starting
+				// with the part of the pattern before its first wildcard are
+				// tried.
+	SectionViewList	FindSections(t_StrRef szPattern);
+				// FindKeys: Returns the keys of the section whose names match
+				// szPattern, as FindSections() does.
+	KeyViewList	FindKeys(t_StrRef szPattern, t_StrRef szSection = t_StrRef());
+
 				// Clear: Initializes the member variables to their default states
 	void		Clear();
                 // Maddalone:
                 // ClearDirty: clear m_bDirty flag - so we don't try to save the file
     void        ClearDirty();
+				// GetDirtySections: Returns the names of the sections that were
+				// created, or had keys added, changed or removed, since the file
+				// was last loaded or saved.
+	std::vector<std::string>	GetDirtySections();
+				// IsSectionDirty: Returns true if the section is listed by
+				// GetDirtySections.
+	bool		IsSectionDirty(t_StrRef szSection);
+				// IsKeyDirty: Returns true if the key was created or changed
+				// since the file was last loaded or saved.
+	bool		IsKeyDirty(t_StrRef szKey, t_StrRef szSection = t_StrRef());
 				// SetFileName: For use when creating the object by hand
 				// initializes the file name so that it can be later saved.
-	void		SetFileName(std::string szFileName);
+	void		SetFileName(const std::string& szFileName);
 				// CommentStr
 				// Parses a string into a proper comment token/comment.
 	std::string		CommentStr(std::string szComment);
 
+#ifdef CDATAFILE_STATS
+				// Instrumentation methods (CDATAFILE_STATS only)
+				/////////////////////////////////////////////////////////////////
+
+				// GetStats: Returns the counts so far. Each is read atomically,
+				// but not all of them at the same instant.
+	t_DataStats	GetStats() const;
+				// ResetStats: Sets every count back to zero.
+	void		ResetStats();
+				// SetStatsCallback: Has OnStats called at the end of every load
+				// and save, without our lock held, from the thread that did it.
+				// Set it before the object is shared between threads.
+	void		SetStatsCallback(StatsCallback OnStats);
+#endif
+
 
 protected:
 				// Note: I've tried to insulate the end user from the internal
@@ -271,9 +1384,145 @@ protected:
 
 				// GetKey: Returns the requested key (if found) from the requested
 				// Section. Returns NULL otherwise.
-	t_Key*		GetKey(std::string szKey, std::string szSection);
+	t_Key*		GetKey(t_StrRef szKey, t_StrRef szSection);
 				// GetSection: Returns the requested section (if found), NULL otherwise.
-	t_Section*	GetSection(std::string szSection);
+	t_Section*	GetSection(t_StrRef szSection);
+				// GetKey: Returns the key the handle refers to, NULL if there is
+				// no such key, first looking the key up again if need be.
+	t_Key*		GetKey(t_KeyHandle& Handle);
+
+				// LoadMapped: Load() through a memory mapping of the file, in
+				// chunks on several threads if bParallel is set. Returns false
+				// if the file could not be opened or mapped.
+	bool		LoadMapped(const std::string& szFileName, bool bParallel = false);
+				// LoadRange: Parses the lines of [pPos, pEnd), carrying szSection
+				// and szComment as LoadLine does.
+	void		LoadRange(const char* pPos, const char* pEnd, std::string& szSection, std::string& szComment);
+				// LoadChunks: LoadRange() on the whole of [pStart, pEnd), split
+				// at section headers into as many as nChunks chunks, and parsed
+				// on a thread for each.
+	void		LoadChunks(const char* pStart, const char* pEnd, std::size_t nChunks);
+				// LoadStream: Load() through a std::fstream.
+	bool		LoadStream(const std::string& szFileName);
+				// LoadSections: Load() from a compiled image, rather than text.
+	void		LoadSections(const CDataImage& Image);
+				// LoadLine: Parses one line of a file being loaded, in which
+				// pEqual is the first separator (or NULL if there is none), as
+				// found by the scan for the end of the line. szSection and
+				// szComment carry the current section and any pending comment
+				// from one line to the next.
+	void		LoadLine(t_StrRef szLine, const char* pEqual, std::string& szSection, std::string& szComment);
+				// Serialize: Renders the file, as Save() writes it, into szOut.
+	void		Serialize(std::string& szOut);
+				// SerializeChanges: Renders just the dirty keys and sections,
+				// as they are appended by INCREMENTAL_SAVE, into szOut. Returns
+				// false if the changes cannot be appended.
+	bool		SerializeChanges(std::string& szOut);
+				// PrepareSave: Renders what Save() would write into Pending.
+				// Returns false, having reported why, if there is nothing to.
+	bool		PrepareSave(t_PendingSave& Pending);
+				// SavedPending: Records the size of the file after Pending.
+	void		SavedPending(const t_PendingSave& Pending);
+				// SaveQueued: Does the work of SaveAsync(), on the writer's
+				// thread. The lock is only held to render the file and to record
+				// it once written, not while writing.
+	bool		SaveQueued();
+				// MarkClean: Clears the dirty keys and sections.
+	void		MarkClean();
+				// MarkSynced: Records that the file on disk now holds exactly
+				// what is in memory, and clears the dirty keys and sections.
+	void		MarkSynced();
+				// IsSynced: Returns true if the file on disk is still the one
+				// recorded by MarkSynced, and only appendable changes have been
+				// made since.
+	bool		IsSynced();
+
+				// StoreValue: Does the work of SetValue() and CreateKey(), without
+				// locking. bAutoKey and bAutoSection stand in for the
+				// AUTOCREATE_KEYS and AUTOCREATE_SECTIONS flags. pValue, if
+				// given, is the string szValue refers to, and is moved from
+				// rather than copied.
+	bool		StoreValue(t_StrRef szKey, t_StrRef szValue, t_StrRef szComment,
+						   t_StrRef szSection, bool bAutoKey, bool bAutoSection,
+						   std::string* pValue = NULL);
+				// UpdateKey: Sets the value and comment of a key of the section,
+				// as StoreValue() does for a key that allready exists.
+	void		UpdateKey(t_Section* pSection, t_Key* pKey, t_StrRef szValue, t_StrRef szComment,
+						  std::string* pValue = NULL);
+				// StoreSection: Does the work of CreateSection(), without locking.
+	bool		StoreSection(t_StrRef szSection, t_StrRef szComment);
+				// Parse: Loads the file into Parsed, a private object, without
+				// locking. Stamp is set to the file as it was before reading.
+	bool		Parse(const std::string& szFileName, CDataFile& Parsed,
+					  t_FileStamp& Stamp, bool& bStamped);
+				// ReloadFile: Does the work of Reload(), filling in pChanges, if
+				// given, with the keys whose values changed.
+	bool		ReloadFile(ChangeList* pChanges);
+				// CheckFile: Called by m_Watcher. Reloads the file, and calls
+				// m_OnChange, if it has changed since it was last checked.
+	void		CheckFile();
+				// Merge: Moves everything loaded into Parsed into this object,
+				// as though it had been loaded here directly.
+	void		Merge(CDataFile& Parsed);
+				// MergeLoaded: Merges Parsed, which was loaded from the named file,
+				// as it was when stamped with Stamp, as Load() does.
+	void		MergeLoaded(CDataFile& Parsed, const std::string& szFileName,
+							const t_FileStamp& Stamp, bool bStamped);
+
+				// IndexSection: Adds the section at the given position in
+				// m_Sections, and all of its keys, to the lookup indexes.
+	void		IndexSection(std::size_t nSection);
+				// IndexKey: Adds the key at the given position in the section's
+				// key list to the section's key index.
+	void		IndexKey(t_Section* pSection, std::size_t nKey);
+				// IndexAppended: Indexes the keys of the section added by
+				// SetValues(), from nFirst on, folding repeats of a key into its
+				// first and dropping new keys left without a value. Returns false
+				// if any key was dropped.
+	bool		IndexAppended(t_Section* pSection, std::size_t nFirst);
+				// RebuildIndex: Recreates the section index from m_Sections. Must
+				// be called whenever sections are removed or reordered.
+	void		RebuildIndex();
+				// CountKeys: Counts the keys of m_Sections into m_nKeys afresh,
+				// for when they have been replaced wholesale.
+	void		CountKeys();
+				// Compact: Removes the tombstones left by DeleteKey() and
+				// DeleteSection(). Everything that walks m_Sections, rather than
+				// looking names up, calls this first, as the tombstones are left
+				// in the lists (though not in the indexes) until then.
+	void		Compact();
+				// CompactSection: Removes the section's deleted keys, and indexes
+				// the rest again.
+	void		CompactSection(t_Section* pSection);
+				// BuildImage: Compiles the sections and keys into an image, for
+				// SaveImage() and PublishShared().
+	bool		BuildImage(std::string& szBuffer);
+				// LoadDeferred: Copies the file in and finds its section headers,
+				// for LAZY_LOAD, leaving each section's lines to be parsed later.
+				// Returns false, without reporting, if the file cannot be mapped.
+	bool		LoadDeferred(const std::string& szFileName);
+				// ParseDeferred: Parses the section's deferred lines, if it has
+				// any. Safe to call with the lock held either way.
+	void		ParseDeferred(t_Section* pSection);
+				// ParseAllDeferred: Parses every deferred section, for those that
+				// go through them all.
+	void		ParseAllDeferred();
+				// QuerySections, QueryKeys: Return the sections (or keys of the
+				// section) whose names start with szPrefix and, if pPattern is
+				// given, match it too, sorting the names first if need be.
+	SectionViewList	QuerySections(t_StrRef szPrefix, const t_StrRef* pPattern);
+	KeyViewList	QueryKeys(t_StrRef szSection, t_StrRef szPrefix, const t_StrRef* pPattern);
+
+#ifdef CDATAFILE_STATS
+				// AddStats: Adds the counts of Other, an object parsed into,
+				// to ours.
+	void		AddStats(const CDataFile& Other);
+				// RecordTiming: Counts a load or save (by nCount, one of
+				// STAT_LOADS and STAT_SAVES) that took nNanoseconds, and passes
+				// it on to m_OnStats.
+	void		RecordTiming(e_Stat nCount, const char* szOperation, const std::string& szFileName,
+							 bool bOk, unsigned long long nBytes, unsigned long long nNanoseconds);
+#endif
 
 
 // Data
@@ -282,8 +1531,71 @@ public:
 
 protected:
 	SectionList	m_Sections;		// Our list of sections
+	HashIndex	m_SectionIndex;	// Positions of m_Sections, by section name
+	t_NameOrder	m_SectionOrder;	// Positions of m_Sections, sorted by section name
 	std::string		m_szFileName;	// The filename to write to
 	bool		m_bDirty;		// Tracks whether or not data has changed.
+
+	bool		m_bSynced;		// m_Stamp is the file as of the last load or save
+	bool		m_bRewrite;		// A change was made that only a full save can write
+	t_FileStamp	m_Stamp;		// The file, as we last loaded or saved it
+	unsigned long long	m_nBaseSize;	// Size of the file at its last full save
+	unsigned long long	m_nLogSize;		// Bytes appended to it since then
+
+	CRWLock		m_Lock;			// Held by public methods when THREAD_SAFE is set
+	SnapshotPtr	m_pSnapshot;	// The last snapshot published; use atomically
+
+	CFileWatcher	m_Watcher;		// Calls CheckFile() while watching
+	CSaveWriter	m_Writer;		// Calls SaveQueued() for SaveAsync()
+	ChangeCallback	m_OnChange;		// Used only by the watching thread
+	t_FileStamp	m_WatchStamp;	// The file, as CheckFile() last saw it
+
+	unsigned long long	m_nGeneration;	// Changed whenever keys or sections move
+	std::size_t	m_nKeys;		// Keys in all of m_Sections, kept up to date
+	std::size_t	m_nDeletedKeys;	// Tombstones among the keys of m_Sections
+	std::size_t	m_nDeletedSections;	// Tombstones among m_Sections
+	t_Deferred	m_Deferred;		// Sections left to be parsed by LAZY_LOAD
+
+#ifdef CDATAFILE_STATS
+	std::atomic<unsigned long long>	m_Stats[STAT_COUNT];	// By e_Stat
+	StatsCallback	m_OnStats;
+#endif
+};
+
+
+// CDataBatch
+// Gathers values to be set in a CDataFile all at once, by Commit(), with the
+// same result as setting them one by one with SetValue(). Best for setting
+// many keys at a time, such as when building a file in memory; see
+// CDataFile::SetValues().
+class CDataBatch
+{
+public:
+				CDataBatch(CDataFile& File);
+
+				// SetValue: Queues a value to be set, as CDataFile::SetValue().
+	void		SetValue(t_StrRef szKey, t_StrRef szValue,
+						 t_StrRef szComment = t_StrRef(), t_StrRef szSection = t_StrRef());
+				// Reserve: Makes room for nCount values in all, and nText
+				// characters of their strings.
+	void		Reserve(std::size_t nCount, std::size_t nText = 0);
+				// Size: Returns the number of values queued.
+	std::size_t	Size() const;
+				// Commit: Sets every value queued, and empties the batch. Returns
+				// false if any value could not be set.
+	bool		Commit();
+				// Clear: Empties the batch, setting nothing.
+	void		Clear();
+
+private:
+	friend class CDataFile;
+
+				// Text: Returns a string of the batch.
+	t_StrRef	Text(const t_BatchString& String) const;
+
+	CDataFile&	m_File;
+	BatchList	m_Values;
+	std::string		m_szText;		// Every string queued, one after another
 };
 
 
@@ -0,0 +1,270 @@
+//
+// CDataImage Class
+//
+// A compiled, binary image of the sections and keys of a CDataFile, for
+// programs that want their settings at startup without parsing any text.
+// The image is written by CDataFile::SaveImage() and is read in place: Open()
+// maps the file into memory, checks that it is sound, and after that every
+// lookup works straight out of the mapping. Names are found by binary search
+// of hash sorted indexes, and each value is held both as text and already
+// converted, as GetInt(), GetFloat() and GetBool() would convert it.
+//
+// The image records the size, modification time and file number of the .ini
+// file it was compiled from, so that a stale image can be told apart from a
+// current one (see CDataFile::LoadCompiled).
+//
+// An image is only read back by a build of the same byte order and word size
+// as the one that wrote it; anything else is rejected by Open(). Every
+// offset in it is relative to its start, so it can be mapped anywhere.
+//
+// Layout, each part starting on an 8 byte boundary;
+//
+//   t_ImageHeader
+//   t_ImageSection	[nSections]		In the order of the file
+//   std::uint32_t	[nSections]		Section positions, sorted by (hash, position)
+//   t_ImageKey		[nKeys]			Grouped by section, each in the order of the file
+//   std::uint32_t	[nKeys]			Key positions, sorted by (hash, position) within each section
+//   char			[nStringsLen]	The string table; each string has a null after it
+//
+
+#ifndef __CDATAIMAGE_H__
+#define __CDATAIMAGE_H__
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "CDataFile.h"
+
+// IMAGE_MAGIC, IMAGE_VERSION
+// Found at the start of every image. The version changes whenever the layout
+// does, and images of any other version are rejected.
+#define IMAGE_MAGIC					"CDFIMAGE"
+#define IMAGE_VERSION				1
+
+// IMAGE_SUFFIX
+// Added to the name of a file to name its compiled image, by
+// CDataFile::LoadCompiled().
+#define IMAGE_SUFFIX				".cdi"
+
+// SHARED_MAGIC
+// Found at the start of the control segment of a shared image (see
+// CSharedImage).
+#define SHARED_MAGIC				"CDFSHARE"
+
+
+// st_imagestring
+// A string in the image's string table, by its offset within the table and
+// its length (not counting the null that follows it).
+typedef struct st_imagestring
+{
+	std::uint32_t	nAt;
+	std::uint32_t	nLen;
+
+} t_ImageString;
+
+// st_imageheader
+// The start of an image. The nxxxAt members are offsets from the start of
+// the image.
+typedef struct st_imageheader
+{
+	char			szMagic[8];		// IMAGE_MAGIC, without its null
+	std::uint32_t	nVersion;		// IMAGE_VERSION
+	std::uint32_t	nByteOrder;		// 0x01020304, as written
+	std::uint32_t	nHashSize;		// sizeof(std::size_t), as written
+	std::uint32_t	nSections;
+	std::uint32_t	nKeys;
+	std::uint32_t	nReserved;
+	std::uint64_t	nSourceSize;	// The t_FileStamp of the file it was compiled from,
+	std::uint64_t	nSourceTime;	// all zero if it was not compiled from a file
+	std::uint64_t	nSourceInode;
+	std::uint64_t	nSectionsAt;
+	std::uint64_t	nSectionIndexAt;
+	std::uint64_t	nKeysAt;
+	std::uint64_t	nKeyIndexAt;
+	std::uint64_t	nStringsAt;
+	std::uint64_t	nStringsLen;
+	std::uint64_t	nImageSize;
+
+} t_ImageHeader;
+
+// st_imagesection
+// One section of an image. Its keys are nKeys keys, from nFirstKey on, of
+// the image's key list, and likewise of its key index.
+typedef struct st_imagesection
+{
+	std::uint64_t	nHash;			// HashNoCase of the name
+	t_ImageString	Name;
+	t_ImageString	Comment;
+	std::uint32_t	nFirstKey;
+	std::uint32_t	nKeys;
+
+} t_ImageSection;
+
+// st_imagekey
+// One key of an image, with its value as text and converted.
+typedef struct st_imagekey
+{
+	std::uint64_t	nHash;			// HashNoCase of the name
+	t_ImageString	Name;
+	t_ImageString	Value;
+	t_ImageString	Comment;
+	std::int32_t	nInt;			// As GetInt() would return it
+	float			fFloat;			// As GetFloat() would return it
+	std::uint32_t	bBool;			// As GetBool() would return it
+	std::uint32_t	nReserved;
+
+} t_ImageKey;
+
+
+/// Class Definitions ///////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////
+
+// CDataImage
+// A compiled image, opened for reading. The read methods behave just like
+// those of CDataFile, and, as nothing in an open image ever changes, any
+// number of threads may call them at once. A CDataImage cannot be copied.
+class CDataImage
+{
+// Methods
+public:
+				CDataImage();
+				~CDataImage();
+
+				// Open: Opens the named image, replacing any open before. Returns
+				// false, and leaves the object closed, if the file cannot be read
+				// or is not a sound image written by this build.
+	bool		Open(const std::string& szImageFile);
+				// OpenShared: As Open(), from the named POSIX shared memory
+				// segment rather than a file.
+	bool		OpenShared(const std::string& szSegment);
+				// Close: Lets go of the image, if one is open.
+	void		Close();
+				// IsOpen: Returns true if an image is open.
+	bool		IsOpen() const;
+				// GetSourceStamp: Returns the stamp of the file the image was
+				// compiled from.
+	t_FileStamp	GetSourceStamp() const;
+
+				// GetValueRef: Returns the value of a key, pointing into the
+				// image, for as long as it stays open. Nothing is copied.
+	t_StrRef	GetValueRef(t_StrRef szKey, t_StrRef szSection = t_StrRef()) const;
+	std::string		GetValue(t_StrRef szKey, t_StrRef szSection = t_StrRef()) const;
+	std::string		GetString(t_StrRef szKey, t_StrRef szSection = t_StrRef()) const;
+	float		GetFloat(t_StrRef szKey, t_StrRef szSection = t_StrRef()) const;
+	int			GetInt(t_StrRef szKey, t_StrRef szSection = t_StrRef()) const;
+	bool		GetBool(t_StrRef szKey, t_StrRef szSection = t_StrRef()) const;
+	bool		CheckSectionName(t_StrRef szSectionName) const;
+	int			SectionCount() const;
+	int			KeyCount() const;
+
+				// GetSections: Copies the image's sections and keys into Sections,
+				// in their original order, without building their key indexes.
+	void		GetSections(SectionList& Sections) const;
+
+				// Build: Compiles Sections into an image, in szOut, recording
+				// Source as the file it was compiled from. Returns false if
+				// they are too big to be held in an image.
+	static bool	Build(const SectionList& Sections, const t_FileStamp& Source, std::string& szOut);
+
+private:
+				CDataImage(const CDataImage&);
+	CDataImage&	operator=(const CDataImage&);
+
+#ifndef WIN32
+	void		MapImage(int nFile, bool bShared);
+#endif
+	bool		Attach();
+	bool		Validate() const;
+	t_StrRef	String(const t_ImageString& String) const;
+	const t_ImageSection*	FindSection(t_StrRef szSection) const;
+	const t_ImageKey*	FindKey(t_StrRef szKey, t_StrRef szSection) const;
+
+// Data
+private:
+	const char*	m_pImage;		// The image, mapped or in m_Buffer; NULL when closed
+	std::size_t	m_nSize;
+	bool		m_bMapped;		// m_pImage is a mapping, to be unmapped
+	std::vector<std::uint64_t>	m_Buffer;	// The image, read in, where it cannot be mapped
+
+	const t_ImageHeader*	m_pHeader;
+	const t_ImageSection*	m_pSections;
+	const std::uint32_t*	m_pSectionIndex;
+	const t_ImageKey*		m_pKeys;
+	const std::uint32_t*	m_pKeyIndex;
+	const char*				m_pStrings;
+};
+
+// st_sharedcontrol
+// The control segment of a shared image, which names the publication to
+// attach to by its generation. Zero means nothing has been published yet.
+typedef struct st_sharedcontrol
+{
+	char			szMagic[8];		// SHARED_MAGIC, without its null
+	std::atomic<std::uint64_t>	nGeneration;	// The latest publication
+
+} t_SharedControl;
+
+// CSharedImage
+// A compiled image that CDataFile::PublishShared() has put in POSIX shared
+// memory under a name, such as "/CrapSim", for every process on the host to
+// read in place, rather than each parsing the file into a copy of its own.
+// Each publication is a segment of its own, named for the name and its
+// generation ("/CrapSim.3"); a small control segment, under the name itself,
+// holds the generation last published. Attach() maps the latest publication
+// and Refresh() moves on to a newer one, once there is one. A replaced
+// publication is unlinked, but stays mapped for as long as anyone is attached
+// to it, so an attached image never changes. A CSharedImage cannot be copied.
+//
+//   CSharedImage Shared;
+//   if ( Shared.Attach("/CrapSim") )
+//       nBet = Shared.Image().GetInt("MinBet", "Table");
+class CSharedImage
+{
+public:
+				CSharedImage();
+				~CSharedImage();
+
+				// Attach: Maps the latest publication under szName, replacing any
+				// attached before. Returns false, and leaves the object detached,
+				// if nothing sound has been published under the name.
+	bool		Attach(const std::string& szName);
+				// Refresh: Maps the latest publication, if it is newer than the
+				// one attached, and returns true if it is. Costs one read of the
+				// control segment otherwise. References into the old image, such
+				// as Image() and what GetValueRef() returned, are then no good.
+	bool		Refresh();
+				// Detach: Lets go of the publication and the control segment.
+	void		Detach();
+				// IsAttached: Returns true if a publication is attached.
+	bool		IsAttached() const;
+				// Generation: The generation of the publication attached, or
+				// zero when detached.
+	std::uint64_t	Generation() const { return m_nGeneration; }
+				// Image: The publication attached, to be read as any other image.
+	const CDataImage&	Image() const { return *m_pImage; }
+
+				// Publish: Puts szImage, a built image, in shared memory under
+				// szName as its next generation, and unlinks the one it replaces.
+				// Returns the generation published, or zero on failure.
+	static std::uint64_t	Publish(const std::string& szName, const std::string& szImage);
+				// Remove: Unlinks the latest publication under szName, and the
+				// control segment, so that nothing more can attach to them.
+	static bool	Remove(const std::string& szName);
+
+private:
+				CSharedImage(const CSharedImage&);
+	CSharedImage&	operator=(const CSharedImage&);
+
+	bool		AttachLatest();
+
+	std::string	m_szName;
+	const t_SharedControl*	m_pControl;	// Mapped read only; NULL when detached
+	std::uint64_t	m_nGeneration;
+	std::unique_ptr<CDataImage>	m_pImage;	// Never NULL
+};
+
+
+#endif
@@ -0,0 +1,182 @@
+//
+// CDataSchema Templates
+//
+// Binds the fields of a struct to keys in a CDataFile, so that a whole struct
+// can be read from, or written back to, the file in one call. Each field is
+// declared once, with its section and key, and the names are hashed when the
+// program is built (see HashName), so reading a struct costs one lookup per
+// section plus one hash probe per field, with no names hashed at run time.
+//
+// An example;
+//
+// struct t_Table
+// {
+//     std::string szType;
+//     int         nMinWager;
+//     int         nMaxWager;
+//     bool        bFieldBetting;
+// };
+//
+// static const CDataField<t_Table> TableFields[] =
+// {
+//     CDataField<t_Table>("Table", "Type",         &t_Table::szType),
+//     CDataField<t_Table>("Table", "MinimumWager", &t_Table::nMinWager),
+//     CDataField<t_Table>("Table", "MaximumWager", &t_Table::nMaxWager),
+//     CDataField<t_Table>("Table", "FieldBets",    &t_Table::bFieldBetting)
+// };
+//
+// static const CDataSchema<t_Table> TableSchema(TableFields);
+//
+// t_Table Table;
+// TableSchema.Read(DataFile, Table);
+// Table.nMaxWager *= 2;
+// TableSchema.Write(DataFile, Table);
+//
+
+#ifndef __CDATASCHEMA_H__
+#define __CDATASCHEMA_H__
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+#include "CDataFile.h"
+
+
+/// Class Definitions ///////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////
+
+// CDataField
+// Declares one field of T: the section and key it is kept under, and the
+// member it is kept in. The section and key names must be string literals
+// (or otherwise outlive the field). A table of fields can be built entirely
+// at compile time.
+template <class T>
+class CDataField
+{
+public:
+	constexpr	CDataField(const char* szSection, const char* szKey, int T::* pInt)
+		: m_szSection(szSection), m_szKey(szKey),
+		  m_nSectionHash(HashName(szSection)), m_nKeyHash(HashName(szKey)),
+		  m_Type(BIND_INT), m_pInt(pInt), m_pFloat(nullptr), m_pBool(nullptr), m_pString(nullptr)
+	{
+	}
+
+	constexpr	CDataField(const char* szSection, const char* szKey, float T::* pFloat)
+		: m_szSection(szSection), m_szKey(szKey),
+		  m_nSectionHash(HashName(szSection)), m_nKeyHash(HashName(szKey)),
+		  m_Type(BIND_FLOAT), m_pInt(nullptr), m_pFloat(pFloat), m_pBool(nullptr), m_pString(nullptr)
+	{
+	}
+
+	constexpr	CDataField(const char* szSection, const char* szKey, bool T::* pBool)
+		: m_szSection(szSection), m_szKey(szKey),
+		  m_nSectionHash(HashName(szSection)), m_nKeyHash(HashName(szKey)),
+		  m_Type(BIND_BOOL), m_pInt(nullptr), m_pFloat(nullptr), m_pBool(pBool), m_pString(nullptr)
+	{
+	}
+
+	constexpr	CDataField(const char* szSection, const char* szKey, std::string T::* pString)
+		: m_szSection(szSection), m_szKey(szKey),
+		  m_nSectionHash(HashName(szSection)), m_nKeyHash(HashName(szKey)),
+		  m_Type(BIND_STRING), m_pInt(nullptr), m_pFloat(nullptr), m_pBool(nullptr), m_pString(pString)
+	{
+	}
+
+				// Bind: Returns the binding of this field of Object.
+	t_Binding	Bind(T& Object) const
+	{
+		t_Binding Binding;
+
+		Binding.szSection = m_szSection;
+		Binding.szKey = m_szKey;
+		Binding.nSectionHash = m_nSectionHash;
+		Binding.nKeyHash = m_nKeyHash;
+		Binding.Type = m_Type;
+
+		switch ( m_Type )
+		{
+			case BIND_INT:
+				Binding.pValue = &(Object.*m_pInt);
+				break;
+			case BIND_FLOAT:
+				Binding.pValue = &(Object.*m_pFloat);
+				break;
+			case BIND_BOOL:
+				Binding.pValue = &(Object.*m_pBool);
+				break;
+			case BIND_STRING:
+				Binding.pValue = &(Object.*m_pString);
+				break;
+		}
+
+		return Binding;
+	}
+
+private:
+	const char*		m_szSection;
+	const char*		m_szKey;
+	std::size_t		m_nSectionHash;
+	std::size_t		m_nKeyHash;
+	e_BindType		m_Type;
+	int T::*		m_pInt;
+	float T::*		m_pFloat;
+	bool T::*		m_pBool;
+	std::string T::*	m_pString;
+};
+
+
+// CDataSchema
+// A table of CDataFields, that together describe how a T is kept in a file.
+// The table is not copied, and must outlive the schema. Keep the fields of
+// each section together: the section is looked up again whenever it changes.
+template <class T>
+class CDataSchema
+{
+public:
+	template <std::size_t N>
+				CDataSchema(const CDataField<T> (&Fields)[N])
+		: m_pFields(Fields), m_nFields(N)
+	{
+	}
+
+				// Read: Sets each field of Object from its key, under a single
+				// hold of the file's lock. Fields whose keys are not found are
+				// left as they were, and false is returned.
+	bool		Read(CDataFile& File, T& Object) const
+	{
+		std::vector<t_Binding> Bindings;
+
+		Bind(Object, Bindings);
+
+		return File.ReadBindings(&Bindings[0], Bindings.size());
+	}
+
+				// Write: Sets each key from its field of Object, under a single
+				// hold of the file's lock, creating keys and sections as
+				// SetValue() would. Returns false if any key could not be set.
+	bool		Write(CDataFile& File, const T& Object) const
+	{
+		std::vector<t_Binding> Bindings;
+
+		// The bindings are only read from when writing.
+		Bind(const_cast<T&>(Object), Bindings);
+
+		return File.WriteBindings(&Bindings[0], Bindings.size());
+	}
+
+private:
+	void		Bind(T& Object, std::vector<t_Binding>& Bindings) const
+	{
+		Bindings.reserve(m_nFields);
+
+		for (std::size_t nField = 0; nField < m_nFields; nField++)
+			Bindings.push_back( m_pFields[nField].Bind(Object) );
+	}
+
+	const CDataField<T>*	m_pFields;
+	std::size_t		m_nFields;
+};
+
+
+#endif
@@ -52,15 +52,40 @@
 #include <ios>
 #include <iostream>
 #include <climits>
+#include <utility>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+#include <deque>
+#include <exception>
 
 // Maddalone
 #include <cstdlib>
 
+#include <sys/stat.h>
+
 #ifdef WIN32
 #include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <syslog.h>
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
 #endif
 
 #include "CDataFile.h"
+#include "CDataImage.h"
 
 // Compatibility Defines ////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////
@@ -70,41 +95,564 @@
 #endif
 
 
+// ReadLock
+// Holds a CRWLock shared while in scope, if the flags passed include
+// THREAD_SAFE.
+class ReadLock
+{
+public:
+	ReadLock(CRWLock& Lock, long nFlags)
+	{
+		m_pLock = (nFlags & THREAD_SAFE) ? &Lock : NULL;
+
+		if ( m_pLock != NULL )
+			m_pLock->LockShared();
+	}
+
+	~ReadLock()
+	{
+		if ( m_pLock != NULL )
+			m_pLock->UnlockShared();
+	}
+
+private:
+	CRWLock*	m_pLock;
+};
+
+// WriteLock
+// Holds a CRWLock exclusively while in scope, if the flags passed include
+// THREAD_SAFE.
+class WriteLock
+{
+public:
+	WriteLock(CRWLock& Lock, long nFlags)
+	{
+		m_pLock = (nFlags & THREAD_SAFE) ? &Lock : NULL;
+
+		if ( m_pLock != NULL )
+			m_pLock->Lock();
+	}
+
+	~WriteLock()
+	{
+		if ( m_pLock != NULL )
+			m_pLock->Unlock();
+	}
+
+private:
+	CRWLock*	m_pLock;
+};
+
+static void SaveDetached(t_PendingSave& Save, std::promise<bool>* pDone);
+
+#ifdef CDATAFILE_STATS
+// st_lookupcount
+// Lookups made by FindSection and FindKey on this thread, by e_Stat, for
+// LookupStats to collect. Only the first STAT_COMPARES + 1 are used.
+typedef struct st_lookupcount
+{
+	unsigned long long	nCount[STAT_COMPARES + 1];
+
+} t_LookupCount;
+
+static thread_local t_LookupCount ThreadLookups;
+
+// LookupStats
+// Collects the lookups made on this thread while in scope, and adds them to
+// the counters given. The thread's counts are put back as they were, so that
+// a public method called by another counts its lookups just the once.
+class LookupStats
+{
+public:
+	LookupStats(std::atomic<unsigned long long>* pStats)
+	{
+		m_pStats = pStats;
+		m_Saved = ThreadLookups;
+		memset(&ThreadLookups, 0, sizeof(ThreadLookups));
+	}
+
+	~LookupStats()
+	{
+		for (int nStat = 0; nStat <= STAT_COMPARES; nStat++)
+		{
+			if ( ThreadLookups.nCount[nStat] > 0 )
+				m_pStats[nStat].fetch_add(ThreadLookups.nCount[nStat], std::memory_order_relaxed);
+		}
+
+		ThreadLookups = m_Saved;
+	}
+
+private:
+	std::atomic<unsigned long long>*	m_pStats;
+	t_LookupCount	m_Saved;
+};
+
+// COUNT_LOOKUPS, COUNT_LOOKUP, COUNT_STAT
+// COUNT_LOOKUPS() goes with the lock in each public method that looks names
+// up. COUNT_LOOKUP counts one lookup on this thread, and COUNT_STAT adds to
+// one of our own counters.
+#define COUNT_LOOKUPS()				LookupStats Counting(m_Stats)
+#define COUNT_LOOKUP(nStat)			(ThreadLookups.nCount[nStat]++)
+#define COUNT_STAT(nStat, nBy)		m_Stats[nStat].fetch_add((nBy), std::memory_order_relaxed)
+
+// ElapsedNs
+// Nanoseconds from Start to now.
+static unsigned long long ElapsedNs(const std::chrono::steady_clock::time_point& Start)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start).count();
+}
+
+// START_TIMING, RECORD_TIMING
+// Time a load or save, from START_TIMING() to RECORD_TIMING, which passes
+// the rest of its arguments to RecordTiming.
+#define START_TIMING()				std::chrono::steady_clock::time_point TimingStart = std::chrono::steady_clock::now()
+#define RECORD_TIMING(nCount, szOperation, szFileName, bOk, nBytes) \
+	RecordTiming(nCount, szOperation, szFileName, bOk, nBytes, ElapsedNs(TimingStart))
+#else
+#define COUNT_LOOKUPS()
+#define COUNT_LOOKUP(nStat)			((void)0)
+#define COUNT_STAT(nStat, nBy)		((void)0)
+#define START_TIMING()
+#define RECORD_TIMING(nCount, szOperation, szFileName, bOk, nBytes)	((void)0)
+#endif
+
+
+// NewGeneration
+// Returns a layout generation (see t_KeyHandle) that no CDataFile has had
+// before, so that a handle can never mistake one object's layout, or an
+// earlier layout of the same object, for the one it was taken in.
+static unsigned long long NewGeneration()
+{
+	static std::atomic<unsigned long long> nLast(0);
+
+	return ++nLast;
+}
+
+// FindSection
+// Looks a section up by name in Index, the index of Sections. Returns NULL if
+// it is not there.
+static const t_Section* FindSection(const SectionList& Sections, const HashIndex& Index, t_StrRef szSection,
+									std::size_t nHash)
+{
+	const t_Section* pFound = NULL;
+	std::size_t nSlot = Index.Start(nHash);
+	std::size_t nPos;
+
+	COUNT_LOOKUP(STAT_SECTION_LOOKUPS);
+
+	while ( Index.Next(nHash, nSlot, nPos) )
+	{
+		const t_Section* pSection = &Sections[nPos];
+
+		COUNT_LOOKUP(STAT_COMPARES);
+
+		if ( (pFound == NULL || pSection < pFound) && CompareNoCase( pSection->szName, szSection ) == 0 )
+			pFound = pSection;
+	}
+
+	if ( pFound == NULL )
+		COUNT_LOOKUP(STAT_SECTION_MISSES);
+
+	return pFound;
+}
+
+static const t_Section* FindSection(const SectionList& Sections, const HashIndex& Index, t_StrRef szSection)
+{
+	return FindSection(Sections, Index, szSection, HashNoCase(szSection));
+}
+
+// FindKey
+// Looks a key up by name in the section's key index. Returns NULL if it is
+// not there.
+static const t_Key* FindKey(const t_Section& Section, t_StrRef szKey, std::size_t nHash)
+{
+	const t_Key* pFound = NULL;
+	std::size_t nSlot = Section.KeyIndex.Start(nHash);
+	std::size_t nPos;
+
+	COUNT_LOOKUP(STAT_KEY_LOOKUPS);
+
+	// Should a key list hold the same name twice, the first one wins, just
+	// as it would in a front to back search of the list.
+	while ( Section.KeyIndex.Next(nHash, nSlot, nPos) )
+	{
+		const t_Key* pKey = &Section.Keys[nPos];
+
+		COUNT_LOOKUP(STAT_COMPARES);
+
+		if ( (pFound == NULL || pKey < pFound) && CompareNoCase( pKey->szKey, szKey ) == 0 )
+			pFound = pKey;
+	}
+
+	if ( pFound == NULL )
+		COUNT_LOOKUP(STAT_KEY_MISSES);
+
+	return pFound;
+}
+
+static const t_Key* FindKey(const t_Section& Section, t_StrRef szKey)
+{
+	return FindKey(Section, szKey, HashNoCase(szKey));
+}
+
+// NameOf
+// The name a section or key is indexed by.
+static t_StrRef NameOf(const t_Section& Section)
+{
+	return Section.szName;
+}
+
+static t_StrRef NameOf(const t_Key& Key)
+{
+	return Key.szKey;
+}
+
+// SortByName
+// Sorts the positions of Items into Order, by name, unless Order is already
+// up to date with Index. The sort is stable, so that of two items with the
+// same name, the one FindSection or FindKey would find comes first.
+template <class ITEM>
+static void SortByName(const std::vector<ITEM>& Items, const HashIndex& Index, t_NameOrder& Order)
+{
+	if ( Order.nChanges == Index.Changes() )
+		return;
+
+	Order.Positions.resize(Items.size());
+	for (std::size_t nPos = 0; nPos < Items.size(); nPos++)
+		Order.Positions[nPos] = nPos;
+
+	std::stable_sort(Order.Positions.begin(), Order.Positions.end(),
+					 [&Items](std::size_t nLeft, std::size_t nRight)
+					 { return CompareNoCase(NameOf(Items[nLeft]), NameOf(Items[nRight])) < 0; });
+
+	Order.nChanges = Index.Changes();
+}
+
+// FindInOrder
+// Adds a view of each item whose name starts with szPrefix, and matches
+// *pPattern if there is one, to Found. The names with the prefix sit
+// together in Order, from the first that is not less than the prefix. Only
+// the first of any items with the same name is taken.
+template <class VIEW, class ITEM>
+static void FindInOrder(const std::vector<ITEM>& Items, const t_NameOrder& Order, t_StrRef szPrefix,
+						const t_StrRef* pPattern, std::vector<VIEW>& Found)
+{
+	std::vector<std::size_t>::const_iterator o_pos =
+		std::lower_bound(Order.Positions.begin(), Order.Positions.end(), szPrefix,
+						 [&Items](std::size_t nPos, t_StrRef szFind)
+						 { return CompareNoCase(NameOf(Items[nPos]), szFind) < 0; });
+	const ITEM* pLast = NULL;
+
+	for (; o_pos != Order.Positions.end(); o_pos++)
+	{
+		const ITEM* pItem = &Items[*o_pos];
+		t_StrRef szName = NameOf(*pItem);
+
+		if ( szName.nLen < szPrefix.nLen
+			 || CompareNoCase(t_StrRef(szName.pStr, szPrefix.nLen), szPrefix) != 0 )
+			break;
+
+		if ( pLast != NULL && CompareNoCase(NameOf(*pLast), szName) == 0 )
+			continue;
+
+		pLast = pItem;
+
+		if ( pPattern == NULL || MatchNoCase(*pPattern, szName) )
+			Found.push_back( VIEW(pItem) );
+	}
+}
+
+// PatternPrefix
+// The part of a pattern before its first wildcard.
+static t_StrRef PatternPrefix(t_StrRef szPattern)
+{
+	std::size_t nLen = 0;
+
+	while ( nLen < szPattern.nLen && szPattern.pStr[nLen] != '*' && szPattern.pStr[nLen] != '?' )
+		nLen++;
+
+	return t_StrRef(szPattern.pStr, nLen);
+}
+
+// ValueToFloat
+// Converts a key's value for GetFloat. Returns FLT_MIN if there is no key,
+// or it has no value. The result is cached in the key.
+static float ValueToFloat(const t_Key* pKey)
+{
+	if ( pKey == NULL )
+		return FLT_MIN;
+
+	t_ValueCache& Cache = pKey->Cache;
+
+	if ( Cache.nValid.load(std::memory_order_acquire) & t_ValueCache::CACHED_FLOAT )
+		return Cache.fFloat.load(std::memory_order_relaxed);
+
+	float fValue = ValueAsFloat(pKey->szValue);
+
+	Cache.fFloat.store(fValue, std::memory_order_relaxed);
+	Cache.nValid.fetch_or(t_ValueCache::CACHED_FLOAT, std::memory_order_release);
+
+	return fValue;
+}
+
+// ValueToInt
+// Converts a key's value for GetInt. Returns INT_MIN if there is no key, or
+// it has no value. The result is cached in the key.
+static int ValueToInt(const t_Key* pKey)
+{
+	if ( pKey == NULL )
+		return INT_MIN;
+
+	t_ValueCache& Cache = pKey->Cache;
+
+	if ( Cache.nValid.load(std::memory_order_acquire) & t_ValueCache::CACHED_INT )
+		return Cache.nInt.load(std::memory_order_relaxed);
+
+	int nValue = ValueAsInt(pKey->szValue);
+
+	Cache.nInt.store(nValue, std::memory_order_relaxed);
+	Cache.nValid.fetch_or(t_ValueCache::CACHED_INT, std::memory_order_release);
+
+	return nValue;
+}
+
+// ValueToBool
+// Converts a key's value for GetBool. Returns false if there is no key. The
+// result is cached in the key.
+static bool ValueToBool(const t_Key* pKey)
+{
+	if ( pKey == NULL )
+		return false;
+
+	t_ValueCache& Cache = pKey->Cache;
+
+	if ( Cache.nValid.load(std::memory_order_acquire) & t_ValueCache::CACHED_BOOL )
+		return Cache.bBool.load(std::memory_order_relaxed);
+
+	bool bValue = ValueAsBool(pKey->szValue);
+
+	Cache.bBool.store(bValue, std::memory_order_relaxed);
+	Cache.nValid.fetch_or(t_ValueCache::CACHED_BOOL, std::memory_order_release);
+
+	return bValue;
+}
+
+
+// t_CharClass
+// Classifies every character, once, by the constants that the loader and
+// Trim() look characters up in, so that each test is a single table lookup
+// rather than a search of the constant.
+enum
+{
+	CHAR_TRIM = 1,			// In WhiteSpace or EqualIndicators; trimmed by Trim()
+	CHAR_EQUAL = 2,			// In EqualIndicators
+	CHAR_COMMENT = 4		// In CommentIndicators
+};
+
+typedef struct st_charclass
+{
+	unsigned char	nClass[256];
+
+	st_charclass()
+	{
+		memset(nClass, 0, sizeof(nClass));
+
+		for (std::size_t nPos = 0; nPos < WhiteSpace.size(); nPos++)
+			nClass[(unsigned char)WhiteSpace[nPos]] |= CHAR_TRIM;
+		for (std::size_t nPos = 0; nPos < EqualIndicators.size(); nPos++)
+			nClass[(unsigned char)EqualIndicators[nPos]] |= CHAR_TRIM | CHAR_EQUAL;
+		for (std::size_t nPos = 0; nPos < CommentIndicators.size(); nPos++)
+			nClass[(unsigned char)CommentIndicators[nPos]] |= CHAR_COMMENT;
+	}
+
+	bool Is(char c, unsigned char nFlags) const
+	{
+		return (nClass[(unsigned char)c] & nFlags) != 0;
+	}
+
+} t_CharClass;
+
+static const t_CharClass CharClass;
+
+// ScanLine
+// Finds the end of the line that starts at pPos: the '\n' that ends it, or
+// pEnd if none does. Also sets pEqual to the line's first separator (one of
+// EqualIndicators), or NULL if it has none. Both are found in the one pass,
+// a block of bytes at a time: 16 bytes with SSE2, or else 8 bytes packed in
+// a word, with a word only examined byte by byte once it is known to hold a
+// newline or separator. Nothing is read outside [pPos, pEnd).
+static const char* ScanLine(const char* pPos, const char* pEnd, const char*& pEqual)
+{
+	pEqual = NULL;
+
+#ifdef __SSE2__
+	const __m128i Newline = _mm_set1_epi8('\n');
+
+	for (; pEnd - pPos >= 16; pPos += 16)
+	{
+		__m128i Block = _mm_loadu_si128((const __m128i*)pPos);
+		unsigned int nNewlines = _mm_movemask_epi8( _mm_cmpeq_epi8(Block, Newline) );
+		unsigned int nEquals = 0;
+
+		if ( pEqual == NULL )
+		{
+			for (std::size_t nChar = 0; nChar < EqualIndicators.size(); nChar++)
+				nEquals |= _mm_movemask_epi8( _mm_cmpeq_epi8(Block, _mm_set1_epi8(EqualIndicators[nChar])) );
+
+			// Only a separator ahead of the first newline is the line's.
+			if ( nNewlines != 0 )
+				nEquals &= (nNewlines & (0u - nNewlines)) - 1;
+
+			if ( nEquals != 0 )
+				pEqual = pPos + __builtin_ctz(nEquals);
+		}
+
+		if ( nNewlines != 0 )
+			return pPos + __builtin_ctz(nNewlines);
+	}
+#else
+	const unsigned long long nOnes = 0x0101010101010101ULL;
+	const unsigned long long nHighs = 0x8080808080808080ULL;
+
+	for (; pEnd - pPos >= 8; pPos += 8)
+	{
+		unsigned long long nWord;
+		unsigned long long nFound;
+
+		memcpy(&nWord, pPos, sizeof(nWord));
+
+		// A byte of x is zero just where the high bit of (x - 1) & ~x is
+		// set, give or take false hits above a true one, which the byte by
+		// byte check below sorts out.
+		nFound = nWord ^ (nOnes * '\n');
+		nFound = (nFound - nOnes) & ~nFound;
+
+		for (std::size_t nChar = 0; pEqual == NULL && nChar < EqualIndicators.size(); nChar++)
+		{
+			unsigned long long nMatch = nWord ^ (nOnes * (unsigned char)EqualIndicators[nChar]);
+
+			nFound |= (nMatch - nOnes) & ~nMatch;
+		}
+
+		if ( (nFound & nHighs) == 0 )
+			continue;
+
+		for (std::size_t nByte = 0; nByte < 8; nByte++)
+		{
+			if ( pPos[nByte] == '\n' )
+				return pPos + nByte;
+
+			if ( pEqual == NULL && CharClass.Is(pPos[nByte], CHAR_EQUAL) )
+				pEqual = pPos + nByte;
+		}
+	}
+#endif
+
+	for (; pPos < pEnd; pPos++)
+	{
+		if ( *pPos == '\n' )
+			return pPos;
+
+		if ( pEqual == NULL && CharClass.Is(*pPos, CHAR_EQUAL) )
+			pEqual = pPos;
+	}
+
+	return pEnd;
+}
+
 // CDataFile
 // Our default contstructor.  If it can load the file, it will do so and populate
 // the section list with the values from the file.
-CDataFile::CDataFile(std::string szFileName)
+CDataFile::CDataFile(const std::string& szFileName)
 {
+#ifdef CDATAFILE_STATS
+	ResetStats();
+#endif
 	m_bDirty = false;
+	m_bSynced = false;
+	m_bRewrite = false;
+	m_nBaseSize = 0;
+	m_nLogSize = 0;
+	m_nGeneration = NewGeneration();
+	m_nKeys = 0;
+	m_nDeletedKeys = 0;
+	m_nDeletedSections = 0;
 	m_szFileName = szFileName;
-	m_Flags = (AUTOCREATE_SECTIONS | AUTOCREATE_KEYS);
-	m_Sections.push_back( *(new t_Section) );
+	m_Flags = (AUTOCREATE_SECTIONS | AUTOCREATE_KEYS | MMAP_LOAD);
+	m_Sections.push_back( t_Section() );
+	IndexSection(0);
 
 	Load(m_szFileName);
 }
 
 CDataFile::CDataFile()
 {
+#ifdef CDATAFILE_STATS
+	ResetStats();
+#endif
+	m_Flags = (AUTOCREATE_SECTIONS | AUTOCREATE_KEYS | MMAP_LOAD);
+	m_nGeneration = NewGeneration();
 	Clear();
-	m_Flags = (AUTOCREATE_SECTIONS | AUTOCREATE_KEYS);
-	m_Sections.push_back( *(new t_Section) );
+	m_Sections.push_back( t_Section() );
+	IndexSection(0);
 }
 
 // ~CDataFile
-// Saves the file if any values have changed since the last save.
+// Saves the file if any values have changed since the last save, or a save
+// that was asked for has yet to start. With ASYNC_SAVE, the file is only
+// rendered here, and written by SaveDetached.
 CDataFile::~CDataFile()
 {
-	if ( m_bDirty )
-		Save();
+	std::promise<bool> Pending;
+
+	m_Watcher.Stop();
+
+	bool bPending = m_Writer.Stop(Pending);
+
+	if ( !m_bDirty && !bPending )
+		return;
+
+	if ( (m_Flags & ASYNC_SAVE) == ASYNC_SAVE )
+	{
+		t_PendingSave Save;
+
+		if ( PrepareSave(Save) )
+			SaveDetached(Save, bPending ? &Pending : NULL);
+		else if ( bPending )
+			Pending.set_value(false);
+
+		return;
+	}
+
+	bool bSaved = Save();
+
+	if ( bPending )
+		Pending.set_value(bSaved);
 }
 
 // Clear
 // Resets the member variables to their defaults
 void CDataFile::Clear()
 {
+	WriteLock Lock(m_Lock, m_Flags);
+
 	m_bDirty = false;
+	m_bSynced = false;
+	m_bRewrite = false;
+	m_nBaseSize = 0;
+	m_nLogSize = 0;
 	m_szFileName = std::string("");
-	m_Sections.clear();
+
+	// Swapping with empty containers hands back all of their memory at once,
+	// where clear() would hold on to it.
+	SectionList().swap(m_Sections);
+	HashIndex().Swap(m_SectionIndex);
+	m_nGeneration = NewGeneration();
+	m_nKeys = 0;
+	m_nDeletedKeys = 0;
+	m_nDeletedSections = 0;
+	m_SectionOrder = t_NameOrder();
+	m_Deferred = t_Deferred();
 }
 
 // Maddalone
@@ -112,15 +660,66 @@ void CDataFile::Clear()
 // Clear the m_bDirty flag so we do not try to save the file
 void CDataFile::ClearDirty()
 {
+	WriteLock Lock(m_Lock, m_Flags);
+
 	m_bDirty = false;
+
+	// The changes being thrown away here are no longer on record, so the
+	// next save can't append them; it will have to write the whole file.
+	MarkSynced();
+	m_bSynced = false;
+}
+
+// GetDirtySections
+// Returns the names of the sections with changes that have yet to be saved.
+std::vector<std::string> CDataFile::GetDirtySections()
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	std::vector<std::string> Names;
+	SectionItor s_pos;
+
+	for (s_pos = m_Sections.begin(); s_pos != m_Sections.end(); s_pos++)
+	{
+		if ( (*s_pos).bDirty && !(*s_pos).bDeleted )
+			Names.push_back( (*s_pos).szName );
+	}
+
+	return Names;
+}
+
+// IsSectionDirty
+// Returns true if the section has changes that have yet to be saved.
+bool CDataFile::IsSectionDirty(t_StrRef szSection)
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	t_Section* pSection = GetSection(szSection);
+
+	return pSection != NULL && pSection->bDirty;
+}
+
+// IsKeyDirty
+// Returns true if the key has changes that have yet to be saved.
+bool CDataFile::IsKeyDirty(t_StrRef szKey, t_StrRef szSection)
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	t_Key* pKey = GetKey(szKey, szSection);
+
+	return pKey != NULL && pKey->bDirty;
 }
 
 
 // SetFileName
 // Set's the m_szFileName member variable. For use when creating the CDataFile
 // object by hand (-vs- loading it from a file
-void CDataFile::SetFileName(std::string szFileName)
+void CDataFile::SetFileName(const std::string& szFileName)
 {
+	WriteLock Lock(m_Lock, m_Flags);
+
+	if ( szFileName != m_szFileName )
+		m_bSynced = false;
+
 	if (m_szFileName.size() != 0 && CompareNoCase(szFileName, m_szFileName) != 0)
 	{
 		m_bDirty = true;
@@ -136,589 +735,3879 @@ void CDataFile::SetFileName(std::string szFileName)
 // Attempts to load in the text file. If successful it will populate the
 // Section list with the key/value pairs found in the file. Note that comments
 // are saved so that they can be rewritten to the file later.
-bool CDataFile::Load(std::string szFileName)
+bool CDataFile::Load(const std::string& szFileName)
 {
-	// We dont want to create a new file here.  If it doesn't exist, just
-	// return false and report the failure.
-	//fstream File(szFileName.c_str(), ios::in|ios::nocreate);
-	std::fstream File(szFileName.c_str(), std::ios::in);
+	// The file is parsed into an object of its own, without holding our lock,
+	// and then merged in.
+	CDataFile Parsed;
+	t_FileStamp Stamp;
+	bool bStamped;
+	START_TIMING();
+	bool bLoaded = Parse(szFileName, Parsed, Stamp, bStamped);
 
-	if ( File.is_open() )
-	{
-		bool bDone = false;
-		bool bAutoKey = (m_Flags & AUTOCREATE_KEYS) == AUTOCREATE_KEYS;
-		bool bAutoSec = (m_Flags & AUTOCREATE_SECTIONS) == AUTOCREATE_SECTIONS;
+	if ( bLoaded )
+		MergeLoaded(Parsed, szFileName, Stamp, bStamped);
 
-		std::string szLine;
-		std::string szComment;
-		char buffer[MAX_BUFFER_LEN];
-		t_Section* pSection = GetSection("");
+	RECORD_TIMING(STAT_LOADS, "Load", szFileName, bLoaded, Parsed.m_Stats[STAT_BYTES_PARSED]);
+
+	return bLoaded;
+}
+
+// st_threadjoiner
+// Joins each of the threads that is still joinable as it goes out of scope,
+// so that threads left running when the function that started them throws
+// are waited for, rather than having their destruction terminate us.
+typedef struct st_threadjoiner
+{
+	std::vector<std::thread>&	Threads;
 
-		// These need to be set, we'll restore the original values later.
-		m_Flags |= AUTOCREATE_KEYS;
-		m_Flags |= AUTOCREATE_SECTIONS;
+	st_threadjoiner(std::vector<std::thread>& Started) : Threads(Started)
+	{
+	}
 
-		while ( !bDone )
+	~st_threadjoiner()
+	{
+		for (std::size_t nThread = 0; nThread < Threads.size(); nThread++)
 		{
-			memset(buffer, 0, MAX_BUFFER_LEN);
-			File.getline(buffer, MAX_BUFFER_LEN);
+			if ( Threads[nThread].joinable() )
+				Threads[nThread].join();
+		}
+	}
 
-			szLine = buffer;
-			Trim(szLine);
+} t_ThreadJoiner;
+
+// LoadFiles
+// Parses the files into objects of their own, one per file, on a pool of
+// threads that each take the next file not yet started. The calling thread
+// merges the results, strictly in file order, into a private object of its
+// own, as each becomes ready, freeing each once merged; when the next file
+// in order has not been started, it parses that one itself. So the outcome
+// is always that of loading the files one after another, however the work
+// was spread about, and only the merged whole is merged in under our lock.
+// Should parsing a file throw, the exception is kept with the file, and
+// thrown again here when it is that file's turn to be merged, once the
+// threads have been told to take no more files. Whatever is thrown, the
+// threads are waited for before it leaves us.
+bool CDataFile::LoadFiles(const std::vector<std::string>& Files, unsigned int nThreads)
+{
+	std::vector< std::unique_ptr<CDataFile> > Parsed(Files.size());
+	std::vector<char> Done(Files.size(), 0);
+	std::vector<char> Loaded(Files.size(), 0);
+	std::vector<std::exception_ptr> Errors(Files.size());
+	std::atomic<std::size_t> nNext(0);
+	std::mutex Mutex;
+	std::condition_variable Ready;
+	std::vector<std::thread> Threads;
+	CDataFile Merged;
+	bool bLoaded = true;
+#ifdef CDATAFILE_STATS
+	unsigned long long nBytes = 0;
+#endif
+	START_TIMING();
 
-			bDone = ( File.eof() || File.bad() || File.fail() );
+	if ( nThreads == 0 )
+		nThreads = std::max(std::thread::hardware_concurrency(), 1u);
 
-			if ( szLine.find_first_of(CommentIndicators) == 0 )
-			{
-				szComment += "\n";
-				szComment += szLine;
-			}
-			else
-			if ( szLine.find_first_of('[') == 0 ) // new section
-			{
-				szLine.erase( 0, 1 );
-				szLine.erase( szLine.find_last_of(']'), 1 );
+	nThreads = (unsigned int)std::min<std::size_t>(nThreads, Files.size());
 
-				CreateSection(szLine, szComment);
-				pSection = GetSection(szLine);
-				szComment = std::string("");
-			}
-			else
-			if ( szLine.size() > 0 ) // we have a key, add this key/value pair
-			{
-				std::string szKey = GetNextWord(szLine);
-				std::string szValue = szLine;
+	auto ParseFile = [&](std::size_t nFile)
+	{
+		std::unique_ptr<CDataFile> pParsed;
+		std::exception_ptr pError;
+		t_FileStamp Stamp;
+		bool bStamped;
+		bool bParsed = false;
 
-				if ( szKey.size() > 0 && szValue.size() > 0 )
-				{
-					SetValue(szKey, szValue, szComment, pSection->szName);
-					szComment = std::string("");
-				}
-			}
+		try
+		{
+			pParsed.reset(new CDataFile);
+			bParsed = Parse(Files[nFile], *pParsed, Stamp, bStamped);
+		}
+		catch (...)
+		{
+			pError = std::current_exception();
 		}
 
-		// Restore the original flag values.
-		if ( !bAutoKey )
-			m_Flags &= ~AUTOCREATE_KEYS;
+		std::lock_guard<std::mutex> Guard(Mutex);
+
+		Parsed[nFile].swap(pParsed);
+		Loaded[nFile] = bParsed;
+		Errors[nFile] = pError;
+		Done[nFile] = 1;
+		Ready.notify_all();
+	};
+
+	auto Run = [&]()
+	{
+		std::size_t nFile;
+
+		while ( (nFile = nNext++) < Files.size() )
+			ParseFile(nFile);
+	};
+
+	t_ThreadJoiner Joiner(Threads);
+
+	for (unsigned int nThread = 1; nThread < nThreads; nThread++)
+		Threads.push_back( std::thread(Run) );
+
+	for (std::size_t nFile = 0; nFile < Files.size(); nFile++)
+	{
+		std::size_t nUnstarted = nFile;
+
+		// Every file ahead of this one has been taken, so if this one has not
+		// been, it is the next to be.
+		if ( nNext.compare_exchange_strong(nUnstarted, nFile + 1) )
+			ParseFile(nFile);
+
+		std::unique_ptr<CDataFile> pParsed;
+
+		{
+			std::unique_lock<std::mutex> Guard(Mutex);
+
+			while ( !Done[nFile] )
+				Ready.wait(Guard);
+
+			pParsed.swap(Parsed[nFile]);
+		}
+
+		if ( Errors[nFile] )
+		{
+			nNext = Files.size();
+			std::rethrow_exception(Errors[nFile]);
+		}
+
+#ifdef CDATAFILE_STATS
+		nBytes += pParsed->m_Stats[STAT_BYTES_PARSED];
+#endif
+
+		if ( Loaded[nFile] )
+			Merged.Merge(*pParsed);
+		else
+			bLoaded = false;
+	}
+
+	for (std::size_t nThread = 0; nThread < Threads.size(); nThread++)
+		Threads[nThread].join();
+
+	{
+		WriteLock Lock(m_Lock, m_Flags);
+
+		Merge(Merged);
+		m_bSynced = false;
+	}
+
+	RECORD_TIMING(STAT_LOADS, "LoadFiles", Files.empty() ? std::string("") : Files[0], bLoaded, nBytes);
+
+	return bLoaded;
+}
+
+// LoadDirectory
+// Lists the directory's regular files with the given suffix, sorts them by
+// name, so that precedence between them does not depend on the order the
+// system lists them in, and loads them with LoadFiles.
+bool CDataFile::LoadDirectory(const std::string& szDirectory, const std::string& szSuffix, unsigned int nThreads)
+{
+	std::vector<std::string> Files;
+	std::string szPrefix = szDirectory;
+
+	if ( szPrefix.size() > 0 && szPrefix[szPrefix.size() - 1] != '/' && szPrefix[szPrefix.size() - 1] != '\\' )
+		szPrefix += "/";
+
+#ifdef WIN32
+	WIN32_FIND_DATAA Found;
+	HANDLE hFind = FindFirstFileA((szPrefix + "*" + szSuffix).c_str(), &Found);
+
+	if ( hFind == INVALID_HANDLE_VALUE )
+	{
+		Report(E_ERROR, "[CDataFile::LoadDirectory] Unable to read directory <%s>.", szDirectory.c_str());
+		return false;
+	}
+
+	do
+	{
+		if ( (Found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0 )
+			Files.push_back(szPrefix + Found.cFileName);
+	}
+	while ( FindNextFileA(hFind, &Found) );
+
+	FindClose(hFind);
+#else
+	DIR* pDir = opendir(szDirectory.c_str());
+	struct dirent* pEntry;
+
+	if ( pDir == NULL )
+	{
+		Report(E_ERROR, "[CDataFile::LoadDirectory] Unable to read directory <%s>.", szDirectory.c_str());
+		return false;
+	}
+
+	while ( (pEntry = readdir(pDir)) != NULL )
+	{
+		std::string szName = pEntry->d_name;
+		struct stat Stat;
+
+		if ( szName.size() < szSuffix.size() || szName.compare(szName.size() - szSuffix.size(), szSuffix.size(), szSuffix) != 0 )
+			continue;
+
+		if ( stat((szPrefix + szName).c_str(), &Stat) == 0 && S_ISREG(Stat.st_mode) )
+			Files.push_back(szPrefix + szName);
+	}
+
+	closedir(pDir);
+#endif
+
+	std::sort(Files.begin(), Files.end());
+
+	return LoadFiles(Files, nThreads);
+}
+
+// Reload
+// Reads the file again into an object of its own, and makes a snapshot of
+// it, without holding our lock. Then, under the lock, swaps the result in for
+// what we had and publishes the snapshot, so that snapshot readers are never
+// held up and lock holders are only held up for the swap.
+bool CDataFile::Reload()
+{
+	return ReloadFile(NULL);
+}
+
+// StartWatching
+// Starts the watcher thread on our file, taking the file as it is now as the
+// starting point: only later changes to it cause a reload.
+void CDataFile::StartWatching(ChangeCallback OnChange, unsigned int nPollMs)
+{
+	std::string szFileName;
+
+	StopWatching();
+
+	m_Flags |= THREAD_SAFE;
+
+	{
+		ReadLock Lock(m_Lock, m_Flags);
+		szFileName = m_szFileName;
+	}
+
+	m_OnChange = OnChange;
+	m_WatchStamp = t_FileStamp();
+	GetFileStamp(szFileName, m_WatchStamp);
+
+	m_Watcher.Start(szFileName, std::bind(&CDataFile::CheckFile, this), nPollMs);
+}
+
+// StopWatching
+// Stops the watcher thread.
+void CDataFile::StopWatching()
+{
+	m_Watcher.Stop();
+}
+
+// Publish
+// Copies the sections and keys into a new snapshot, and swaps it in for the
+// last one. The lock is held throughout, so no change can slip in between.
+// It is held exclusively, as any deleted keys and sections are compacted
+// away first.
+void CDataFile::Publish()
+{
+	WriteLock Lock(m_Lock, m_Flags);
+
+	ParseAllDeferred();
+	Compact();
+
+	std::atomic_store(&m_pSnapshot,
+					  std::make_shared<const CDataSnapshot>(m_Sections, m_SectionIndex));
+}
+
+// GetSnapshot
+// Returns the last snapshot published, or NULL.
+SnapshotPtr CDataFile::GetSnapshot()
+{
+	return std::atomic_load(&m_pSnapshot);
+}
+
+
+// WriteBuffer
+// Writes all of szBuffer to an open file and closes it, flushing it to disk
+// first if bSync is set. Returns false if any part of that fails.
+static bool WriteBuffer(FILE* pFile, const std::string& szBuffer, bool bSync)
+{
+	bool bWritten = fwrite(szBuffer.data(), 1, szBuffer.size(), pFile) == szBuffer.size();
+
+	bWritten = fflush(pFile) == 0 && bWritten;
+
+	if ( bSync && bWritten )
+	{
+#ifdef WIN32
+		bWritten = _commit(_fileno(pFile)) == 0;
+#else
+		bWritten = fsync(fileno(pFile)) == 0;
+#endif
+	}
+
+	return fclose(pFile) == 0 && bWritten;
+}
+
+// SaveBuffer
+// Replaces the contents of szFileName with szBuffer, in place.
+static bool SaveBuffer(const std::string& szFileName, const std::string& szBuffer, bool bSync)
+{
+	FILE* pFile = fopen(szFileName.c_str(), "w");
+
+	if ( pFile == NULL )
+		return false;
+
+	return WriteBuffer(pFile, szBuffer, bSync);
+}
+
+// AppendBuffer
+// Adds szBuffer to the end of szFileName, starting it on a new line.
+static bool AppendBuffer(const std::string& szFileName, const std::string& szBuffer, bool bSync)
+{
+	FILE* pFile = fopen(szFileName.c_str(), "rb");
+	bool bNewLine = false;
+
+	if ( pFile == NULL )
+		return false;
+
+	// A file edited by hand may not end with a newline.
+	if ( fseek(pFile, -1, SEEK_END) == 0 )
+		bNewLine = fgetc(pFile) != '\n';
+
+	fclose(pFile);
+
+	if ( (pFile = fopen(szFileName.c_str(), "a")) == NULL )
+		return false;
+
+	if ( bNewLine && fputc('\n', pFile) == EOF )
+	{
+		fclose(pFile);
+		return false;
+	}
+
+	return WriteBuffer(pFile, szBuffer, bSync);
+}
+
+// SaveBufferAtomic
+// Replaces the contents of szFileName with szBuffer by writing a temporary
+// file in the same directory and renaming it over szFileName. The rename is
+// atomic, so szFileName always holds either the old or the new contents.
+// bBinary writes the buffer exactly as it is, where text mode would not.
+static bool SaveBufferAtomic(const std::string& szFileName, const std::string& szBuffer, bool bSync,
+							 bool bBinary = false)
+{
+#ifdef WIN32
+	std::string szTempName = szFileName + ".tmp";
+	FILE* pFile = fopen(szTempName.c_str(), bBinary ? "wb" : "w");
+
+	if ( pFile == NULL )
+		return false;
+
+	if ( !WriteBuffer(pFile, szBuffer, bSync) ||
+		 !MoveFileExA(szTempName.c_str(), szFileName.c_str(),
+					  MOVEFILE_REPLACE_EXISTING | (bSync ? MOVEFILE_WRITE_THROUGH : 0)) )
+	{
+		remove(szTempName.c_str());
+		return false;
+	}
+
+	return true;
+#else
+	std::string szTempName = szFileName + ".XXXXXX";
+	struct stat Stat;
+	int nFile = mkstemp(&szTempName[0]);
+
+	if ( nFile < 0 )
+		return false;
+
+	// mkstemp creates the file readable by its owner only. Give it the
+	// permissions of the file it replaces, or, for a new file, the ones
+	// fopen would have.
+	if ( stat(szFileName.c_str(), &Stat) == 0 )
+	{
+		fchmod(nFile, Stat.st_mode & 07777);
+	}
+	else
+	{
+		mode_t nMask = umask(0);
+
+		umask(nMask);
+		fchmod(nFile, 0666 & ~nMask);
+	}
+
+	FILE* pFile = fdopen(nFile, bBinary ? "wb" : "w");
+
+	if ( pFile == NULL )
+	{
+		close(nFile);
+		unlink(szTempName.c_str());
+		return false;
+	}
+
+	if ( !WriteBuffer(pFile, szBuffer, bSync) || rename(szTempName.c_str(), szFileName.c_str()) != 0 )
+	{
+		unlink(szTempName.c_str());
+		return false;
+	}
+
+	// Make the rename itself durable.
+	if ( bSync )
+	{
+		std::string::size_type nSlash = szFileName.find_last_of('/');
+		std::string szDir = (nSlash == std::string::npos) ? std::string(".") : szFileName.substr(0, nSlash + 1);
+		int nDir = open(szDir.c_str(), O_RDONLY);
+
+		if ( nDir >= 0 )
+		{
+			fsync(nDir);
+			close(nDir);
+		}
+	}
+
+	return true;
+#endif
+}
+
+// WritePending
+// Appends, rewrites or atomically replaces the file, as the save calls for.
+static bool WritePending(const t_PendingSave& Pending)
+{
+	if ( Pending.bAppend )
+		return Pending.szBuffer.size() == 0 || AppendBuffer(Pending.szFileName, Pending.szBuffer, Pending.bSync);
+
+	if ( Pending.bAtomic )
+		return SaveBufferAtomic(Pending.szFileName, Pending.szBuffer, Pending.bSync);
+
+	return SaveBuffer(Pending.szFileName, Pending.szBuffer, Pending.bSync);
+}
+
+// t_DetachedSaves
+// The saves handed over by objects destroyed with ASYNC_SAVE set, and the
+// CSaveWriter that writes them, one after another. A save queued for a file
+// that allready has one waiting is folded into it: a whole file replaces what
+// was waiting, and appended blocks are added to its end, which either way
+// leaves the file just as writing both would have. The queue is never
+// destroyed, so that objects destroyed at exit can always reach it. It is
+// stopped instead, as the program exits, by t_DetachedExit; every save left
+// is written then, and any save queued after that is written by the caller.
+typedef struct st_detachedsave
+{
+	t_PendingSave	Save;
+	std::vector< std::promise<bool> >	Done;	// Each waiting on the save
+
+} t_DetachedSave;
+
+typedef struct st_detachedsaves
+{
+	std::mutex		Mutex;		// Guards Queue and bStopped
+	std::deque<t_DetachedSave>	Queue;
+	bool			bStopped;	// Saves are written by the caller from now on
+	CSaveWriter		Writer;		// Calls WriteAll()
+
+	st_detachedsaves() : bStopped(false)
+	{
+	}
+
+	// WriteAll: Writes each save queued, until there are none.
+	bool WriteAll()
+	{
+		std::unique_lock<std::mutex> Guard(Mutex);
+
+		while ( !Queue.empty() )
+		{
+			t_DetachedSave Save( std::move(Queue.front()) );
+
+			Queue.pop_front();
+			Guard.unlock();
+
+			bool bWritten = WritePending(Save.Save);
+
+			if ( !bWritten )
+				Report(E_ERROR, "[CDataFile::~CDataFile] Unable to save file <%s>.", Save.Save.szFileName.c_str());
+
+			for (std::size_t nDone = 0; nDone < Save.Done.size(); nDone++)
+				Save.Done[nDone].set_value(bWritten);
+
+			Guard.lock();
+		}
+
+		return true;
+	}
+
+	// Stop: Waits for the writer, and writes whatever it left.
+	void Stop()
+	{
+		std::promise<bool> Pending;
+
+		{
+			std::lock_guard<std::mutex> Guard(Mutex);
+
+			bStopped = true;
+		}
+
+		if ( Writer.Stop(Pending) )
+			Pending.set_value(true);
+
+		WriteAll();
+	}
+
+} t_DetachedSaves;
+
+typedef struct st_detachedexit
+{
+	t_DetachedSaves*	pSaves;
+
+	st_detachedexit(t_DetachedSaves* pDetached) : pSaves(pDetached)
+	{
+	}
+
+	~st_detachedexit()
+	{
+		pSaves->Stop();
+	}
+
+} t_DetachedExit;
+
+// SaveDetached
+// Queues a prepared save to be written by the detached writer, which pDone,
+// if given, is kept for. Once the writer has stopped, at exit, it is written
+// here. Whether it has is decided under the queue's mutex, which the writer
+// stops under, so no save is ever queued that will not be written.
+static void SaveDetached(t_PendingSave& Save, std::promise<bool>* pDone)
+{
+	static t_DetachedSaves* pSaves = new t_DetachedSaves;
+	static t_DetachedExit Exit(pSaves);
+	t_DetachedSaves& Saves = *pSaves;
+	std::unique_lock<std::mutex> Guard(Saves.Mutex);
+
+	if ( Saves.bStopped )
+	{
+		Guard.unlock();
+
+		bool bWritten = WritePending(Save);
+
+		if ( pDone != NULL )
+			pDone->set_value(bWritten);
+
+		return;
+	}
+
+	std::deque<t_DetachedSave>::iterator d_pos;
+
+	for (d_pos = Saves.Queue.begin(); d_pos != Saves.Queue.end(); d_pos++)
+	{
+		if ( (*d_pos).Save.szFileName == Save.szFileName )
+			break;
+	}
+
+	if ( d_pos == Saves.Queue.end() )
+	{
+		Saves.Queue.push_back( t_DetachedSave() );
+		d_pos = Saves.Queue.end() - 1;
+		(*d_pos).Save = std::move(Save);
+	}
+	else if ( Save.bAppend )
+	{
+		(*d_pos).Save.szBuffer += Save.szBuffer;
+		(*d_pos).Save.bSync = (*d_pos).Save.bSync || Save.bSync;
+	}
+	else
+		(*d_pos).Save = std::move(Save);
+
+	if ( pDone != NULL )
+		(*d_pos).Done.push_back( std::move(*pDone) );
+
+	// Asked for with the mutex held, so that Stop() cannot come between
+	// queueing the save and waking the writer for it.
+	Saves.Writer.Request( []() { return pSaves->WriteAll(); } );
+}
+
+// Save
+// Attempts to save the Section list and keys to the file. Note that if Load
+// was never called (the CDataFile object was created manually), then you
+// must set the m_szFileName variable before calling save.
+bool CDataFile::Save()
+{
+	t_PendingSave Pending;
+	bool bSaved = false;
+	START_TIMING();
+
+	{
+		std::lock_guard<std::mutex> Saving(m_Writer.SaveMutex());
+		WriteLock Lock(m_Lock, m_Flags);
+
+		if ( !PrepareSave(Pending) )
+			return false;
+
+		if ( WritePending(Pending) )
+		{
+			MarkSynced();
+			SavedPending(Pending);
+			m_bDirty = false;
+			bSaved = true;
+		}
+		else
+			Report(E_ERROR, "[CDataFile::Save] Unable to save file.");
+	}
+
+	RECORD_TIMING(STAT_SAVES, "Save", Pending.szFileName, bSaved, bSaved ? Pending.szBuffer.size() : 0);
+
+	return bSaved;
+}
+
+// SaveAsync
+// Asks our writer to call SaveQueued. Without THREAD_SAFE, nothing would keep
+// the writer's thread off the object while the caller's is using it, so the
+// file is saved here and now instead.
+std::shared_future<bool> CDataFile::SaveAsync()
+{
+	if ( (m_Flags & THREAD_SAFE) == 0 )
+	{
+		std::promise<bool> Saved;
+
+		Saved.set_value( Save() );
+
+		return Saved.get_future().share();
+	}
+
+	return m_Writer.Request( [this]() { return SaveQueued(); } );
+}
+
+// PrepareSave
+// Renders what is to be saved: just the changes, when INCREMENTAL_SAVE can
+// append them, or else the whole file.
+bool CDataFile::PrepareSave(t_PendingSave& Pending)
+{
+	Compact();
+
+	// Deferred sections are as saved, and need not be parsed to append the
+	// changes, unless they are changes themselves.
+	if ( !m_Deferred.bClean )
+		ParseAllDeferred();
+
+	if ( m_Sections.size() == 0 )
+	{
+		// no point in saving
+		Report(E_INFO, "[CDataFile::Save] Nothing to save.");
+		return false;
+	}
+
+	if ( m_szFileName.size() == 0 )
+	{
+		Report(E_ERROR, "[CDataFile::Save] No filename has been set.");
+		return false;
+	}
+
+	Pending.szFileName = m_szFileName;
+	Pending.bAtomic = (m_Flags & ATOMIC_SAVE) == ATOMIC_SAVE;
+	Pending.bSync = (m_Flags & SYNC_SAVE) == SYNC_SAVE;
+	Pending.bAppend = (m_Flags & INCREMENTAL_SAVE) == INCREMENTAL_SAVE && !Pending.bAtomic
+					  && IsSynced() && SerializeChanges(Pending.szBuffer)
+					  && m_nLogSize + Pending.szBuffer.size() <= m_nBaseSize;
+
+	if ( !Pending.bAppend )
+	{
+		ParseAllDeferred();
+		Serialize(Pending.szBuffer);
+	}
+
+	return true;
+}
+
+// SavedPending
+// Appended blocks are counted against the size of the last full save, so that
+// the file is rewritten once they outgrow it.
+void CDataFile::SavedPending(const t_PendingSave& Pending)
+{
+	if ( Pending.bAppend )
+		m_nLogSize += Pending.szBuffer.size();
+	else
+	{
+		m_nBaseSize = Pending.szBuffer.size();
+		m_nLogSize = 0;
+	}
+}
+
+// SaveQueued
+// Renders the file under the lock and clears the dirty flags at once, since
+// what has been rendered is as good as saved: anything changed from then on
+// is dirty again, for the next save. The file is written with the lock let
+// go, and then stamped. Should the write fail, the whole file is left to be
+// rewritten by the next save, as the flags can no longer say what is missing.
+bool CDataFile::SaveQueued()
+{
+	t_PendingSave Pending;
+	bool bWritten;
+	START_TIMING();
+
+	{
+		std::lock_guard<std::mutex> Saving(m_Writer.SaveMutex());
+
+		{
+			WriteLock Lock(m_Lock, m_Flags);
+
+			if ( !PrepareSave(Pending) )
+				return false;
+
+			MarkClean();
+			m_bSynced = false;
+			m_bDirty = false;
+		}
+
+		bWritten = WritePending(Pending);
+
+		WriteLock Lock(m_Lock, m_Flags);
+
+		if ( !bWritten )
+		{
+			Report(E_ERROR, "[CDataFile::SaveAsync] Unable to save file.");
+			m_bRewrite = true;
+			m_bDirty = true;
+		}
+		else
+		{
+			SavedPending(Pending);
+
+			if ( Pending.szFileName == m_szFileName )
+				m_bSynced = GetFileStamp(m_szFileName, m_Stamp);
+		}
+	}
+
+	RECORD_TIMING(STAT_SAVES, "SaveAsync", Pending.szFileName, bWritten, bWritten ? Pending.szBuffer.size() : 0);
+
+	return bWritten;
+}
+
+// SaveImage
+// Compiles the sections and keys into an image, under the lock, and then
+// writes it out. The image is always written to a temporary file and renamed
+// into place, as anyone who has the old image mapped would otherwise see it
+// change under them.
+bool CDataFile::SaveImage(const std::string& szImageFile)
+{
+	std::string szBuffer;
+
+	if ( !BuildImage(szBuffer) )
+		return false;
+
+	if ( !SaveBufferAtomic(szImageFile, szBuffer, (m_Flags & SYNC_SAVE) == SYNC_SAVE, true) )
+	{
+		Report(E_ERROR, "[CDataFile::SaveImage] Unable to save image <%s>.", szImageFile.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// PublishShared
+// Compiles the image under the lock, as SaveImage does, and publishes it with
+// the lock let go.
+bool CDataFile::PublishShared(const std::string& szName)
+{
+	std::string szBuffer;
+
+	if ( !BuildImage(szBuffer) )
+		return false;
+
+	if ( CSharedImage::Publish(szName, szBuffer) == 0 )
+	{
+		Report(E_ERROR, "[CDataFile::PublishShared] Unable to publish <%s>.", szName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// BuildImage
+// Compiles the sections and keys into an image, under the lock. If what is in
+// memory is just what is in our file, the image is stamped with the file's
+// stamp. An image of anything the file does not hold is stamped as coming
+// from no file at all, so LoadCompiled never mistakes it for one.
+bool CDataFile::BuildImage(std::string& szBuffer)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	t_FileStamp Source;
+	bool bMatches = IsSynced();
+
+	ParseAllDeferred();
+	Compact();
+
+	for (std::size_t nSection = 0; bMatches && nSection < m_Sections.size(); nSection++)
+		bMatches = !m_Sections[nSection].bDirty;
+
+	if ( bMatches )
+		Source = m_Stamp;
+
+	return CDataImage::Build(m_Sections, Source, szBuffer);
+}
+
+// LoadImage
+// Copies the sections and keys out of an image, into an object of its own,
+// and merges them in as Load() would the text. If the image was compiled from
+// our file as it is now, the result is as if the file had been loaded.
+bool CDataFile::LoadImage(const std::string& szImageFile)
+{
+	CDataImage Image;
+	CDataFile Parsed;
+	t_FileStamp Stamp;
+	std::string szFileName;
+
+	if ( !Image.Open(szImageFile) )
+	{
+		Report(E_ERROR, "[CDataFile::LoadImage] Unable to open <%s>, or it is not an image.", szImageFile.c_str());
+		return false;
+	}
+
+	Parsed.LoadSections(Image);
+
+	{
+		ReadLock Lock(m_Lock, m_Flags);
+		szFileName = m_szFileName;
+	}
+
+	bool bStamped = GetFileStamp(szFileName, Stamp) && Stamp == Image.GetSourceStamp();
+
+	MergeLoaded(Parsed, szFileName, Stamp, bStamped);
+
+	return true;
+}
+
+// LoadCompiled
+// Uses the file's image if its recorded stamp is the file's stamp now. If
+// not, the text is parsed, and compiled, stamped as it was before it was
+// read, so that an image is never stamped newer than what it holds. Failing
+// to write the image (in a read-only directory, say) does not fail the load.
+bool CDataFile::LoadCompiled(const std::string& szFileName)
+{
+	std::string szImageFile = szFileName + IMAGE_SUFFIX;
+	CDataImage Image;
+	CDataFile Parsed;
+	t_FileStamp Stamp;
+	bool bStamped;
+
+	if ( GetFileStamp(szFileName, Stamp) && Image.Open(szImageFile) && Image.GetSourceStamp() == Stamp )
+	{
+		Parsed.LoadSections(Image);
+		Image.Close();
+
+		MergeLoaded(Parsed, szFileName, Stamp, true);
+
+		return true;
+	}
+
+	Image.Close();
+
+	if ( !Parse(szFileName, Parsed, Stamp, bStamped) )
+		return false;
+
+	// The image is compiled from every key.
+	Parsed.ParseAllDeferred();
+
+	std::string szBuffer;
+
+	if ( CDataImage::Build(Parsed.m_Sections, bStamped ? Stamp : t_FileStamp(), szBuffer)
+		 && !SaveBufferAtomic(szImageFile, szBuffer, false, true) )
+	{
+		Report(E_INFO, "[CDataFile::LoadCompiled] Unable to save image <%s>.", szImageFile.c_str());
+	}
+
+	MergeLoaded(Parsed, szFileName, Stamp, bStamped);
+
+	return true;
+}
+
+// SetKeyComment
+// Set the comment of a given key. Returns true if the key is not found.
+bool CDataFile::SetKeyComment(t_StrRef szKey, t_StrRef szComment, t_StrRef szSection)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	t_Key* pKey = GetKey(szKey, szSection);
+
+	if ( pKey == NULL )
+		return false;
+
+	pKey->szComment.assign(szComment.pStr, szComment.nLen);
+	pKey->bDirty = true;
+	GetSection(szSection)->bDirty = true;
+	m_bDirty = true;
+
+	return true;
+}
+
+// SetSectionComment
+// Set the comment for a given section. Returns false if the section
+// was not found.
+bool CDataFile::SetSectionComment(t_StrRef szSection, t_StrRef szComment)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	t_Section* pSection = GetSection(szSection);
+
+	if ( pSection == NULL )
+		return false;
+
+	pSection->szComment.assign(szComment.pStr, szComment.nLen);
+	pSection->bDirty = true;
+	m_bDirty = true;
+
+	// A section's comment is written ahead of its first header, so it can
+	// only be changed in place by rewriting the file.
+	if ( !pSection->bNew )
+		m_bRewrite = true;
+
+	return true;
+}
+
+
+// SetValue
+// Given a key, a value and a section, this function will attempt to locate the
+// Key within the given section, and if it finds it, change the keys value to
+// the new value. If it does not locate the key, it will create a new key with
+// the proper value and place it in the section requested.
+bool CDataFile::SetValue(t_StrRef szKey, t_StrRef szValue, t_StrRef szComment, t_StrRef szSection)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+
+	return StoreValue(szKey, szValue, szComment, szSection,
+					  (m_Flags & AUTOCREATE_KEYS) == AUTOCREATE_KEYS,
+					  (m_Flags & AUTOCREATE_SECTIONS) == AUTOCREATE_SECTIONS);
+}
+
+// SetValue
+// As above, but takes the value to keep, rather than copying it.
+bool CDataFile::SetValue(t_StrRef szKey, std::string&& szValue, t_StrRef szComment, t_StrRef szSection)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+
+	return StoreValue(szKey, szValue, szComment, szSection,
+					  (m_Flags & AUTOCREATE_KEYS) == AUTOCREATE_KEYS,
+					  (m_Flags & AUTOCREATE_SECTIONS) == AUTOCREATE_SECTIONS, &szValue);
+}
+
+// SetValue
+// Picks the copying SetValue for a string literal, which would otherwise fit
+// both of the above equally well.
+bool CDataFile::SetValue(t_StrRef szKey, const char* szValue, t_StrRef szComment, t_StrRef szSection)
+{
+	return SetValue(szKey, t_StrRef(szValue), szComment, szSection);
+}
+
+// SetFloat
+// Passes the given float to SetValue as a string
+bool CDataFile::SetFloat(t_StrRef szKey, float fValue, t_StrRef szComment, t_StrRef szSection)
+{
+	char szStr[64];
+
+	snprintf(szStr, 64, "%f", fValue);
+
+	return SetValue(szKey, szStr, szComment, szSection);
+}
+
+// SetInt
+// Passes the given int to SetValue as a string
+bool CDataFile::SetInt(t_StrRef szKey, int nValue, t_StrRef szComment, t_StrRef szSection)
+{
+	char szStr[64];
+
+	snprintf(szStr, 64, "%d", nValue);
+
+	return SetValue(szKey, szStr, szComment, szSection);
+
+}
+
+// SetBool
+// Passes the given bool to SetValue as a string
+bool CDataFile::SetBool(t_StrRef szKey, bool bValue, t_StrRef szComment, t_StrRef szSection)
+{
+	return SetValue(szKey, bValue ? "True" : "False", szComment, szSection);
+}
+
+// GetValue
+// Returns the key value as a t_Str object. A return value of
+// t_Str("") indicates that the key could not be found.
+std::string CDataFile::GetValue(t_StrRef szKey, t_StrRef szSection)
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	t_Key* pKey = GetKey(szKey, szSection);
+
+	return (pKey == NULL) ? std::string("") : pKey->szValue;
+}
+
+// GetValueRef
+// As GetValue, but points at the value where it is kept, copying nothing.
+t_StrRef CDataFile::GetValueRef(t_StrRef szKey, t_StrRef szSection)
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	t_Key* pKey = GetKey(szKey, szSection);
+
+	return (pKey == NULL) ? t_StrRef() : t_StrRef(pKey->szValue);
+}
+
+// GetString
+// Returns the key value as a t_Str object. A return value of
+// t_Str("") indicates that the key could not be found.
+std::string CDataFile::GetString(t_StrRef szKey, t_StrRef szSection)
+{
+	return GetValue(szKey, szSection);
+}
+
+// GetFloat
+// Returns the key value as a float type. Returns FLT_MIN if the key is
+// not found.
+float CDataFile::GetFloat(t_StrRef szKey, t_StrRef szSection)
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+
+	return ValueToFloat( GetKey(szKey, szSection) );
+}
+
+// GetInt
+// Returns the key value as an integer type. Returns INT_MIN if the key is
+// not found.
+int	CDataFile::GetInt(t_StrRef szKey, t_StrRef szSection)
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+
+	return ValueToInt( GetKey(szKey, szSection) );
+}
+
+// GetBool
+// Returns the key value as a bool type. Returns false if the key is
+// not found.
+bool CDataFile::GetBool(t_StrRef szKey, t_StrRef szSection)
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+
+	return ValueToBool( GetKey(szKey, szSection) );
+}
+
+// CheckSectionName
+// Return true if section name exists.  False if not.
+bool CDataFile::CheckSectionName(t_StrRef szSectionName)
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+    bool bValue = false;
+    t_Section* pSection = GetSection(szSectionName);
+
+    if (pSection != NULL)
+        bValue = true;
+
+    return bValue;
+}
+
+// DeleteSection
+// Delete a specific section. Returns false if the section cannot be
+// found or true when sucessfully deleted.
+bool CDataFile::DeleteSection(t_StrRef szSection)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	t_Section* pSection = GetSection(szSection);
+
+	if ( pSection == NULL )
+		return false;
+
+	// The section is left in place, as a tombstone, so that no other section
+	// moves; its keys are let go of now. Handles to them must look them up
+	// again, and find them gone, so the generation changes.
+	m_SectionIndex.Erase(HashNoCase(pSection->szName), pSection - &m_Sections[0]);
+	m_nKeys -= pSection->Keys.size() - pSection->nDeleted;
+	m_nDeletedKeys -= pSection->nDeleted;
+	KeyList().swap(pSection->Keys);
+	HashIndex().Swap(pSection->KeyIndex);
+	pSection->nDeleted = 0;
+	pSection->bDeleted = true;
+	m_nDeletedSections++;
+	m_bRewrite = true;
+	m_bDirty = true;
+	m_nGeneration = NewGeneration();
+
+	if ( m_nDeletedSections * 2 > m_Sections.size() )
+		Compact();
+
+	return true;
+}
+
+// DeleteKey
+// Delete a specific key in a specific section. Returns false if the key
+// cannot be found or true when sucessfully deleted.
+bool CDataFile::DeleteKey(t_StrRef szKey, t_StrRef szFromSection)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	t_Section* pSection = GetSection(szFromSection);
+	std::size_t nHash = HashNoCase(szKey);
+	t_Key* pKey;
+
+	if ( pSection == NULL || (pKey = const_cast<t_Key*>( FindKey(*pSection, szKey, nHash) )) == NULL )
+		return false;
+
+	// The key is left in place, as a tombstone, so that no other key moves,
+	// and handles to them stay good; handles to it check bDeleted. Once
+	// tombstones are half of the section it is compacted, which keeps the
+	// cost of deleting many keys in proportion to their number.
+	pSection->KeyIndex.Erase(nHash, pKey - &pSection->Keys[0]);
+	std::string().swap(pKey->szKey);
+	std::string().swap(pKey->szValue);
+	std::string().swap(pKey->szComment);
+	pKey->Cache = t_ValueCache();
+	pKey->bDeleted = true;
+	pSection->nDeleted++;
+	pSection->bDirty = true;
+	m_nDeletedKeys++;
+	m_nKeys--;
+	m_bRewrite = true;
+	m_bDirty = true;
+
+	if ( pSection->nDeleted * 2 > pSection->Keys.size() )
+		CompactSection(pSection);
+
+	return true;
+}
+
+// ReadBindings
+// Reads the keys into the bound variables. Each section is looked up once
+// for the run of bindings that name it, and each key by its own hash, so no
+// names are hashed here at all.
+bool CDataFile::ReadBindings(const t_Binding* pBindings, std::size_t nBindings)
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	const t_Section* pSection = NULL;
+	const t_Binding* pLast = NULL;
+	bool bAll = true;
+
+	for (std::size_t nPos = 0; nPos < nBindings; nPos++)
+	{
+		const t_Binding& Binding = pBindings[nPos];
+
+		if ( pLast == NULL || pLast->nSectionHash != Binding.nSectionHash
+			 || CompareNoCase(pLast->szSection, Binding.szSection) != 0 )
+		{
+			pSection = FindSection(m_Sections, m_SectionIndex, Binding.szSection, Binding.nSectionHash);
+			pLast = &Binding;
+
+			if ( pSection != NULL )
+				ParseDeferred(const_cast<t_Section*>(pSection));
+		}
+
+		const t_Key* pKey = (pSection == NULL) ? NULL : FindKey(*pSection, Binding.szKey, Binding.nKeyHash);
+
+		// GetInt and friends treat a key without a value as missing, too.
+		if ( pKey == NULL || pKey->szValue.size() == 0 )
+		{
+			bAll = false;
+			continue;
+		}
+
+		switch ( Binding.Type )
+		{
+			case BIND_INT:
+				*(int*)Binding.pValue = ValueToInt(pKey);
+				break;
+			case BIND_FLOAT:
+				*(float*)Binding.pValue = ValueToFloat(pKey);
+				break;
+			case BIND_BOOL:
+				*(bool*)Binding.pValue = ValueToBool(pKey);
+				break;
+			case BIND_STRING:
+				*(std::string*)Binding.pValue = pKey->szValue;
+				break;
+		}
+	}
+
+	return bAll;
+}
+
+// WriteBindings
+// Sets the keys from the bound variables, formatting each value as SetInt,
+// SetFloat or SetBool would.
+bool CDataFile::WriteBindings(const t_Binding* pBindings, std::size_t nBindings)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	bool bAutoKey = (m_Flags & AUTOCREATE_KEYS) == AUTOCREATE_KEYS;
+	bool bAutoSection = (m_Flags & AUTOCREATE_SECTIONS) == AUTOCREATE_SECTIONS;
+	std::string szComment;
+	bool bAll = true;
+
+	for (std::size_t nPos = 0; nPos < nBindings; nPos++)
+	{
+		const t_Binding& Binding = pBindings[nPos];
+		char szStr[64];
+		t_StrRef szValue;
+
+		switch ( Binding.Type )
+		{
+			case BIND_INT:
+				snprintf(szStr, 64, "%d", *(const int*)Binding.pValue);
+				szValue = szStr;
+				break;
+			case BIND_FLOAT:
+				snprintf(szStr, 64, "%f", *(const float*)Binding.pValue);
+				szValue = szStr;
+				break;
+			case BIND_BOOL:
+				szValue = *(const bool*)Binding.pValue ? "True" : "False";
+				break;
+			case BIND_STRING:
+				szValue = *(const std::string*)Binding.pValue;
+				break;
+		}
+
+		const t_Section* pSection = FindSection(m_Sections, m_SectionIndex, Binding.szSection, Binding.nSectionHash);
+
+		if ( pSection != NULL )
+			ParseDeferred(const_cast<t_Section*>(pSection));
+
+		const t_Key* pKey = (pSection == NULL) ? NULL : FindKey(*pSection, Binding.szKey, Binding.nKeyHash);
+
+		// StoreValue replaces the comment, so hand it the one there is.
+		szComment = (pKey == NULL) ? std::string("") : pKey->szComment;
+
+		if ( !StoreValue(Binding.szKey, szValue, szComment, Binding.szSection, bAutoKey, bAutoSection) )
+			bAll = false;
+	}
+
+	return bAll;
+}
+
+// SetValues
+// Sets the values in three passes. The first finds each value's section,
+// reusing the last one found while the values name the same section, and
+// sets the keys the section allready had in place. Every other key is only
+// counted, against its section, so that the second pass can make room for all
+// of a section's new keys at once before moving them onto its end, unindexed,
+// at no cost of a lookup among each other. The last pass settles the new keys
+// of each section that gained some, by way of IndexAppended.
+bool CDataFile::SetValues(const CDataBatch& Batch)
+{
+	const std::size_t nNone = (std::size_t)-1;
+	const BatchList& Values = Batch.m_Values;
+	WriteLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	bool bAutoKey = (m_Flags & AUTOCREATE_KEYS) == AUTOCREATE_KEYS;
+	bool bAutoSection = (m_Flags & AUTOCREATE_SECTIONS) == AUTOCREATE_SECTIONS;
+	std::vector<std::size_t> Targets(Values.size(), nNone);
+	std::vector<std::size_t> NewKeys(m_Sections.size(), 0);
+	std::vector<std::size_t> FirstNew;
+	std::vector<std::size_t> Touched;
+	std::size_t nSection = nNone;
+	bool bAll = true;
+
+	for (std::size_t nValue = 0; nValue < Values.size(); nValue++)
+	{
+		const t_BatchValue& Value = Values[nValue];
+		t_StrRef szSection = Batch.Text(Value.Section);
+
+		if ( nSection == nNone || (Value.Section.nAt != Values[nValue - 1].Section.nAt
+			 && CompareNoCase(Batch.Text(Values[nValue - 1].Section), szSection) != 0) )
+		{
+			const t_Section* pFound = FindSection(m_Sections, m_SectionIndex, szSection);
+
+			if ( pFound == NULL )
+			{
+				nSection = nNone;
+
+				if ( !bAutoSection || !StoreSection(szSection, t_StrRef()) )
+				{
+					bAll = false;
+					continue;
+				}
+
+				pFound = &m_Sections.back();
+				NewKeys.push_back(0);
+			}
+
+			ParseDeferred(const_cast<t_Section*>(pFound));
+			nSection = pFound - &m_Sections[0];
+		}
+
+		t_Section* pSection = &m_Sections[nSection];
+		t_StrRef szKey = Batch.Text(Value.Key);
+		t_Key* pKey = NULL;
+
+		// A section with nothing indexed, such as one just created, has no
+		// keys to find.
+		if ( pSection->KeyIndex.Size() > 0 )
+			pKey = const_cast<t_Key*>( FindKey(*pSection, szKey) );
+
+		if ( pKey != NULL )
+			UpdateKey(pSection, pKey, Batch.Text(Value.Value), Batch.Text(Value.Comment));
+		else if ( !bAutoKey )
+			bAll = false;
+		else
+		{
+			if ( NewKeys[nSection]++ == 0 )
+				Touched.push_back(nSection);
+
+			Targets[nValue] = nSection;
+		}
+	}
+
+	FirstNew.resize(m_Sections.size(), 0);
+
+	for (std::size_t nPos = 0; nPos < Touched.size(); nPos++)
+	{
+		t_Section& Section = m_Sections[Touched[nPos]];
+
+		FirstNew[Touched[nPos]] = Section.Keys.size();
+		COUNT_STAT(STAT_ALLOCATIONS, NewKeys[Touched[nPos]]
+				   + (Section.Keys.size() + NewKeys[Touched[nPos]] > Section.Keys.capacity() ? 1 : 0));
+		Section.Keys.reserve(Section.Keys.size() + NewKeys[Touched[nPos]]);
+	}
+
+	for (std::size_t nValue = 0; nValue < Values.size(); nValue++)
+	{
+		if ( Targets[nValue] == nNone )
+			continue;
+
+		const t_BatchValue& Value = Values[nValue];
+		KeyList& Keys = m_Sections[Targets[nValue]].Keys;
+
+		Keys.push_back( t_Key() );
+		m_nKeys++;
+
+		t_Key& Key = Keys.back();
+		t_StrRef szKey = Batch.Text(Value.Key);
+		t_StrRef szValue = Batch.Text(Value.Value);
+		t_StrRef szComment = Batch.Text(Value.Comment);
+
+		Key.szKey.assign(szKey.pStr, szKey.nLen);
+		Key.szValue.assign(szValue.pStr, szValue.nLen);
+		Key.szComment.assign(szComment.pStr, szComment.nLen);
+		Key.bDirty = true;
+	}
+
+	for (std::size_t nPos = 0; nPos < Touched.size(); nPos++)
+	{
+		if ( !IndexAppended(&m_Sections[Touched[nPos]], FirstNew[Touched[nPos]]) )
+			bAll = false;
+	}
+
+	return bAll;
+}
+
+// GetHandle
+// Looks the key up, and returns a handle to it.
+t_KeyHandle CDataFile::GetHandle(t_StrRef szKey, t_StrRef szSection)
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	t_KeyHandle Handle;
+
+	Handle.szKey.assign(szKey.pStr, szKey.nLen);
+	Handle.szSection.assign(szSection.pStr, szSection.nLen);
+	GetKey(Handle);
+
+	return Handle;
+}
+
+// GetValue
+// Returns the value of the key the handle refers to, or t_Str("") if the key
+// could not be found.
+std::string CDataFile::GetValue(t_KeyHandle& Handle)
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	t_Key* pKey = GetKey(Handle);
+
+	return (pKey == NULL) ? std::string("") : pKey->szValue;
+}
+
+// GetString
+// Same as GetValue.
+std::string CDataFile::GetString(t_KeyHandle& Handle)
+{
+	return GetValue(Handle);
+}
+
+// GetFloat
+// Returns the value of the key the handle refers to as a float type, or
+// FLT_MIN if the key is not found.
+float CDataFile::GetFloat(t_KeyHandle& Handle)
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+
+	return ValueToFloat( GetKey(Handle) );
+}
+
+// GetInt
+// Returns the value of the key the handle refers to as an integer type, or
+// INT_MIN if the key is not found.
+int CDataFile::GetInt(t_KeyHandle& Handle)
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+
+	return ValueToInt( GetKey(Handle) );
+}
+
+// GetBool
+// Returns the value of the key the handle refers to as a bool type, or false
+// if the key is not found.
+bool CDataFile::GetBool(t_KeyHandle& Handle)
+{
+	ReadLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+
+	return ValueToBool( GetKey(Handle) );
+}
+
+// SetValue
+// Sets the value of the key the handle refers to. A key that is not found is
+// created (and its section) as SetValue would by name, and the handle is
+// pointed at it.
+bool CDataFile::SetValue(t_KeyHandle& Handle, t_StrRef szValue, t_StrRef szComment)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	t_Key* pKey = GetKey(Handle);
+
+	if ( pKey == NULL )
+	{
+		if ( !StoreValue(Handle.szKey, szValue, szComment, Handle.szSection,
+						 (m_Flags & AUTOCREATE_KEYS) == AUTOCREATE_KEYS,
+						 (m_Flags & AUTOCREATE_SECTIONS) == AUTOCREATE_SECTIONS) )
+			return false;
+
+		GetKey(Handle);
+		return true;
+	}
+
+	UpdateKey(&m_Sections[Handle.nSection], pKey, szValue, szComment, NULL);
+
+	return true;
+}
+
+// SetFloat
+// Passes the given float to SetValue as a string
+bool CDataFile::SetFloat(t_KeyHandle& Handle, float fValue, t_StrRef szComment)
+{
+	char szStr[64];
+
+	snprintf(szStr, 64, "%f", fValue);
+
+	return SetValue(Handle, szStr, szComment);
+}
+
+// SetInt
+// Passes the given int to SetValue as a string
+bool CDataFile::SetInt(t_KeyHandle& Handle, int nValue, t_StrRef szComment)
+{
+	char szStr[64];
+
+	snprintf(szStr, 64, "%d", nValue);
+
+	return SetValue(Handle, szStr, szComment);
+}
+
+// SetBool
+// Passes the given bool to SetValue as a string
+bool CDataFile::SetBool(t_KeyHandle& Handle, bool bValue, t_StrRef szComment)
+{
+	return SetValue(Handle, bValue ? "True" : "False", szComment);
+}
+
+// CreateKey
+// Given a key, a value and a section, this function will attempt to locate the
+// Key within the given section, and if it finds it, change the keys value to
+// the new value. If it does not locate the key, it will create a new key with
+// the proper value and place it in the section requested.
+bool CDataFile::CreateKey(t_StrRef szKey, t_StrRef szValue, t_StrRef szComment, t_StrRef szSection)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+
+	return StoreValue(szKey, szValue, szComment, szSection, true,
+					  (m_Flags & AUTOCREATE_SECTIONS) == AUTOCREATE_SECTIONS);
+}
+
+// CreateKey
+// As above, but takes the value to keep, rather than copying it.
+bool CDataFile::CreateKey(t_StrRef szKey, std::string&& szValue, t_StrRef szComment, t_StrRef szSection)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+
+	return StoreValue(szKey, szValue, szComment, szSection, true,
+					  (m_Flags & AUTOCREATE_SECTIONS) == AUTOCREATE_SECTIONS, &szValue);
+}
+
+// CreateKey
+// As SetValue, for a string literal.
+bool CDataFile::CreateKey(t_StrRef szKey, const char* szValue, t_StrRef szComment, t_StrRef szSection)
+{
+	return CreateKey(szKey, t_StrRef(szValue), szComment, szSection);
+}
+
+
+// CreateSection
+// Given a section name, this function first checks to see if the given section
+// allready exists in the list or not, if not, it creates the new section and
+// assigns it the comment given in szComment.  The function returns true if
+// sucessfully created, or false otherwise.
+bool CDataFile::CreateSection(t_StrRef szSection, t_StrRef szComment)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+
+	return StoreSection(szSection, szComment);
+}
+
+// CreateSection
+// Given a section name, this function first checks to see if the given section
+// allready exists in the list or not, if not, it creates the new section and
+// assigns it the comment given in szComment.  The function returns true if
+// sucessfully created, or false otherwise. This version accpets a KeyList
+// and sets up the newly created Section with the keys in the list.
+bool CDataFile::CreateSection(t_StrRef szSection, t_StrRef szComment, KeyList Keys)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+
+	if ( !StoreSection(szSection, szComment) )
+		return false;
+
+	t_Section* pSection = GetSection(szSection);
+
+	if ( !pSection )
+		return false;
+
+	// Keys is our own copy, and the section is new and empty, so the list
+	// can simply be taken over whole.
+	pSection->Keys.swap(Keys);
+	pSection->KeyIndex.Reserve(pSection->Keys.size());
+	m_nKeys += pSection->Keys.size();
+
+	for (std::size_t nKey = 0; nKey < pSection->Keys.size(); nKey++)
+	{
+		pSection->Keys[nKey].bDirty = true;
+		IndexKey(pSection, nKey);
+	}
+
+	m_bDirty = true;
+
+	return true;
+}
+
+// SectionCount
+// Simply returns the number of sections in the list.
+int CDataFile::SectionCount()
+{
+	ReadLock Lock(m_Lock, m_Flags);
+
+	return (int)(m_Sections.size() - m_nDeletedSections);
+}
+
+// KeyCount
+// Returns the total number of keys contained within all the sections.
+int CDataFile::KeyCount()
+{
+	ReadLock Lock(m_Lock, m_Flags);
+
+	ParseAllDeferred();
+
+	return (int)m_nKeys;
+}
+
+// Sections
+// Returns a range over m_Sections as they stand, once any deleted keys and
+// sections have been compacted away.
+SectionRange CDataFile::Sections()
+{
+	WriteLock Lock(m_Lock, m_Flags);
+
+	ParseAllDeferred();
+	Compact();
+
+	return MakeSectionRange(m_Sections);
+}
+
+// SectionsWithPrefix
+SectionViewList CDataFile::SectionsWithPrefix(t_StrRef szPrefix)
+{
+	return QuerySections(szPrefix, NULL);
+}
+
+// KeysWithPrefix
+KeyViewList CDataFile::KeysWithPrefix(t_StrRef szPrefix, t_StrRef szSection)
+{
+	return QueryKeys(szSection, szPrefix, NULL);
+}
+
+// FindSections
+SectionViewList CDataFile::FindSections(t_StrRef szPattern)
+{
+	return QuerySections(PatternPrefix(szPattern), &szPattern);
+}
+
+// FindKeys
+KeyViewList CDataFile::FindKeys(t_StrRef szPattern, t_StrRef szSection)
+{
+	return QueryKeys(szSection, PatternPrefix(szPattern), &szPattern);
+}
+
+
+// Protected Member Functions ///////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////
+
+// LoadMapped
+// Maps the whole file read-only and hands each line to LoadLine straight out
+// of the mapping. Nothing is copied until LoadLine stores a section, key or
+// comment. Returns false, without reporting, if the file cannot be opened or
+// mapped, so that Load can fall back to LoadStream.
+bool CDataFile::LoadMapped(const std::string& szFileName, bool bParallel)
+{
+	CMappedFile File;
+	std::string szSection;
+	std::string szComment;
+
+	if ( !File.Open(szFileName) )
+		return false;
+
+	// There is nothing to map in an empty file, but it loaded just fine.
+	if ( File.Size() == 0 )
+		return true;
+
+#ifndef WIN32
+	madvise((void*)File.Data(), File.Size(), MADV_SEQUENTIAL);
+#endif
+	COUNT_STAT(STAT_BYTES_PARSED, File.Size());
+
+	const char* pPos = File.Data();
+	const char* pEnd = pPos + File.Size();
+	std::size_t nChunks = 1;
+
+	if ( bParallel )
+		nChunks = std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1u),
+										File.Size() / PARALLEL_CHUNK_LEN);
+
+	if ( nChunks > 1 )
+		LoadChunks(pPos, pEnd, nChunks);
+	else
+		LoadRange(pPos, pEnd, szSection, szComment);
+
+	return true;
+}
+
+// LoadRange
+// Parses each line of [pPos, pEnd) in turn.
+void CDataFile::LoadRange(const char* pPos, const char* pEnd, std::string& szSection, std::string& szComment)
+{
+	while ( pPos < pEnd )
+	{
+		const char* pEqual;
+		const char* pEol = ScanLine(pPos, pEnd, pEqual);
+
+		LoadLine(t_StrRef(pPos, pEol - pPos), pEqual, szSection, szComment);
+		pPos = pEol + 1;
+	}
+}
+
+// FindHeader
+// Returns the start of the first line after pPos that is a section header,
+// once trimmed as LoadLine trims it, or pEnd if there is none.
+static const char* FindHeader(const char* pPos, const char* pEnd)
+{
+	while ( pPos < pEnd )
+	{
+		const char* pEol = (const char*)memchr(pPos, '\n', pEnd - pPos);
+
+		if ( pEol == NULL )
+			return pEnd;
+
+		pPos = pEol + 1;
+
+		const char* pFirst = pPos;
+
+		while ( pFirst < pEnd && *pFirst != '\n' && CharClass.Is(*pFirst, CHAR_TRIM) )
+			pFirst++;
+
+		if ( pFirst < pEnd && *pFirst == '[' )
+			return pPos;
+	}
+
+	return pEnd;
+}
+
+// LoadChunks
+// Cuts [pStart, pEnd) into as many as nChunks chunks of about the same size,
+// each but the first starting with a section header, and parses every chunk
+// but the first into an object of its own on a thread of its own, while this
+// thread parses the first straight into us. The chunks are then stitched on
+// in file order. Each chunk's parse began knowing nothing of what came before
+// its header, so the header line is parsed again here, carrying on the
+// section and pending comment left by the chunk before it; that gives the
+// header the comment it would have had in a single pass (or none, if it names
+// a section we allready have), and the rest of the chunk is then merged in
+// just as its keys would have been set. Should a chunk's parse throw, the
+// exception is kept with the chunk and thrown again here when the chunk is
+// reached; whatever is thrown, the threads are waited for before it leaves
+// us.
+void CDataFile::LoadChunks(const char* pStart, const char* pEnd, std::size_t nChunks)
+{
+	typedef struct st_chunk
+	{
+		const char*		pStart;
+		std::unique_ptr<CDataFile>	pParsed;
+		std::string		szSection;
+		std::string		szComment;
+		std::exception_ptr	pError;		// What the parse threw, if it did
+
+	} t_Chunk;
+
+	std::size_t nSize = pEnd - pStart;
+	std::vector<t_Chunk> Chunks(1);
+	std::vector<std::thread> Threads;
+	t_ThreadJoiner Joiner(Threads);
+	std::string szSection;
+	std::string szComment;
+
+	Chunks[0].pStart = pStart;
+
+	for (std::size_t nChunk = 1; nChunk < nChunks; nChunk++)
+	{
+		const char* pSplit = FindHeader(std::max(Chunks.back().pStart, pStart + nSize / nChunks * nChunk), pEnd);
+
+		if ( pSplit == pEnd )
+			break;
+
+		Chunks.push_back( t_Chunk() );
+		Chunks.back().pStart = pSplit;
+	}
+
+	for (std::size_t nChunk = 1; nChunk < Chunks.size(); nChunk++)
+	{
+		t_Chunk& Chunk = Chunks[nChunk];
+		const char* pChunkEnd = nChunk + 1 < Chunks.size() ? Chunks[nChunk + 1].pStart : pEnd;
+
+		Chunk.pParsed.reset(new CDataFile);
+		Threads.push_back( std::thread([&Chunk, pChunkEnd]()
+		{
+			try
+			{
+				Chunk.pParsed->LoadRange(Chunk.pStart, pChunkEnd, Chunk.szSection, Chunk.szComment);
+			}
+			catch (...)
+			{
+				Chunk.pError = std::current_exception();
+			}
+
+			// The chunk is only ever merged, never saved.
+			Chunk.pParsed->m_bDirty = false;
+		}) );
+	}
+
+	LoadRange(pStart, Chunks.size() > 1 ? Chunks[1].pStart : pEnd, szSection, szComment);
+
+	for (std::size_t nChunk = 1; nChunk < Chunks.size(); nChunk++)
+	{
+		t_Chunk& Chunk = Chunks[nChunk];
+		const char* pEqual;
+		const char* pEol = ScanLine(Chunk.pStart, pEnd, pEqual);
+
+		Threads[nChunk - 1].join();
+
+		if ( Chunk.pError )
+			std::rethrow_exception(Chunk.pError);
+
+		LoadLine(t_StrRef(Chunk.pStart, pEol - Chunk.pStart), pEqual, szSection, szComment);
+		Merge(*Chunk.pParsed);
+#ifdef CDATAFILE_STATS
+		AddStats(*Chunk.pParsed);
+#endif
+		Chunk.pParsed.reset();
+
+		szSection.swap(Chunk.szSection);
+		szComment.swap(Chunk.szComment);
+	}
+}
+
+// HeaderName
+// Sets szSection to the name given by a section header line, trimmed: all
+// after the '[', less the last ']' (and only that ']') when there is one.
+static void HeaderName(t_StrRef szLine, std::string& szSection)
+{
+	t_StrRef szName(szLine.pStr + 1, szLine.nLen - 1);
+	const char* pBracket = NULL;
+
+	for (const char* pPos = szName.pStr + szName.nLen; pPos > szName.pStr; pPos--)
+	{
+		if ( pPos[-1] == ']' )
+		{
+			pBracket = pPos - 1;
+			break;
+		}
+	}
+
+	if ( pBracket != NULL && pBracket + 1 == szName.pStr + szName.nLen )
+		szSection.assign(szName.pStr, szName.nLen - 1);
+	else
+	if ( pBracket != NULL )
+	{
+		szSection.assign(szName.pStr, pBracket - szName.pStr);
+		szSection.append(pBracket + 1, szName.pStr + szName.nLen - pBracket - 1);
+	}
+	else
+		szSection.assign(szName.pStr, szName.nLen);
+}
+
+// SplitKey
+// Finds the key and value of a trimmed key=value line. pEqual is the first
+// separator of the line as it was before it was trimmed; only if that one was
+// trimmed away need we look again. Returns false if the line sets nothing,
+// having no separator, or an empty key or value.
+static bool SplitKey(t_StrRef szLine, const char* pEqual, t_StrRef& szKey, t_StrRef& szValue)
+{
+	if ( pEqual != NULL && pEqual < szLine.pStr )
+		ScanLine(szLine.pStr, szLine.pStr + szLine.nLen, pEqual);
+
+	if ( pEqual == NULL || pEqual >= szLine.pStr + szLine.nLen )
+		return false;
+
+	szKey = TrimRef( t_StrRef(szLine.pStr, pEqual - szLine.pStr) );
+	szValue = t_StrRef(pEqual + 1, szLine.pStr + szLine.nLen - pEqual - 1);
+
+	return szKey.nLen > 0 && szValue.nLen > 0;
+}
+
+// LoadDeferred
+// Copies the file out of its mapping, and goes through the copy a line at a
+// time as LoadLine would, but only acts on section headers, creating each
+// section with the comment gathered ahead of it, just as LoadLine would have.
+// Every other line is merely classed, so that the comment is gathered as
+// LoadLine would have gathered it. The lines after each header, up to the
+// next, are added to its section's Deferred lines; those ahead of the first
+// header go to the default section. Nothing counts as deferred until the
+// whole file has been gone through, so that finding a section here never
+// parses it. The lines are kept in the copy, rather than the mapping, so that
+// the file may be rewritten while they wait to be parsed.
+bool CDataFile::LoadDeferred(const std::string& szFileName)
+{
+	CMappedFile File;
+	std::shared_ptr<std::string> pText;
+	std::string szSection;
+	std::string szComment;
+	std::size_t nSection = 0;
+	std::size_t nDeferred = 0;
+
+	if ( !File.Open(szFileName) )
+		return false;
+
+	if ( File.Size() == 0 )
+		return true;
+
+	COUNT_STAT(STAT_BYTES_PARSED, File.Size());
+	COUNT_STAT(STAT_ALLOCATIONS, 1);
+
+	pText = std::make_shared<std::string>(File.Data(), File.Size());
+	File.Close();
+
+	const char* pPos = pText->data();
+	const char* pEnd = pPos + pText->size();
+	const char* pBody = pPos;
+
+	for (;;)
+	{
+		const char* pEqual = NULL;
+		const char* pEol = (pPos < pEnd) ? ScanLine(pPos, pEnd, pEqual) : pEnd;
+		t_StrRef szLine = TrimRef( t_StrRef(pPos, pEol - pPos) );
+		t_StrRef szKey;
+		t_StrRef szValue;
+
+		if ( pPos < pEnd && (szLine.nLen == 0 || szLine.pStr[0] != '[') )
+		{
+			if ( szLine.nLen > 0 && CharClass.Is(szLine.pStr[0], CHAR_COMMENT) )
+			{
+				szComment += "\n";
+				szComment.append(szLine.pStr, szLine.nLen);
+			}
+			else
+			if ( szLine.nLen > 0 && SplitKey(szLine, pEqual, szKey, szValue) )
+			{
+				// As storing the key would have.
+				m_Sections[nSection].bDirty = true;
+				szComment.clear();
+			}
+
+			pPos = (pEol < pEnd) ? pEol + 1 : pEnd;
+			continue;
+		}
+
+		// A header, or the end of the file, ends the lines of the section
+		// before it.
+		if ( pPos > pBody )
+		{
+			if ( m_Sections[nSection].Deferred.empty() )
+				nDeferred++;
+
+			m_Sections[nSection].Deferred.push_back( t_StrRef(pBody, pPos - pBody) );
+		}
+
+		if ( pPos >= pEnd )
+			break;
+
+		HeaderName(szLine, szSection);
+
+		if ( GetSection(szSection) == NULL )
+			StoreSection(szSection, szComment);
+
+		szComment.clear();
+		nSection = GetSection(szSection) - &m_Sections[0];
+		pPos = pBody = (pEol < pEnd) ? pEol + 1 : pEnd;
+	}
+
+	if ( nDeferred > 0 )
+	{
+		m_Deferred.pText = pText;
+		m_Deferred.nSections.store(nDeferred, std::memory_order_release);
+	}
+
+	return true;
+}
+
+// ParseDeferred
+// Parses the section's deferred lines into it as LoadLine would have, under
+// the deferred mutex, which keeps any other thread from parsing at the same
+// time. Looking the section up again while doing so finds nothing left to
+// parse. The lines hold no headers, as LoadDeferred split the file at every
+// one, so only this section's keys are built. This may be called with no
+// more than the shared lock held, so nothing is touched that a reader of
+// another section (or of our flags) might be reading: the keys are built
+// here rather than through StoreValue, and our flags and the section's are
+// left as they are, since the keys were there all along. The keys themselves
+// count as changes only if they would have, had they been parsed at the
+// start.
+void CDataFile::ParseDeferred(t_Section* pSection)
+{
+	if ( m_Deferred.nSections.load(std::memory_order_acquire) == 0 )
+		return;
+
+	std::lock_guard<std::recursive_mutex> Parsing(m_Deferred.Mutex);
+
+	if ( pSection->Deferred.empty() )
+		return;
+
+	std::vector<t_StrRef> Deferred;
+
+	Deferred.swap(pSection->Deferred);
+
+	for (std::size_t nPart = 0; nPart < Deferred.size(); nPart++)
+	{
+		const char* pPos = Deferred[nPart].pStr;
+		const char* pEnd = pPos + Deferred[nPart].nLen;
+		std::string szComment;
+
+		while ( pPos < pEnd )
+		{
+			const char* pEqual;
+			const char* pEol = ScanLine(pPos, pEnd, pEqual);
+			t_StrRef szLine = TrimRef( t_StrRef(pPos, pEol - pPos) );
+			t_StrRef szKey;
+			t_StrRef szValue;
+
+			pPos = pEol + 1;
+
+			if ( szLine.nLen == 0 )
+				continue;
+
+			if ( CharClass.Is(szLine.pStr[0], CHAR_COMMENT) )
+			{
+				szComment += "\n";
+				szComment.append(szLine.pStr, szLine.nLen);
+				continue;
+			}
+
+			if ( !SplitKey(szLine, pEqual, szKey, szValue) )
+				continue;
+
+			t_Key* pKey = const_cast<t_Key*>( FindKey(*pSection, szKey) );
+
+			if ( pKey == NULL )
+			{
+				COUNT_STAT(STAT_ALLOCATIONS, pSection->Keys.size() == pSection->Keys.capacity() ? 2 : 1);
+				pSection->Keys.push_back( t_Key() );
+				pKey = &pSection->Keys.back();
+				pKey->szKey.assign(szKey.pStr, szKey.nLen);
+				m_nKeys++;
+
+				IndexKey(pSection, pSection->Keys.size() - 1);
+			}
+
+			pKey->szValue.assign(szValue.pStr, szValue.nLen);
+			pKey->szComment = szComment;
+			pKey->Cache.nValid.store(0, std::memory_order_relaxed);
+			pKey->bDirty = !m_Deferred.bClean;
+			szComment.clear();
+		}
+	}
+
+	// The last section parsed lets go of the text.
+	if ( m_Deferred.nSections.fetch_sub(1, std::memory_order_release) == 1 )
+		m_Deferred.pText.reset();
+}
+
+// ParseAllDeferred
+void CDataFile::ParseAllDeferred()
+{
+	if ( m_Deferred.nSections.load(std::memory_order_acquire) == 0 )
+		return;
+
+	std::lock_guard<std::recursive_mutex> Parsing(m_Deferred.Mutex);
+
+	for (std::size_t nSection = 0; nSection < m_Sections.size(); nSection++)
+		ParseDeferred(&m_Sections[nSection]);
+}
+
+// LoadStream
+// Reads the file through a std::fstream, LOAD_CHUNK_LEN bytes at a time, and
+// hands each line to LoadLine. Lines that lie wholly within a chunk are
+// parsed in place; only a line that straddles two chunks is copied, into
+// szPartial, to be put back together.
+bool CDataFile::LoadStream(const std::string& szFileName)
+{
+	// We dont want to create a new file here.  If it doesn't exist, just
+	// return false and report the failure.
+	//fstream File(szFileName.c_str(), ios::in|ios::nocreate);
+	std::fstream File(szFileName.c_str(), std::ios::in|std::ios::binary);
+
+	if ( !File.is_open() )
+	{
+		Report(E_INFO, "[CDataFile::Load] Unable to open file. Does it exist?");
+		return false;
+	}
+
+	std::vector<char> Buffer(LOAD_CHUNK_LEN);
+	std::string szSection;
+	std::string szComment;
+	std::string szPartial;
+
+	while ( File )
+	{
+		File.read(&Buffer[0], Buffer.size());
+
+		const char* pPos = &Buffer[0];
+		const char* pEnd = pPos + File.gcount();
+
+		COUNT_STAT(STAT_BYTES_PARSED, File.gcount());
+
+		while ( pPos < pEnd )
+		{
+			const char* pEqual;
+			const char* pEol = ScanLine(pPos, pEnd, pEqual);
+
+			if ( pEol == pEnd )
+			{
+				szPartial.append(pPos, pEnd - pPos);
+				break;
+			}
+
+			if ( szPartial.size() == 0 )
+				LoadLine(t_StrRef(pPos, pEol - pPos), pEqual, szSection, szComment);
+			else
+			{
+				// The separator may lie in either part, so look again.
+				szPartial.append(pPos, pEol - pPos);
+				ScanLine(szPartial.data(), szPartial.data() + szPartial.size(), pEqual);
+				LoadLine(szPartial, pEqual, szSection, szComment);
+				szPartial.clear();
+			}
+
+			pPos = pEol + 1;
+		}
+	}
+
+	// The last line need not end with a newline.
+	if ( szPartial.size() > 0 )
+	{
+		const char* pEqual;
+
+		ScanLine(szPartial.data(), szPartial.data() + szPartial.size(), pEqual);
+		LoadLine(szPartial, pEqual, szSection, szComment);
+	}
+
+	File.close();
+
+	return true;
+}
+
+// LoadSections
+// Copies every section and key out of the image and indexes them. They are
+// marked just as parsing the text would have marked them, and nothing is
+// left to be saved.
+void CDataFile::LoadSections(const CDataImage& Image)
+{
+	SectionItor s_pos;
+	KeyItor k_pos;
+
+	Image.GetSections(m_Sections);
+
+	for (s_pos = m_Sections.begin(); s_pos != m_Sections.end(); s_pos++)
+	{
+		(*s_pos).bNew = (*s_pos).szName.size() > 0;
+		(*s_pos).bDirty = (*s_pos).bNew || (*s_pos).Keys.size() > 0;
+
+		for (k_pos = (*s_pos).Keys.begin(); k_pos != (*s_pos).Keys.end(); k_pos++)
+			(*k_pos).bDirty = true;
+	}
+
+	m_SectionIndex.Clear();
+	m_SectionIndex.Reserve(m_Sections.size());
+	for (std::size_t nSection = 0; nSection < m_Sections.size(); nSection++)
+		IndexSection(nSection);
+
+	CountKeys();
+	m_nGeneration = NewGeneration();
+	m_bDirty = false;
+}
+
+// LoadLine
+// Parses a single line of a file being loaded. Comment lines are collected in
+// szComment until they can be attached to the next section or key. A section
+// header makes that section current (szSection), and a key=value pair is set
+// within the current section.
+void CDataFile::LoadLine(t_StrRef szLine, const char* pEqual, std::string& szSection, std::string& szComment)
+{
+	szLine = TrimRef(szLine);
+
+	if ( szLine.nLen == 0 )
+		return;
+
+	if ( CharClass.Is(szLine.pStr[0], CHAR_COMMENT) )
+	{
+		szComment += "\n";
+		szComment.append(szLine.pStr, szLine.nLen);
+	}
+	else
+	if ( szLine.pStr[0] == '[' ) // new section
+	{
+		HeaderName(szLine, szSection);
+
+		// A section may be headed more than once, as it is in a file Save()
+		// has appended to. Later keys are merged into the existing section.
+		if ( GetSection(szSection) == NULL )
+			StoreSection(szSection, szComment);
+
+		szComment.clear();
+	}
+	else // we have a key, add this key/value pair
+	{
+		t_StrRef szKey;
+		t_StrRef szValue;
+
+		if ( SplitKey(szLine, pEqual, szKey, szValue) )
+		{
+			StoreValue(szKey, szValue, szComment, szSection, true, true);
+			szComment.clear();
+		}
+	}
+}
+
+// StoreValue
+// Sets the key's value, creating the key if bAutoKey is set, and the section
+// too if bAutoSection is set, when they are not found.
+bool CDataFile::StoreValue(t_StrRef szKey, t_StrRef szValue, t_StrRef szComment,
+						   t_StrRef szSection, bool bAutoKey, bool bAutoSection, std::string* pValue)
+{
+	t_Key* pKey = GetKey(szKey, szSection);
+	t_Section* pSection = GetSection(szSection);
+
+	if (pSection == NULL)
+	{
+		if ( !bAutoSection || !StoreSection(szSection, t_StrRef()) )
+			return false;
+
+		pSection = GetSection(szSection);
+	}
+
+	// Sanity check...
+	if ( pSection == NULL )
+		return false;
+
+	// if the key does not exist in that section, and the value passed
+	// is not t_Str("") then add the new key.
+	if ( pKey == NULL && szValue.nLen > 0 && bAutoKey )
+	{
+		// The key is built where it is to live, so its text is copied
+		// just the once.
+		COUNT_STAT(STAT_ALLOCATIONS, pSection->Keys.size() == pSection->Keys.capacity() ? 2 : 1);
+		pSection->Keys.push_back( t_Key() );
+		pKey = &pSection->Keys.back();
+
+		pKey->szKey.assign(szKey.pStr, szKey.nLen);
+		if ( pValue != NULL )
+			pKey->szValue = std::move(*pValue);
+		else
+			pKey->szValue.assign(szValue.pStr, szValue.nLen);
+		pKey->szComment.assign(szComment.pStr, szComment.nLen);
+		pKey->bDirty = true;
+
+		pSection->bDirty = true;
+		m_bDirty = true;
+		m_nKeys++;
+
+		IndexKey(pSection, pSection->Keys.size() - 1);
+
+		return true;
+	}
+
+	if ( pKey != NULL )
+	{
+		UpdateKey(pSection, pKey, szValue, szComment, pValue);
+		return true;
+	}
+
+	return false;
+}
+
+// UpdateKey
+// Gives an existing key a new value and comment.
+void CDataFile::UpdateKey(t_Section* pSection, t_Key* pKey, t_StrRef szValue, t_StrRef szComment,
+						  std::string* pValue)
+{
+	// Keys without a value are left out of the file. Leaving out a key
+	// that is already there will not remove it, and adding one back
+	// later would move it to the end of its section.
+	if ( (szValue.nLen == 0) != pKey->szValue.empty() )
+		m_bRewrite = true;
+
+	// assign() reuses the existing buffers, so updating a key in place
+	// does not allocate unless the new text is longer. A value we may take
+	// is taken whole instead.
+	COUNT_STAT(STAT_ALLOCATIONS, pValue == NULL && szValue.nLen > pKey->szValue.capacity() ? 1 : 0);
+	if ( pValue != NULL )
+		pKey->szValue = std::move(*pValue);
+	else
+		pKey->szValue.assign(szValue.pStr, szValue.nLen);
+	pKey->szComment.assign(szComment.pStr, szComment.nLen);
+	pKey->Cache.nValid.store(0, std::memory_order_relaxed);
+	pKey->bDirty = true;
+
+	pSection->bDirty = true;
+	m_bDirty = true;
+}
+
+// StoreSection
+// Creates the section, unless it allready exists.
+bool CDataFile::StoreSection(t_StrRef szSection, t_StrRef szComment)
+{
+	t_Section* pSection = GetSection(szSection);
+
+	if ( pSection )
+	{
+		Report(E_INFO, "[CDataFile::CreateSection] Section <%.*s> allready exists. Aborting.",
+			   (int)szSection.nLen, szSection.pStr);
+		return false;
+	}
+
+	COUNT_STAT(STAT_ALLOCATIONS, m_Sections.size() == m_Sections.capacity() ? 2 : 1);
+	m_Sections.push_back( t_Section() );
+	pSection = &m_Sections.back();
+
+	pSection->szName.assign(szSection.pStr, szSection.nLen);
+	pSection->szComment.assign(szComment.pStr, szComment.nLen);
+	pSection->bDirty = true;
+	pSection->bNew = true;
+	IndexSection(m_Sections.size() - 1);
+	m_bDirty = true;
+
+	return true;
+}
+
+// ReloadFile
+// Reads the file again into an object of its own, and makes a snapshot of
+// it, without holding our lock. Then, under the lock, swaps the result in for
+// what we had and publishes the snapshot, so that snapshot readers are never
+// held up and lock holders are only held up for the swap. The changes are
+// worked out afterwards, from the old contents and the new snapshot, neither
+// of which anyone else can change.
+bool CDataFile::ReloadFile(ChangeList* pChanges)
+{
+	CDataFile Parsed;
+	t_FileStamp Stamp;
+	bool bStamped;
+	std::string szFileName;
+	START_TIMING();
+
+	{
+		ReadLock Lock(m_Lock, m_Flags);
+		szFileName = m_szFileName;
+	}
+
+	if ( !Parse(szFileName, Parsed, Stamp, bStamped) )
+	{
+		RECORD_TIMING(STAT_LOADS, "Reload", szFileName, false, Parsed.m_Stats[STAT_BYTES_PARSED]);
+		return false;
+	}
+
+	// The snapshot, and the changes, need every key.
+	Parsed.ParseAllDeferred();
+
+	SnapshotPtr pSnapshot = std::make_shared<const CDataSnapshot>(Parsed.m_Sections, Parsed.m_SectionIndex);
+	bool bRenamed;
+
+	{
+		WriteLock Lock(m_Lock, m_Flags);
+
+		// The file name may have been changed while we read the old one, in
+		// which case what we read is thrown away.
+		bRenamed = szFileName != m_szFileName;
+
+		if ( !bRenamed )
+		{
+			// The old contents are compared with the new below, key by key.
+			ParseAllDeferred();
+			Compact();
+
+			m_Sections.swap(Parsed.m_Sections);
+			m_SectionIndex.Swap(Parsed.m_SectionIndex);
+			std::swap(m_nKeys, Parsed.m_nKeys);
+			m_nGeneration = NewGeneration();
+
+			MarkSynced();
+			m_bSynced = bStamped;
+			m_Stamp = Stamp;
+			m_nBaseSize = Stamp.nSize;
+			m_nLogSize = 0;
+			m_bDirty = false;
+
+			std::atomic_store(&m_pSnapshot, pSnapshot);
+		}
+	}
+
+	// Recorded once the lock is let go, as the stats callback may want it.
+	RECORD_TIMING(STAT_LOADS, "Reload", szFileName, !bRenamed, Parsed.m_Stats[STAT_BYTES_PARSED]);
+
+	if ( bRenamed )
+		return false;
+
+	if ( pChanges != NULL )
+	{
+		const SectionList& Old = Parsed.m_Sections;
+		const SectionList& New = pSnapshot->m_Sections;
+		SectionList::const_iterator s_pos;
+		KeyList::const_iterator k_pos;
+		t_Change Change;
+
+		pChanges->clear();
+
+		// Keys added or changed, in the order the file now has them...
+		for (s_pos = New.begin(); s_pos != New.end(); s_pos++)
+		{
+			const t_Section* pOld = FindSection(Old, Parsed.m_SectionIndex, (*s_pos).szName);
+
+			for (k_pos = (*s_pos).Keys.begin(); k_pos != (*s_pos).Keys.end(); k_pos++)
+			{
+				const t_Key* pKey = (pOld == NULL) ? NULL : FindKey(*pOld, (*k_pos).szKey);
+
+				if ( pKey != NULL && pKey->szValue == (*k_pos).szValue )
+					continue;
+
+				Change.szSection = (*s_pos).szName;
+				Change.szKey = (*k_pos).szKey;
+				Change.szOldValue = (pKey == NULL) ? std::string("") : pKey->szValue;
+				Change.szNewValue = (*k_pos).szValue;
+				pChanges->push_back(Change);
+			}
+		}
+
+		// ...followed by those removed, in the order it used to have them.
+		for (s_pos = Old.begin(); s_pos != Old.end(); s_pos++)
+		{
+			const t_Section* pNew = pSnapshot->GetSection((*s_pos).szName);
+
+			for (k_pos = (*s_pos).Keys.begin(); k_pos != (*s_pos).Keys.end(); k_pos++)
+			{
+				if ( (*k_pos).szValue.size() == 0
+					 || (pNew != NULL && FindKey(*pNew, (*k_pos).szKey) != NULL) )
+					continue;
+
+				Change.szSection = (*s_pos).szName;
+				Change.szKey = (*k_pos).szKey;
+				Change.szOldValue = (*k_pos).szValue;
+				Change.szNewValue = std::string("");
+				pChanges->push_back(Change);
+			}
+		}
+	}
+
+	return true;
+}
+
+// CheckFile
+// Called from the watcher thread whenever the file may have changed. The
+// file's stamp tells us whether it really has; if the new stamp is the one
+// our own Save() left, there is nothing to reload.
+void CDataFile::CheckFile()
+{
+	std::string szFileName;
+	t_FileStamp Stamp;
+	t_FileStamp Saved;
+	bool bSynced;
+
+	{
+		ReadLock Lock(m_Lock, m_Flags);
+		szFileName = m_szFileName;
+		Saved = m_Stamp;
+		bSynced = m_bSynced;
+	}
+
+	// A missing file is most likely part way through being replaced.
+	if ( !GetFileStamp(szFileName, Stamp) || Stamp == m_WatchStamp )
+		return;
+
+	m_WatchStamp = Stamp;
+
+	if ( bSynced && Stamp == Saved )
+		return;
+
+	ChangeList Changes;
+
+	if ( ReloadFile(&Changes) && Changes.size() > 0 && m_OnChange )
+		m_OnChange(*this, Changes);
+}
+
+// Parse
+// Loads the named file into Parsed, using whichever reader our flags ask for.
+// The file is stamped before it is read: if it changes while we read, the
+// stamp is stale and the next save rewrites the file whole.
+bool CDataFile::Parse(const std::string& szFileName, CDataFile& Parsed,
+					  t_FileStamp& Stamp, bool& bStamped)
+{
+	bool bLoaded = false;
+
+	bStamped = GetFileStamp(szFileName, Stamp);
+
+	// Parsed has nothing to save, and no file name to save it to, even when
+	// a parse throws part way through.
+	try
+	{
+		if ( (m_Flags & (MMAP_LOAD | LAZY_LOAD)) == (MMAP_LOAD | LAZY_LOAD) )
+			bLoaded = Parsed.LoadDeferred(szFileName);
+		else
+		if ( (m_Flags & MMAP_LOAD) == MMAP_LOAD )
+			bLoaded = Parsed.LoadMapped(szFileName, (m_Flags & PARALLEL_LOAD) == PARALLEL_LOAD);
+
+		if ( !bLoaded )
+			bLoaded = Parsed.LoadStream(szFileName);
+	}
+	catch (...)
+	{
+		Parsed.m_bDirty = false;
+		throw;
+	}
+
+	Parsed.m_bDirty = false;
+
+#ifdef CDATAFILE_STATS
+	AddStats(Parsed);
+#endif
+
+	return bLoaded;
+}
+
+// Merge
+// Moves the sections and keys that were loaded into Parsed into this object,
+// with the same result as loading the file here would have had: sections are
+// added in the order the file first names them, and a section we allready
+// have keeps its comment but has the file's keys set in it. What is loaded
+// is as it is on disk, so it is merged in clean, and on either path leaves
+// our dirty flag, and those of the sections it is merged into, as they were.
+void CDataFile::Merge(CDataFile& Parsed)
+{
+	SectionItor s_pos;
+	KeyItor k_pos;
+
+	ParseAllDeferred();
+	Compact();
+	Parsed.MarkClean();
+
+	// Nothing has been added to us yet, so we can simply take Parsed's,
+	// sections yet to be parsed and all.
+	if ( m_Sections.size() == 1 && m_Sections[0].szName.size() == 0
+		 && m_Sections[0].szComment.size() == 0 && m_Sections[0].Keys.size() == 0 )
+	{
+		m_Sections.swap(Parsed.m_Sections);
+		m_SectionIndex.Swap(Parsed.m_SectionIndex);
+		m_Deferred.Swap(Parsed.m_Deferred);
+		std::swap(m_nKeys, Parsed.m_nKeys);
+		m_nGeneration = NewGeneration();
+	}
+	else
+	{
+		Parsed.ParseAllDeferred();
+
+		for (s_pos = Parsed.m_Sections.begin(); s_pos != Parsed.m_Sections.end(); s_pos++)
+		{
+			t_Section* pSection = GetSection((*s_pos).szName);
+
+			if ( pSection == NULL )
+			{
+				// Parsed always starts out with the default section, but the
+				// file only puts it in play if it has keys ahead of any header.
+				if ( (*s_pos).szName.size() == 0 && (*s_pos).Keys.size() == 0 )
+					continue;
+
+				COUNT_STAT(STAT_ALLOCATIONS, m_Sections.size() == m_Sections.capacity() ? 1 : 0);
+				m_nKeys += (*s_pos).Keys.size();
+				m_Sections.push_back( std::move(*s_pos) );
+				IndexSection(m_Sections.size() - 1);
+				continue;
+			}
+
+			bool bDirty = m_bDirty;
+			bool bSectionDirty = pSection->bDirty;
+
+			for (k_pos = (*s_pos).Keys.begin(); k_pos != (*s_pos).Keys.end(); k_pos++)
+			{
+				StoreValue((*k_pos).szKey, (*k_pos).szValue, (*k_pos).szComment,
+						   (*s_pos).szName, true, true, &(*k_pos).szValue);
+				GetKey((*k_pos).szKey, (*s_pos).szName)->bDirty = false;
+			}
+
+			pSection->bDirty = bSectionDirty;
+			m_bDirty = bDirty;
+		}
+	}
+
+	Parsed.m_bDirty = false;
+}
+
+// MergeLoaded
+// Takes the lock and merges Parsed in. Loading our own file into an empty
+// object leaves memory holding just what is on disk, as of Stamp, so that
+// later saves can be appended to it. Anything else loaded is not in our file,
+// so the next save has to write the file whole.
+void CDataFile::MergeLoaded(CDataFile& Parsed, const std::string& szFileName,
+							const t_FileStamp& Stamp, bool bStamped)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+
+	ParseAllDeferred();
+	Compact();
+
+	bool bFresh = bStamped && szFileName == m_szFileName && m_Sections.size() == 1
+				  && m_Sections[0].szName.size() == 0 && m_Sections[0].szComment.size() == 0
+				  && m_Sections[0].Keys.size() == 0;
+
+	Merge(Parsed);
+
+	if ( bFresh )
+	{
+		MarkSynced();
+		m_Stamp = Stamp;
+		m_nBaseSize = Stamp.nSize;
+		m_nLogSize = 0;
+	}
+	else
+		m_bSynced = false;
+}
+
+// GetKey
+// Given a key and section name, looks up the key and if found, returns a
+// pointer to that key, otherwise returns NULL.
+t_Key*	CDataFile::GetKey(t_StrRef szKey, t_StrRef szSection)
+{
+	t_Section* pSection = GetSection(szSection);
+
+	// Since our default section has a name value of t_Str("") this should
+	// always return a valid section, wether or not it has any keys in it is
+	// another matter.
+	if ( pSection == NULL )
+	{
+		COUNT_LOOKUP(STAT_KEY_LOOKUPS);
+		COUNT_LOOKUP(STAT_KEY_MISSES);
+		return NULL;
+	}
+
+	return const_cast<t_Key*>( FindKey(*pSection, szKey) );
+}
+
+// GetSection
+// Given a section name, locates that section in the list and returns a pointer
+// to it. If the section was not found, returns NULL
+t_Section* CDataFile::GetSection(t_StrRef szSection)
+{
+	t_Section* pSection = const_cast<t_Section*>( FindSection(m_Sections, m_SectionIndex, szSection) );
+
+	if ( pSection != NULL )
+		ParseDeferred(pSection);
+
+	return pSection;
+}
+
+// GetKey
+// Returns the key a handle refers to. The position held in the handle is
+// good for as long as the layout generation it was taken in; otherwise (or
+// if the key was not found last time) the key is looked up by name again, and
+// the handle updated.
+t_Key* CDataFile::GetKey(t_KeyHandle& Handle)
+{
+	if ( Handle.pOwner == this && Handle.nGeneration == m_nGeneration
+		 && !m_Sections[Handle.nSection].Keys[Handle.nKey].bDeleted )
+		return &m_Sections[Handle.nSection].Keys[Handle.nKey];
+
+	t_Section* pSection = GetSection(Handle.szSection);
+	t_Key* pKey = (pSection == NULL) ? NULL : GetKey(Handle.szKey, Handle.szSection);
+
+	// Left unresolved, the handle is looked up again next time.
+	if ( pKey == NULL )
+	{
+		Handle.pOwner = NULL;
+		return NULL;
+	}
+
+	Handle.pOwner = this;
+	Handle.nGeneration = m_nGeneration;
+	Handle.nSection = pSection - &m_Sections[0];
+	Handle.nKey = pKey - &pSection->Keys[0];
+
+	return pKey;
+}
+
+// IndexSection
+// Adds the section found at position nSection of m_Sections to the section
+// index, and (re)builds that section's key index.
+void CDataFile::IndexSection(std::size_t nSection)
+{
+	t_Section* pSection = &m_Sections[nSection];
+
+	m_SectionIndex.Insert(HashNoCase(pSection->szName), nSection);
+
+	pSection->KeyIndex.Clear();
+	pSection->KeyIndex.Reserve(pSection->Keys.size());
+	for (std::size_t nKey = 0; nKey < pSection->Keys.size(); nKey++)
+		IndexKey(pSection, nKey);
+}
+
+// IndexAppended
+// Walks the new keys in the order they were added, indexing each as it goes,
+// so that a repeat finds the first of its name allready indexed, and is set
+// in it, just as SetValue() would have set the key it had created. A new key
+// whose first value is empty is dropped, as SetValue() would not have created
+// it. The keys kept are packed down over those folded or dropped.
+bool CDataFile::IndexAppended(t_Section* pSection, std::size_t nFirst)
+{
+	std::size_t nTo = nFirst;
+	bool bAll = true;
+
+	pSection->KeyIndex.Reserve(pSection->Keys.size());
+
+	for (std::size_t nKey = nFirst; nKey < pSection->Keys.size(); nKey++)
+	{
+		t_Key& Key = pSection->Keys[nKey];
+		std::size_t nHash = HashNoCase(Key.szKey);
+		t_Key* pFirst = const_cast<t_Key*>( FindKey(*pSection, Key.szKey, nHash) );
+
+		if ( pFirst != NULL )
+		{
+			UpdateKey(pSection, pFirst, Key.szValue, Key.szComment);
+			continue;
+		}
+
+		if ( Key.szValue.empty() )
+		{
+			bAll = false;
+			continue;
+		}
+
+		if ( nTo != nKey )
+			pSection->Keys[nTo] = std::move(Key);
+
+		pSection->KeyIndex.Insert(nHash, nTo++);
+	}
+
+	if ( nTo > nFirst )
+	{
+		pSection->bDirty = true;
+		m_bDirty = true;
+	}
+
+	m_nKeys -= pSection->Keys.size() - nTo;
+	pSection->Keys.erase(pSection->Keys.begin() + nTo, pSection->Keys.end());
+
+	return bAll;
+}
+
+// IndexKey
+// Adds the key found at position nKey of the section's key list to the
+// section's key index.
+void CDataFile::IndexKey(t_Section* pSection, std::size_t nKey)
+{
+	pSection->KeyIndex.Insert(HashNoCase(pSection->Keys[nKey].szKey), nKey);
+}
+
+// RebuildIndex
+// Throws away the section index and recreates it from m_Sections. The key
+// indexes hold positions relative to their own section, so they survive
+// sections moving around and are left untouched.
+void CDataFile::RebuildIndex()
+{
+	m_SectionIndex.Clear();
+	m_SectionIndex.Reserve(m_Sections.size());
+
+	for (std::size_t nSection = 0; nSection < m_Sections.size(); nSection++)
+	{
+		if ( !m_Sections[nSection].bDeleted )
+			m_SectionIndex.Insert(HashNoCase(m_Sections[nSection].szName), nSection);
+	}
+}
+
+// CountKeys
+// Adds up the keys of every section, less those deleted.
+void CDataFile::CountKeys()
+{
+	SectionItor s_pos;
+
+	m_nKeys = 0;
+	for (s_pos = m_Sections.begin(); s_pos != m_Sections.end(); s_pos++)
+		m_nKeys += (*s_pos).Keys.size() - (*s_pos).nDeleted;
+}
+
+// Compact
+// Removes every tombstone in one pass over each list, then indexes what is
+// left again. Does nothing when nothing has been deleted.
+void CDataFile::Compact()
+{
+	if ( m_nDeletedKeys > 0 )
+	{
+		for (std::size_t nSection = 0; nSection < m_Sections.size(); nSection++)
+		{
+			if ( m_Sections[nSection].nDeleted > 0 )
+				CompactSection(&m_Sections[nSection]);
+		}
+	}
+
+	if ( m_nDeletedSections > 0 )
+	{
+		m_Sections.erase(std::remove_if(m_Sections.begin(), m_Sections.end(),
+										[](const t_Section& Section) { return Section.bDeleted; }),
+						 m_Sections.end());
+		m_nDeletedSections = 0;
+		m_nGeneration = NewGeneration();
+
+		RebuildIndex();
+	}
+}
+
+// CompactSection
+// Packs the section's keys down over its tombstones, in one pass, and indexes
+// them again.
+void CDataFile::CompactSection(t_Section* pSection)
+{
+	pSection->Keys.erase(std::remove_if(pSection->Keys.begin(), pSection->Keys.end(),
+										[](const t_Key& Key) { return Key.bDeleted; }),
+						 pSection->Keys.end());
+	m_nDeletedKeys -= pSection->nDeleted;
+	pSection->nDeleted = 0;
+	m_nGeneration = NewGeneration();
+
+	pSection->KeyIndex.Clear();
+	for (std::size_t nKey = 0; nKey < pSection->Keys.size(); nKey++)
+		IndexKey(pSection, nKey);
+}
+
+// QuerySections
+// The lock is held exclusively, as the sections are compacted, and their
+// order sorted, when need be.
+SectionViewList CDataFile::QuerySections(t_StrRef szPrefix, const t_StrRef* pPattern)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	SectionViewList Found;
+
+	ParseAllDeferred();
+	Compact();
+	SortByName(m_Sections, m_SectionIndex, m_SectionOrder);
+	FindInOrder(m_Sections, m_SectionOrder, szPrefix, pPattern, Found);
+
+	return Found;
+}
+
+// QueryKeys
+// As QuerySections, for the keys of one section.
+KeyViewList CDataFile::QueryKeys(t_StrRef szSection, t_StrRef szPrefix, const t_StrRef* pPattern)
+{
+	WriteLock Lock(m_Lock, m_Flags);
+	COUNT_LOOKUPS();
+	KeyViewList Found;
+
+	Compact();
+
+	t_Section* pSection = GetSection(szSection);
+
+	if ( pSection == NULL )
+		return Found;
+
+	SortByName(pSection->Keys, pSection->KeyIndex, pSection->KeyOrder);
+	FindInOrder(pSection->Keys, pSection->KeyOrder, szPrefix, pPattern, Found);
+
+	return Found;
+}
+
+
+#ifdef CDATAFILE_STATS
+// GetStats
+// Reads each counter in turn into a t_DataStats.
+t_DataStats CDataFile::GetStats() const
+{
+	t_DataStats Stats;
+
+	Stats.nSectionLookups = m_Stats[STAT_SECTION_LOOKUPS].load(std::memory_order_relaxed);
+	Stats.nSectionMisses = m_Stats[STAT_SECTION_MISSES].load(std::memory_order_relaxed);
+	Stats.nKeyLookups = m_Stats[STAT_KEY_LOOKUPS].load(std::memory_order_relaxed);
+	Stats.nKeyMisses = m_Stats[STAT_KEY_MISSES].load(std::memory_order_relaxed);
+	Stats.nCompares = m_Stats[STAT_COMPARES].load(std::memory_order_relaxed);
+	Stats.nAllocations = m_Stats[STAT_ALLOCATIONS].load(std::memory_order_relaxed);
+	Stats.nBytesParsed = m_Stats[STAT_BYTES_PARSED].load(std::memory_order_relaxed);
+	Stats.nBytesWritten = m_Stats[STAT_BYTES_WRITTEN].load(std::memory_order_relaxed);
+	Stats.nLoads = m_Stats[STAT_LOADS].load(std::memory_order_relaxed);
+	Stats.nLoadNs = m_Stats[STAT_LOAD_NS].load(std::memory_order_relaxed);
+	Stats.nMaxLoadNs = m_Stats[STAT_MAX_LOAD_NS].load(std::memory_order_relaxed);
+	Stats.nSaves = m_Stats[STAT_SAVES].load(std::memory_order_relaxed);
+	Stats.nSaveNs = m_Stats[STAT_SAVE_NS].load(std::memory_order_relaxed);
+	Stats.nMaxSaveNs = m_Stats[STAT_MAX_SAVE_NS].load(std::memory_order_relaxed);
+
+	return Stats;
+}
+
+// ResetStats
+// Zeroes every counter.
+void CDataFile::ResetStats()
+{
+	for (int nStat = 0; nStat < STAT_COUNT; nStat++)
+		m_Stats[nStat].store(0, std::memory_order_relaxed);
+}
+
+// SetStatsCallback
+// Sets the callback RecordTiming passes each load and save on to.
+void CDataFile::SetStatsCallback(StatsCallback OnStats)
+{
+	m_OnStats = std::move(OnStats);
+}
+
+// AddStats
+// Parsing is done into objects of its own, which count what they create and
+// parse; this adds that to our counts. The maximums are left alone, as
+// nothing is timed in them.
+void CDataFile::AddStats(const CDataFile& Other)
+{
+	for (int nStat = 0; nStat < STAT_COUNT; nStat++)
+	{
+		unsigned long long nCount = Other.m_Stats[nStat].load(std::memory_order_relaxed);
+
+		if ( nCount > 0 && nStat != STAT_MAX_LOAD_NS && nStat != STAT_MAX_SAVE_NS )
+			m_Stats[nStat].fetch_add(nCount, std::memory_order_relaxed);
+	}
+}
+
+// RecordTiming
+// Counts the load or save, adds its time to the total (nCount + 1) and the
+// longest (nCount + 2), and tells m_OnStats about it.
+void CDataFile::RecordTiming(e_Stat nCount, const char* szOperation, const std::string& szFileName,
+							 bool bOk, unsigned long long nBytes, unsigned long long nNanoseconds)
+{
+	std::atomic<unsigned long long>& nMax = m_Stats[nCount + 2];
+	unsigned long long nLongest = nMax.load(std::memory_order_relaxed);
+
+	m_Stats[nCount].fetch_add(1, std::memory_order_relaxed);
+	m_Stats[nCount + 1].fetch_add(nNanoseconds, std::memory_order_relaxed);
+
+	while ( nNanoseconds > nLongest && !nMax.compare_exchange_weak(nLongest, nNanoseconds, std::memory_order_relaxed) )
+		;
+
+	if ( nCount == STAT_SAVES )
+		m_Stats[STAT_BYTES_WRITTEN].fetch_add(nBytes, std::memory_order_relaxed);
+
+	if ( m_OnStats )
+		m_OnStats(szOperation, szFileName, bOk, nBytes, nNanoseconds);
+}
+#endif
+
+// CommentStr
+// Returns the comment the way it is written to disk (see AppendComment).
+std::string CDataFile::CommentStr(std::string szComment)
+{
+	std::string szNewStr = std::string("");
+
+	AppendComment(szNewStr, szComment);
+
+	return szNewStr;
+}
+
+// Serialize
+// Renders the whole section list, exactly as Save() writes it, into szOut.
+// The output is measured in a first pass so that szOut is allocated once;
+// the second pass appends each piece straight from the stored strings.
+void CDataFile::Serialize(std::string& szOut)
+{
+	SectionList::const_iterator s_pos;
+	KeyList::const_iterator k_pos;
+	std::size_t nSize = 0;
+
+	for (s_pos = m_Sections.begin(); s_pos != m_Sections.end(); s_pos++)
+	{
+		const t_Section& Section = (*s_pos);
+
+		if ( Section.szComment.size() > 0 )
+			nSize += CommentLen(Section.szComment) + 2;
+
+		if ( Section.szName.size() > 0 )
+			nSize += Section.szName.size() + 4;
+
+		for (k_pos = Section.Keys.begin(); k_pos != Section.Keys.end(); k_pos++)
+		{
+			const t_Key& Key = (*k_pos);
+
+			if ( Key.szKey.size() > 0 && Key.szValue.size() > 0 )
+			{
+				if ( Key.szComment.size() > 0 )
+					nSize += CommentLen(Key.szComment) + 2;
+
+				nSize += Key.szKey.size() + Key.szValue.size() + 2;
+			}
+		}
+	}
+
+	szOut.clear();
+	szOut.reserve(nSize);
+
+	for (s_pos = m_Sections.begin(); s_pos != m_Sections.end(); s_pos++)
+	{
+		const t_Section& Section = (*s_pos);
+
+		if ( Section.szComment.size() > 0 )
+		{
+			szOut += '\n';
+			AppendComment(szOut, Section.szComment);
+			szOut += '\n';
+		}
+		else
+		if ( Section.szName.size() > 0 )
+			szOut += '\n';
+
+		if ( Section.szName.size() > 0 )
+		{
+			szOut += '[';
+			szOut += Section.szName;
+			szOut += "]\n";
+		}
+
+		for (k_pos = Section.Keys.begin(); k_pos != Section.Keys.end(); k_pos++)
+		{
+			const t_Key& Key = (*k_pos);
+
+			if ( Key.szKey.size() > 0 && Key.szValue.size() > 0 )
+			{
+				if ( Key.szComment.size() > 0 )
+				{
+					szOut += '\n';
+					AppendComment(szOut, Key.szComment);
+					szOut += '\n';
+				}
+
+				szOut += Key.szKey;
+				szOut += EqualIndicators[0];
+				szOut += Key.szValue;
+				szOut += '\n';
+			}
+		}
+	}
+}
+
+
+
+// SerializeChanges
+// Renders the dirty sections into szOut as a block of text to be appended to
+// the file: each one's header, followed by its new or changed keys. A new
+// section gets its comment too. Loading the file merges each block into the
+// section of the same name, so the reloaded file matches what is in memory.
+// Returns false if there are changes that can't be written this way.
+bool CDataFile::SerializeChanges(std::string& szOut)
+{
+	SectionList::const_iterator s_pos;
+	KeyList::const_iterator k_pos;
+
+	szOut.clear();
+
+	if ( m_bRewrite )
+		return false;
+
+	for (s_pos = m_Sections.begin(); s_pos != m_Sections.end(); s_pos++)
+	{
+		const t_Section& Section = (*s_pos);
+
+		if ( !Section.bDirty )
+			continue;
+
+		// Keys ahead of the first header belong to the default section, and
+		// there is no header that leads back to it.
+		if ( Section.szName.size() == 0 )
+			return false;
+
+		if ( Section.bNew && Section.szComment.size() > 0 )
+		{
+			szOut += '\n';
+			AppendComment(szOut, Section.szComment);
+			szOut += '\n';
+		}
+		else
+			szOut += '\n';
+
+		szOut += '[';
+		szOut += Section.szName;
+		szOut += "]\n";
+
+		for (k_pos = Section.Keys.begin(); k_pos != Section.Keys.end(); k_pos++)
+		{
+			const t_Key& Key = (*k_pos);
+
+			if ( Key.bDirty && Key.szKey.size() > 0 && Key.szValue.size() > 0 )
+			{
+				if ( Key.szComment.size() > 0 )
+				{
+					szOut += '\n';
+					AppendComment(szOut, Key.szComment);
+					szOut += '\n';
+				}
+
+				szOut += Key.szKey;
+				szOut += EqualIndicators[0];
+				szOut += Key.szValue;
+				szOut += '\n';
+			}
+		}
+	}
+
+	return true;
+}
+
+// MarkClean
+// Clears the dirty flag of every key and section.
+void CDataFile::MarkClean()
+{
+	SectionItor s_pos;
+	KeyItor k_pos;
+
+	for (s_pos = m_Sections.begin(); s_pos != m_Sections.end(); s_pos++)
+	{
+		(*s_pos).bDirty = false;
+		(*s_pos).bNew = false;
+
+		for (k_pos = (*s_pos).Keys.begin(); k_pos != (*s_pos).Keys.end(); k_pos++)
+			(*k_pos).bDirty = false;
+	}
+
+	// Sections still to be parsed are as saved, too.
+	m_Deferred.bClean = true;
+	m_bRewrite = false;
+}
+
+// MarkSynced
+// Called once the file on disk (m_szFileName) matches what is in memory.
+// Stamps the file, and clears the dirty flag of every key and section.
+void CDataFile::MarkSynced()
+{
+	MarkClean();
+	m_bSynced = GetFileStamp(m_szFileName, m_Stamp);
+}
+
+// IsSynced
+// Returns true if the changes made since the last load or save can be
+// appended to the file: the file is the one we last loaded or saved, and
+// nothing has been done to it since that needs a full rewrite.
+bool CDataFile::IsSynced()
+{
+	t_FileStamp Stamp;
+
+	return m_bSynced && !m_bRewrite && GetFileStamp(m_szFileName, Stamp) && Stamp == m_Stamp;
+}
+
+// CDataSnapshot ////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////
+
+CDataSnapshot::CDataSnapshot(SectionList Sections, HashIndex SectionIndex)
+{
+	SectionList::const_iterator s_pos;
+
+	m_Sections.swap(Sections);
+	m_SectionIndex.Swap(SectionIndex);
+
+	m_nKeys = 0;
+	for (s_pos = m_Sections.begin(); s_pos != m_Sections.end(); s_pos++)
+		m_nKeys += (*s_pos).Keys.size();
+}
+
+std::string CDataSnapshot::GetValue(t_StrRef szKey, t_StrRef szSection) const
+{
+	const t_Key* pKey = GetKey(szKey, szSection);
+
+	return (pKey == NULL) ? std::string("") : pKey->szValue;
+}
+
+std::string CDataSnapshot::GetString(t_StrRef szKey, t_StrRef szSection) const
+{
+	return GetValue(szKey, szSection);
+}
+
+float CDataSnapshot::GetFloat(t_StrRef szKey, t_StrRef szSection) const
+{
+	return ValueToFloat( GetKey(szKey, szSection) );
+}
+
+int CDataSnapshot::GetInt(t_StrRef szKey, t_StrRef szSection) const
+{
+	return ValueToInt( GetKey(szKey, szSection) );
+}
+
+bool CDataSnapshot::GetBool(t_StrRef szKey, t_StrRef szSection) const
+{
+	return ValueToBool( GetKey(szKey, szSection) );
+}
+
+bool CDataSnapshot::CheckSectionName(t_StrRef szSectionName) const
+{
+	return GetSection(szSectionName) != NULL;
+}
+
+int CDataSnapshot::SectionCount() const
+{
+	return m_Sections.size();
+}
+
+int CDataSnapshot::KeyCount() const
+{
+	return (int)m_nKeys;
+}
+
+SectionRange CDataSnapshot::Sections() const
+{
+	return MakeSectionRange(m_Sections);
+}
+
+const t_Key* CDataSnapshot::GetKey(t_StrRef szKey, t_StrRef szSection) const
+{
+	const t_Section* pSection = GetSection(szSection);
+
+	if ( pSection == NULL )
+		return NULL;
+
+	return FindKey(*pSection, szKey);
+}
+
+const t_Section* CDataSnapshot::GetSection(t_StrRef szSection) const
+{
+	return FindSection(m_Sections, m_SectionIndex, szSection);
+}
+
+
+// CFileWatcher /////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////
+
+CFileWatcher::CFileWatcher()
+{
+	m_bStop = false;
+	m_nPollMs = 0;
+	m_nNotify = -1;
+	m_Pipe[0] = m_Pipe[1] = -1;
+}
+
+CFileWatcher::CFileWatcher(const CFileWatcher&)
+{
+	m_bStop = false;
+	m_nPollMs = 0;
+	m_nNotify = -1;
+	m_Pipe[0] = m_Pipe[1] = -1;
+}
+
+// operator=
+// A watcher belongs to the object it calls back, so assignment leaves it
+// alone.
+CFileWatcher& CFileWatcher::operator=(const CFileWatcher&)
+{
+	return *this;
+}
+
+CFileWatcher::~CFileWatcher()
+{
+	Stop();
+}
+
+// Start
+// Sets up inotify, if we can, on the file's directory, and starts the thread.
+void CFileWatcher::Start(const std::string& szFileName, std::function<void()> Check,
+						 unsigned int nPollMs)
+{
+	std::size_t nSlash = szFileName.find_last_of("/\\");
+	std::string szDir = (nSlash == std::string::npos) ? std::string(".") : szFileName.substr(0, nSlash + 1);
+
+	Stop();
+
+	m_bStop = false;
+	m_Check = Check;
+	m_nPollMs = nPollMs;
+	m_szName = (nSlash == std::string::npos) ? szFileName : szFileName.substr(nSlash + 1);
+
+#ifdef __linux__
+	if ( pipe(m_Pipe) == 0 )
+	{
+		m_nNotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
 
-		if ( !bAutoSec )
-			m_Flags &= ~AUTOCREATE_SECTIONS;
+		// Written in place, or replaced by rename.
+		if ( m_nNotify >= 0
+			 && inotify_add_watch(m_nNotify, szDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0 )
+		{
+			close(m_nNotify);
+			m_nNotify = -1;
+		}
 	}
 	else
-	{
-		Report(E_INFO, "[CDataFile::Load] Unable to open file. Does it exist?");
-		return false;
-	}
-
-	File.close();
+		m_Pipe[0] = m_Pipe[1] = -1;
+#else
+	(void)szDir;
+#endif
 
-	return true;
+	m_Thread = std::thread(&CFileWatcher::Run, this);
 }
 
-
-// Save
-// Attempts to save the Section list and keys to the file. Note that if Load
-// was never called (the CDataFile object was created manually), then you
-// must set the m_szFileName variable before calling save.
-bool CDataFile::Save()
+// Stop
+// Tells the thread to finish, and waits for it. The thread may be the one
+// calling us, from within m_Check, in which case it can't be waited for.
+void CFileWatcher::Stop()
 {
-	if ( KeyCount() == 0 && SectionCount() == 0 )
+	if ( !m_Thread.joinable() )
+		return;
+
 	{
-		// no point in saving
-		Report(E_INFO, "[CDataFile::Save] Nothing to save.");
-		return false;
+		std::lock_guard<std::mutex> Guard(m_Mutex);
+		m_bStop = true;
 	}
 
-	if ( m_szFileName.size() == 0 )
+	m_Wake.notify_all();
+
+	if ( m_Pipe[1] >= 0 && write(m_Pipe[1], "", 1) < 0 )
+		Report(E_WARN, "[CFileWatcher::Stop] Unable to wake the watcher thread.");
+
+	// The thread will see m_bStop once m_Check returns. The next Stop() from
+	// another thread, or our destructor, will wait for it and tidy up.
+	if ( m_Thread.get_id() == std::this_thread::get_id() )
+		return;
+
+	m_Thread.join();
+
+	if ( m_nNotify >= 0 )
+		close(m_nNotify);
+
+	if ( m_Pipe[0] >= 0 )
 	{
-		Report(E_ERROR, "[CDataFile::Save] No filename has been set.");
-		return false;
+		close(m_Pipe[0]);
+		close(m_Pipe[1]);
 	}
 
-	//fstream File(m_szFileName.c_str(), ios::out|ios::trunc);
-	std::fstream File(m_szFileName.c_str(), std::ios::out|std::ios::trunc);
+	m_nNotify = -1;
+	m_Pipe[0] = m_Pipe[1] = -1;
+}
+
+// Run
+// The watcher thread: checks the file each time Wait() says to, until told
+// to stop.
+void CFileWatcher::Run()
+{
+	while ( Wait() )
+		m_Check();
+}
 
-	if ( File.is_open() )
+// Wait
+// Waits for the file to be written, or for the poll interval to pass.
+// Returns false once we are told to stop.
+bool CFileWatcher::Wait()
+{
+#ifdef __linux__
+	if ( m_nNotify >= 0 )
 	{
-		SectionItor s_pos;
-		KeyItor k_pos;
-		t_Section Section;
-		t_Key Key;
+		std::chrono::steady_clock::time_point Deadline =
+			std::chrono::steady_clock::now() + std::chrono::milliseconds(m_nPollMs);
 
-		for (s_pos = m_Sections.begin(); s_pos != m_Sections.end(); s_pos++)
+		for ( ;; )
 		{
-			Section = (*s_pos);
-			bool bWroteComment = false;
+			// Events for other files in the directory don't put off the
+			// next poll.
+			long nLeft = (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+							Deadline - std::chrono::steady_clock::now()).count();
+			struct pollfd Fds[2];
 
-			if ( Section.szComment.size() > 0 )
-			{
-				bWroteComment = true;
+			Fds[0].fd = m_nNotify;
+			Fds[0].events = POLLIN;
+			Fds[1].fd = m_Pipe[0];
+			Fds[1].events = POLLIN;
+			Fds[0].revents = Fds[1].revents = 0;
 
-				WriteLn(File, "\n%s", CommentStr(Section.szComment).c_str());
-			}
+			int nReady = poll(Fds, 2, nLeft > 0 ? (int)nLeft : 0);
 
-			if ( Section.szName.size() > 0 )
-			{
-				WriteLn(File, "%s[%s]",
-						bWroteComment ? "" : "\n",
-						Section.szName.c_str());
-			}
+			if ( Fds[1].revents != 0 )
+				return false;
 
-			for (k_pos = Section.Keys.begin(); k_pos != Section.Keys.end(); k_pos++)
-			{
-				Key = (*k_pos);
+			if ( nReady <= 0 )
+				return nReady == 0 || errno == EINTR;
 
-				if ( Key.szKey.size() > 0 && Key.szValue.size() > 0 )
+			// Only events for our file are worth a check.
+			bool bOurs = false;
+			char Buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+			ssize_t nRead;
+
+			while ( (nRead = read(m_nNotify, Buffer, sizeof(Buffer))) > 0 )
+			{
+				for (char* pPos = Buffer; pPos < Buffer + nRead; )
 				{
-					WriteLn(File, "%s%s%s%s%c%s",
-						Key.szComment.size() > 0 ? "\n" : "",
-						CommentStr(Key.szComment).c_str(),
-						Key.szComment.size() > 0 ? "\n" : "",
-						Key.szKey.c_str(),
-						EqualIndicators[0],
-						Key.szValue.c_str());
+					struct inotify_event* pEvent = (struct inotify_event*)pPos;
+
+					if ( pEvent->len > 0 && m_szName == pEvent->name )
+						bOurs = true;
+
+					pPos += sizeof(struct inotify_event) + pEvent->len;
 				}
 			}
-		}
 
+			if ( bOurs )
+				return true;
+		}
 	}
-	else
-	{
-		Report(E_ERROR, "[CDataFile::Save] Unable to save file.");
-		return false;
-	}
+#endif
 
-	m_bDirty = false;
+	std::unique_lock<std::mutex> Guard(m_Mutex);
 
-	File.flush();
-	File.close();
+	return !m_Wake.wait_for(Guard, std::chrono::milliseconds(m_nPollMs), [this]{ return m_bStop; });
+}
 
-	return true;
+
+// CRWLock //////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////
+
+CRWLock::CRWLock()
+{
+	m_nReaders = 0;
+	m_nWaiting = 0;
+	m_bWriter = false;
 }
 
-// SetKeyComment
-// Set the comment of a given key. Returns true if the key is not found.
-bool CDataFile::SetKeyComment(std::string szKey, std::string szComment, std::string szSection)
+CRWLock::CRWLock(const CRWLock&)
 {
-	KeyItor k_pos;
-	t_Section* pSection;
+	m_nReaders = 0;
+	m_nWaiting = 0;
+	m_bWriter = false;
+}
 
-	if ( (pSection = GetSection(szSection)) == NULL )
-		return false;
+// operator=
+// A lock belongs to the object it protects, so assignment leaves it alone.
+CRWLock& CRWLock::operator=(const CRWLock&)
+{
+	return *this;
+}
 
-	for (k_pos = pSection->Keys.begin(); k_pos != pSection->Keys.end(); k_pos++)
-	{
-		if ( CompareNoCase( (*k_pos).szKey, szKey ) == 0 )
-		{
-			(*k_pos).szComment = szComment;
-			m_bDirty = true;
-			return true;
-		}
-	}
+// LockShared
+// Waits until no writer holds, or is waiting for, the lock, then takes it
+// shared.
+void CRWLock::LockShared()
+{
+	std::unique_lock<std::mutex> Guard(m_Mutex);
 
-	return false;
+	while ( m_bWriter || m_nWaiting > 0 )
+		m_Readers.wait(Guard);
 
+	m_nReaders++;
 }
 
-// SetSectionComment
-// Set the comment for a given section. Returns false if the section
-// was not found.
-bool CDataFile::SetSectionComment(std::string szSection, std::string szComment)
+// UnlockShared
+// Releases a shared hold on the lock, letting a waiting writer in once the
+// last reader has left.
+void CRWLock::UnlockShared()
 {
-	SectionItor s_pos;
-
-	for (s_pos = m_Sections.begin(); s_pos != m_Sections.end(); s_pos++)
-	{
-		if ( CompareNoCase( (*s_pos).szName, szSection ) == 0 )
-		{
-		    (*s_pos).szComment = szComment;
-			m_bDirty = true;
-			return true;
-		}
-	}
+	std::lock_guard<std::mutex> Guard(m_Mutex);
 
-	return false;
+	if ( --m_nReaders == 0 && m_nWaiting > 0 )
+		m_Writers.notify_one();
 }
 
+// Lock
+// Waits until nobody holds the lock, then takes it exclusively.
+void CRWLock::Lock()
+{
+	std::unique_lock<std::mutex> Guard(m_Mutex);
 
-// SetValue
-// Given a key, a value and a section, this function will attempt to locate the
-// Key within the given section, and if it finds it, change the keys value to
-// the new value. If it does not locate the key, it will create a new key with
-// the proper value and place it in the section requested.
-bool CDataFile::SetValue(std::string szKey, std::string szValue, std::string szComment, std::string szSection)
+	m_nWaiting++;
+
+	while ( m_bWriter || m_nReaders > 0 )
+		m_Writers.wait(Guard);
+
+	m_nWaiting--;
+	m_bWriter = true;
+}
+
+// Unlock
+// Releases the exclusive hold on the lock, handing it to the next waiting
+// writer if there is one, or otherwise to every waiting reader.
+void CRWLock::Unlock()
 {
-	t_Key* pKey = GetKey(szKey, szSection);
-	t_Section* pSection = GetSection(szSection);
+	std::lock_guard<std::mutex> Guard(m_Mutex);
 
-	if (pSection == NULL)
-	{
-		if ( !(m_Flags & AUTOCREATE_SECTIONS) || !CreateSection(szSection,""))
-			return false;
+	m_bWriter = false;
 
-		pSection = GetSection(szSection);
-	}
+	if ( m_nWaiting > 0 )
+		m_Writers.notify_one();
+	else
+		m_Readers.notify_all();
+}
 
-	// Sanity check...
-	if ( pSection == NULL )
-		return false;
 
-	// if the key does not exist in that section, and the value passed
-	// is not t_Str("") then add the new key.
-	if ( pKey == NULL && szValue.size() > 0 && (m_Flags & AUTOCREATE_KEYS))
-	{
-		pKey = new t_Key;
+// CMappedFile //////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////
+
+CMappedFile::CMappedFile()
+{
+	m_pData = NULL;
+	m_nSize = 0;
+}
+
+CMappedFile::~CMappedFile()
+{
+	Close();
+}
 
-		pKey->szKey = szKey;
-		pKey->szValue = szValue;
-		pKey->szComment = szComment;
+// Open
+// Maps the whole of a regular file, read-only and private.
+bool CMappedFile::Open(const std::string& szFileName)
+{
+	Close();
 
-		m_bDirty = true;
+#ifdef WIN32
+	(void)szFileName;
+	return false;
+#else
+	int nFile = open(szFileName.c_str(), O_RDONLY);
+	struct stat Stat;
 
-		pSection->Keys.push_back(*pKey);
+	if ( nFile < 0 )
+		return false;
 
-		return true;
+	if ( fstat(nFile, &Stat) != 0 || !S_ISREG(Stat.st_mode) )
+	{
+		close(nFile);
+		return false;
 	}
 
-	if ( pKey != NULL )
+	if ( Stat.st_size > 0 )
 	{
-		pKey->szValue = szValue;
-		pKey->szComment = szComment;
+		void* pMap = mmap(NULL, (std::size_t)Stat.st_size, PROT_READ, MAP_PRIVATE, nFile, 0);
 
-		m_bDirty = true;
+		if ( pMap == MAP_FAILED )
+		{
+			close(nFile);
+			return false;
+		}
 
-		return true;
+		m_pData = (const char*)pMap;
+		m_nSize = (std::size_t)Stat.st_size;
 	}
 
-	return false;
+	close(nFile);
+
+	return true;
+#endif
 }
 
-// SetFloat
-// Passes the given float to SetValue as a string
-bool CDataFile::SetFloat(std::string szKey, float fValue, std::string szComment, std::string szSection)
+void CMappedFile::Close()
 {
-	char szStr[64];
-
-	snprintf(szStr, 64, "%f", fValue);
+#ifndef WIN32
+	if ( m_pData != NULL )
+		munmap((void*)m_pData, m_nSize);
+#endif
 
-	return SetValue(szKey, szStr, szComment, szSection);
+	m_pData = NULL;
+	m_nSize = 0;
 }
 
-// SetInt
-// Passes the given int to SetValue as a string
-bool CDataFile::SetInt(std::string szKey, int nValue, std::string szComment, std::string szSection)
-{
-	char szStr[64];
-
-	snprintf(szStr, 64, "%d", nValue);
 
-	return SetValue(szKey, szStr, szComment, szSection);
+// CSaveWriter //////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////
 
+CSaveWriter::CSaveWriter()
+{
+	m_bStop = false;
+	m_bPending = false;
 }
 
-// SetBool
-// Passes the given bool to SetValue as a string
-bool CDataFile::SetBool(std::string szKey, bool bValue, std::string szComment, std::string szSection)
+CSaveWriter::CSaveWriter(const CSaveWriter&)
 {
-	std::string szValue = bValue ?  "True" : "False";
-
-	return SetValue(szKey, szValue, szComment, szSection);
+	m_bStop = false;
+	m_bPending = false;
 }
 
-// GetValue
-// Returns the key value as a t_Str object. A return value of
-// t_Str("") indicates that the key could not be found.
-std::string CDataFile::GetValue(std::string szKey, std::string szSection)
+// operator=
+// A writer belongs to the object it saves, so assignment leaves it alone.
+CSaveWriter& CSaveWriter::operator=(const CSaveWriter&)
 {
-	t_Key* pKey = GetKey(szKey, szSection);
-
-	return (pKey == NULL) ? std::string("") : pKey->szValue;
+	return *this;
 }
 
-// GetString
-// Returns the key value as a t_Str object. A return value of
-// t_Str("") indicates that the key could not be found.
-std::string CDataFile::GetString(std::string szKey, std::string szSection)
+// ~CSaveWriter
+// The object being destroyed stops us itself, keeping any request waiting;
+// should one still be here, it can no longer be served.
+CSaveWriter::~CSaveWriter()
 {
-	return GetValue(szKey, szSection);
+	std::promise<bool> Pending;
+
+	if ( Stop(Pending) )
+		Pending.set_value(false);
 }
 
-// GetFloat
-// Returns the key value as a float type. Returns FLT_MIN if the key is
-// not found.
-float CDataFile::GetFloat(std::string szKey, std::string szSection)
+// Request
+// Starts a new request only if none is waiting, so that every request made
+// before the thread takes it shares the one future.
+std::shared_future<bool> CSaveWriter::Request(std::function<bool()> Save)
 {
-	std::string szValue = GetValue(szKey, szSection);
+	std::lock_guard<std::mutex> Guard(m_Mutex);
 
-	if ( szValue.size() == 0 )
-		return FLT_MIN;
+	m_Save = Save;
 
-	return (float)atof( szValue.c_str() );
+	if ( !m_bPending )
+	{
+		m_Pending = std::promise<bool>();
+		m_Future = m_Pending.get_future().share();
+		m_bPending = true;
+		m_Wake.notify_one();
+	}
+
+	if ( !m_Thread.joinable() )
+		m_Thread = std::thread(&CSaveWriter::Run, this);
+
+	return m_Future;
 }
 
-// GetInt
-// Returns the key value as an integer type. Returns INT_MIN if the key is
-// not found.
-int	CDataFile::GetInt(std::string szKey, std::string szSection)
+// Stop
+// Tells the thread to finish once any save under way is done, and waits for
+// it. It may be started again by the next Request().
+bool CSaveWriter::Stop(std::promise<bool>& Pending)
 {
-	std::string szValue = GetValue(szKey, szSection);
+	std::unique_lock<std::mutex> Guard(m_Mutex);
 
-	if ( szValue.size() == 0 )
-		return INT_MIN;
+	if ( m_Thread.joinable() )
+	{
+		m_bStop = true;
+		m_Wake.notify_one();
 
-	return atoi( szValue.c_str() );
+		Guard.unlock();
+		m_Thread.join();
+		Guard.lock();
+
+		m_bStop = false;
+	}
+
+	if ( !m_bPending )
+		return false;
+
+	Pending = std::move(m_Pending);
+	m_bPending = false;
+
+	return true;
 }
 
-// GetBool
-// Returns the key value as a bool type. Returns false if the key is
-// not found.
-bool CDataFile::GetBool(std::string szKey, std::string szSection)
+// Run
+// The writer thread: serves each request in turn, until told to stop.
+void CSaveWriter::Run()
 {
-	bool bValue = false;
-	std::string szValue = GetValue(szKey, szSection);
+	std::unique_lock<std::mutex> Guard(m_Mutex);
 
-	if ( szValue.find("1") == 0
-		|| CompareNoCase(szValue, "true") == 0
-		|| CompareNoCase(szValue, "yes") == 0)
+	for (;;)
 	{
-		bValue = true;
-	}
+		while ( !m_bPending && !m_bStop )
+			m_Wake.wait(Guard);
 
-    //if ( szValue.find("1") == 0
-	//	|| CompareNoCase(szValue, "true")
-	//	|| CompareNoCase(szValue, "yes") )
-	//{
-	//	bValue = true;
-	//}
+		if ( m_bStop )
+			return;
 
-	return bValue;
+		std::promise<bool> Done( std::move(m_Pending) );
+		std::function<bool()> Save = m_Save;
+
+		m_bPending = false;
+		Guard.unlock();
+
+		Done.set_value( Save() );
+
+		Guard.lock();
+	}
 }
 
-// CheckSectionName
-// Return true if section name exists.  False if not.
-bool CDataFile::CheckSectionName(std::string szSectionName)
-{
-    bool bValue = false;
-    t_Section* pSection = GetSection(szSectionName);
 
-    if (pSection != NULL)
-        bValue = true;
+// CDataBatch ///////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////
 
-    return bValue;
+CDataBatch::CDataBatch(CDataFile& File) : m_File(File)
+{
 }
 
-// DeleteSection
-// Delete a specific section. Returns false if the section cannot be
-// found or true when sucessfully deleted.
-bool CDataFile::DeleteSection(std::string szSection)
+// SetValue
+// Queues the value, copying its strings onto the end of the batch's text. A
+// section named just as the last value's was is not copied again.
+void CDataBatch::SetValue(t_StrRef szKey, t_StrRef szValue, t_StrRef szComment, t_StrRef szSection)
 {
-	SectionItor s_pos;
+	t_BatchValue Value;
 
-	for (s_pos = m_Sections.begin(); s_pos != m_Sections.end(); s_pos++)
+	if ( m_Values.size() > 0 && m_Values.back().Section.nLen == szSection.nLen
+		 && memcmp(m_szText.data() + m_Values.back().Section.nAt, szSection.pStr, szSection.nLen) == 0 )
+		Value.Section = m_Values.back().Section;
+	else
 	{
-		if ( CompareNoCase( (*s_pos).szName, szSection ) == 0 )
-		{
-			m_Sections.erase(s_pos);
-			return true;
-		}
+		Value.Section.nAt = m_szText.size();
+		Value.Section.nLen = szSection.nLen;
+		m_szText.append(szSection.pStr, szSection.nLen);
 	}
 
-	return false;
+	Value.Key.nAt = m_szText.size();
+	Value.Key.nLen = szKey.nLen;
+	m_szText.append(szKey.pStr, szKey.nLen);
+
+	Value.Value.nAt = m_szText.size();
+	Value.Value.nLen = szValue.nLen;
+	m_szText.append(szValue.pStr, szValue.nLen);
+
+	Value.Comment.nAt = m_szText.size();
+	Value.Comment.nLen = szComment.nLen;
+	m_szText.append(szComment.pStr, szComment.nLen);
+
+	m_Values.push_back(Value);
 }
 
-// DeleteKey
-// Delete a specific key in a specific section. Returns false if the key
-// cannot be found or true when sucessfully deleted.
-bool CDataFile::DeleteKey(std::string szKey, std::string szFromSection)
+void CDataBatch::Reserve(std::size_t nCount, std::size_t nText)
 {
-	KeyItor k_pos;
-	t_Section* pSection;
+	m_Values.reserve(nCount);
+	m_szText.reserve(nText);
+}
 
-	if ( (pSection = GetSection(szFromSection)) == NULL )
-		return false;
+std::size_t CDataBatch::Size() const
+{
+	return m_Values.size();
+}
 
-	for (k_pos = pSection->Keys.begin(); k_pos != pSection->Keys.end(); k_pos++)
-	{
-		if ( CompareNoCase( (*k_pos).szKey, szKey ) == 0 )
-		{
-			pSection->Keys.erase(k_pos);
-			return true;
-		}
-	}
+bool CDataBatch::Commit()
+{
+	bool bAll = m_File.SetValues(*this);
 
-	return false;
+	Clear();
+
+	return bAll;
 }
 
-// CreateKey
-// Given a key, a value and a section, this function will attempt to locate the
-// Key within the given section, and if it finds it, change the keys value to
-// the new value. If it does not locate the key, it will create a new key with
-// the proper value and place it in the section requested.
-bool CDataFile::CreateKey(std::string szKey, std::string szValue, std::string szComment, std::string szSection)
+void CDataBatch::Clear()
 {
-	bool bAutoKey = (m_Flags & AUTOCREATE_KEYS) == AUTOCREATE_KEYS;
-	bool bReturn  = false;
+	m_Values.clear();
+	m_szText.clear();
+}
 
-	m_Flags |= AUTOCREATE_KEYS;
+t_StrRef CDataBatch::Text(const t_BatchString& String) const
+{
+	return t_StrRef(m_szText.data() + String.nAt, String.nLen);
+}
 
-	bReturn = SetValue(szKey, szValue, szComment, szSection);
 
-	if ( !bAutoKey )
-		m_Flags &= ~AUTOCREATE_KEYS;
+// CHashIndex ///////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////
 
-	return bReturn;
+CHashIndex::CHashIndex()
+{
+	m_nMask = 0;
+	m_nCount = 0;
+	m_nChanges = 1;
 }
 
-
-// CreateSection
-// Given a section name, this function first checks to see if the given section
-// allready exists in the list or not, if not, it creates the new section and
-// assigns it the comment given in szComment.  The function returns true if
-// sucessfully created, or false otherwise.
-bool CDataFile::CreateSection(std::string szSection, std::string szComment)
+// Insert
+// Puts the position in the first free slot from the hash's starting slot on,
+// first growing the table if that would leave it more than half full.
+void CHashIndex::Insert(std::size_t nHash, std::size_t nPos)
 {
-	t_Section* pSection = GetSection(szSection);
-
-	if ( pSection )
-	{
-		Report(E_INFO, "[CDataFile::CreateSection] Section <%s> allready exists. Aborting.", szSection.c_str());
-		return false;
-	}
+	if ( (m_nCount + 1) * 2 > m_Slots.size() )
+		Grow( m_Slots.empty() ? (std::size_t)MIN_SLOTS : m_Slots.size() * 2 );
 
-	pSection = new t_Section;
+	std::size_t nSlot = Start(nHash);
 
-	pSection->szName = szSection;
-	pSection->szComment = szComment;
-	m_Sections.push_back(*pSection);
-	m_bDirty = true;
+	while ( m_Slots[nSlot].nPos != EMPTY_SLOT )
+		nSlot = (nSlot + 1) & m_nMask;
 
-	return true;
+	m_Slots[nSlot].nHash = nHash;
+	m_Slots[nSlot].nPos = nPos;
+	m_nCount++;
+	m_nChanges++;
 }
 
-// CreateSection
-// Given a section name, this function first checks to see if the given section
-// allready exists in the list or not, if not, it creates the new section and
-// assigns it the comment given in szComment.  The function returns true if
-// sucessfully created, or false otherwise. This version accpets a KeyList
-// and sets up the newly created Section with the keys in the list.
-bool CDataFile::CreateSection(std::string szSection, std::string szComment, KeyList Keys)
+// Erase
+// Finds the slot holding the position, then moves each later slot of the run
+// back into the gap, provided that is no nearer its hash's starting slot than
+// it is allowed to be. No slot is ever marked as deleted, so lookups stay as
+// short as they would be had the position never been added.
+void CHashIndex::Erase(std::size_t nHash, std::size_t nPos)
 {
-	if ( !CreateSection(szSection, szComment) )
-		return false;
+	if ( m_Slots.empty() )
+		return;
 
-	t_Section* pSection = GetSection(szSection);
+	std::size_t nSlot = Start(nHash);
 
-	if ( !pSection )
-		return false;
+	while ( m_Slots[nSlot].nPos != nPos )
+	{
+		if ( m_Slots[nSlot].nPos == EMPTY_SLOT )
+			return;
 
-	KeyItor k_pos;
+		nSlot = (nSlot + 1) & m_nMask;
+	}
 
-	pSection->szName = szSection;
-	for (k_pos = Keys.begin(); k_pos != Keys.end(); k_pos++)
+	for (std::size_t nNext = (nSlot + 1) & m_nMask; m_Slots[nNext].nPos != EMPTY_SLOT; nNext = (nNext + 1) & m_nMask)
 	{
-		t_Key* pKey = new t_Key;
-		pKey->szComment = (*k_pos).szComment;
-		pKey->szKey = (*k_pos).szKey;
-		pKey->szValue = (*k_pos).szValue;
+		std::size_t nHome = Start(m_Slots[nNext].nHash);
 
-		pSection->Keys.push_back(*pKey);
+		if ( ((nNext - nHome) & m_nMask) >= ((nNext - nSlot) & m_nMask) )
+		{
+			m_Slots[nSlot] = m_Slots[nNext];
+			nSlot = nNext;
+		}
 	}
 
-	m_Sections.push_back(*pSection);
-	m_bDirty = true;
+	m_Slots[nSlot].nPos = EMPTY_SLOT;
+	m_nCount--;
+	m_nChanges++;
+}
 
-	return true;
+// Reserve
+// Grows the table to the size that nCount positions would grow it to.
+void CHashIndex::Reserve(std::size_t nCount)
+{
+	std::size_t nSlots = m_Slots.empty() ? (std::size_t)MIN_SLOTS : m_Slots.size();
+
+	while ( nCount * 2 > nSlots )
+		nSlots *= 2;
+
+	if ( nSlots > m_Slots.size() )
+		Grow(nSlots);
 }
 
-// SectionCount
-// Simply returns the number of sections in the list.
-int CDataFile::SectionCount()
+// Clear
+// Frees every slot, but keeps the table, to be filled again.
+void CHashIndex::Clear()
 {
-	return m_Sections.size();
+	for (std::size_t nSlot = 0; nSlot < m_Slots.size(); nSlot++)
+		m_Slots[nSlot].nPos = EMPTY_SLOT;
+
+	m_nCount = 0;
+	m_nChanges++;
 }
 
-// KeyCount
-// Returns the total number of keys contained within all the sections.
-int CDataFile::KeyCount()
+// Swap
+// The change counts are not swapped, but both moved past the higher of the
+// two, so that neither index ever shows a count it has shown before.
+void CHashIndex::Swap(CHashIndex& Other)
 {
-	int nCounter = 0;
-	SectionItor s_pos;
+	m_Slots.swap(Other.m_Slots);
+	std::swap(m_nMask, Other.m_nMask);
+	std::swap(m_nCount, Other.m_nCount);
+	m_nChanges = Other.m_nChanges = std::max(m_nChanges, Other.m_nChanges) + 1;
+}
 
-	for (s_pos = m_Sections.begin(); s_pos != m_Sections.end(); s_pos++)
-		nCounter += (*s_pos).Keys.size();
+// Grow
+// Moves every position into a new table of nSlots slots.
+void CHashIndex::Grow(std::size_t nSlots)
+{
+	std::vector<t_Slot> Old(nSlots);
 
-	return nCounter;
+	for (std::size_t nSlot = 0; nSlot < nSlots; nSlot++)
+		Old[nSlot].nPos = EMPTY_SLOT;
+
+	Old.swap(m_Slots);
+	m_nMask = nSlots - 1;
+	m_nCount = 0;
+
+	for (std::size_t nSlot = 0; nSlot < Old.size(); nSlot++)
+	{
+		if ( Old[nSlot].nPos != EMPTY_SLOT )
+			Insert(Old[nSlot].nHash, Old[nSlot].nPos);
+	}
 }
 
 
-// Protected Member Functions ///////////////////////////////////////////////////
+// Utility Functions ////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////
 
-// GetKey
-// Given a key and section name, looks up the key and if found, returns a
-// pointer to that key, otherwise returns NULL.
-t_Key*	CDataFile::GetKey(std::string szKey, std::string szSection)
+// GetFileStamp
+// Fills in Stamp for the named file. Returns false if the file can't be
+// examined (it probably doesn't exist).
+bool GetFileStamp(const std::string& szFileName, t_FileStamp& Stamp)
 {
-	KeyItor k_pos;
-	t_Section* pSection;
+#ifdef WIN32
+	struct _stat Stat;
 
-	// Since our default section has a name value of t_Str("") this should
-	// always return a valid section, wether or not it has any keys in it is
-	// another matter.
-	if ( (pSection = GetSection(szSection)) == NULL )
-		return NULL;
+	if ( szFileName.size() == 0 || _stat(szFileName.c_str(), &Stat) != 0 )
+		return false;
 
-	for (k_pos = pSection->Keys.begin(); k_pos != pSection->Keys.end(); k_pos++)
-	{
-		if ( CompareNoCase( (*k_pos).szKey, szKey ) == 0 )
-			return (t_Key*)&(*k_pos);
-	}
+	Stamp.nSize = (unsigned long long)Stat.st_size;
+	Stamp.nTime = (unsigned long long)Stat.st_mtime;
+	Stamp.nInode = 0;
+#else
+	struct stat Stat;
+
+	if ( szFileName.size() == 0 || stat(szFileName.c_str(), &Stat) != 0 )
+		return false;
+
+	Stamp.nSize = (unsigned long long)Stat.st_size;
+#ifdef __linux__
+	Stamp.nTime = (unsigned long long)Stat.st_mtim.tv_sec * 1000000000ULL + Stat.st_mtim.tv_nsec;
+#else
+	Stamp.nTime = (unsigned long long)Stat.st_mtime;
+#endif
+	Stamp.nInode = (unsigned long long)Stat.st_ino;
+#endif
 
-	return NULL;
+	return true;
 }
 
-// GetSection
-// Given a section name, locates that section in the list and returns a pointer
-// to it. If the section was not found, returns NULL
-t_Section* CDataFile::GetSection(std::string szSection)
+// CommentLen
+// Returns the number of characters AppendComment would add for szComment.
+std::size_t CommentLen(t_StrRef szComment)
 {
-	SectionItor s_pos;
+	t_StrRef szText = TrimRef(szComment);
 
-	for (s_pos = m_Sections.begin(); s_pos != m_Sections.end(); s_pos++)
-	{
-		if ( CompareNoCase( (*s_pos).szName, szSection ) == 0 )
-			return (t_Section*)&(*s_pos);
-	}
+	if ( szText.nLen == 0 )
+		return 0;
 
-	return NULL;
-}
+	if ( CommentIndicators.find(szText.pStr[0]) == std::string::npos )
+		return szText.nLen + 2;
 
+	return szText.nLen;
+}
 
-std::string CDataFile::CommentStr(std::string szComment)
+// AppendComment
+// Appends the comment to szOut the way it is written to disk: trimmed, and
+// led by the first of the CommentIndicators if it does not start with one.
+void AppendComment(std::string& szOut, t_StrRef szComment)
 {
-	std::string szNewStr = std::string("");
-
-	Trim(szComment);
+	t_StrRef szText = TrimRef(szComment);
 
-        if ( szComment.size() == 0 )
-          return szComment;
+	if ( szText.nLen == 0 )
+		return;
 
-	if ( szComment.find_first_of(CommentIndicators) != 0 )
+	if ( CommentIndicators.find(szText.pStr[0]) == std::string::npos )
 	{
-		szNewStr = CommentIndicators[0];
-		szNewStr += " ";
+		szOut += CommentIndicators[0];
+		szOut += ' ';
 	}
 
-	szNewStr += szComment;
-
-	return szNewStr;
+	szOut.append(szText.pStr, szText.nLen);
 }
 
-
-
-// Utility Functions ////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////
-
 // GetNextWord
 // Given a key +delimiter+ value string, pulls the key name from the string,
 // deletes the delimiter and alters the original string to contain the
@@ -747,123 +4636,416 @@ std::string GetNextWord(std::string& CommandLine)
 // CompareNoCase
 // it's amazing what features std::string lacks.  This function simply
 // does a lowercase compare against the two strings, returning 0 if they
-// match.
-int CompareNoCase(std::string str1, std::string str2)
+// match. Neither string is copied.
+int CompareNoCase(t_StrRef str1, t_StrRef str2)
 {
-#ifdef WIN32
-	return stricmp(str1.c_str(), str2.c_str());
-#else
-	return strcasecmp(str1.c_str(), str2.c_str());
-#endif
+	std::size_t nLen = (str1.nLen < str2.nLen) ? str1.nLen : str2.nLen;
+
+	for (std::size_t nPos = 0; nPos < nLen; nPos++)
+	{
+		int c1 = (unsigned char)FoldCase( str1.pStr[nPos] );
+		int c2 = (unsigned char)FoldCase( str2.pStr[nPos] );
+
+		if ( c1 != c2 )
+			return c1 - c2;
+	}
+
+	if ( str1.nLen == str2.nLen )
+		return 0;
+
+	return (str1.nLen < str2.nLen) ? -1 : 1;
+}
+
+// MatchNoCase
+// Walks the pattern and the name together. On a mismatch after a '*', the
+// '*' is made to take one more character of the name and the rest of the
+// pattern tried again from there; only the last '*' seen ever needs to be
+// gone back to, so this takes no more than pattern times name steps.
+bool MatchNoCase(t_StrRef szPattern, t_StrRef szName)
+{
+	const std::size_t nNone = (std::size_t)-1;
+	std::size_t nPat = 0;
+	std::size_t nPos = 0;
+	std::size_t nStar = nNone;
+	std::size_t nStarPos = 0;
+
+	while ( nPos < szName.nLen )
+	{
+		if ( nPat < szPattern.nLen && szPattern.pStr[nPat] == '*' )
+		{
+			nStar = nPat++;
+			nStarPos = nPos;
+		}
+		else if ( nPat < szPattern.nLen && (szPattern.pStr[nPat] == '?'
+				  || FoldCase(szPattern.pStr[nPat]) == FoldCase(szName.pStr[nPos])) )
+		{
+			nPat++;
+			nPos++;
+		}
+		else if ( nStar != nNone )
+		{
+			nPat = nStar + 1;
+			nPos = ++nStarPos;
+		}
+		else
+			return false;
+	}
+
+	while ( nPat < szPattern.nLen && szPattern.pStr[nPat] == '*' )
+		nPat++;
+
+	return nPat == szPattern.nLen;
+}
+
+// HashNoCase
+// Returns a hash of the lowercased string (FNV-1a), so that any two strings
+// CompareNoCase considers equal hash to the same value. HashName() must
+// give the same results.
+std::size_t HashNoCase(t_StrRef str)
+{
+	unsigned long long nHash = 14695981039346656037ULL;
+
+	for (std::size_t nPos = 0; nPos < str.nLen; nPos++)
+	{
+		nHash ^= (unsigned char)FoldCase( str.pStr[nPos] );
+		nHash *= 1099511628211ULL;
+	}
+
+	return (std::size_t)nHash;
+}
+
+// ValueAsInt
+// Converts a value to an int, as GetInt() does. An empty value gives INT_MIN.
+int ValueAsInt(const std::string& szValue)
+{
+	if ( szValue.size() == 0 )
+		return INT_MIN;
+
+	return atoi( szValue.c_str() );
+}
+
+// ValueAsFloat
+// Converts a value to a float, as GetFloat() does. An empty value gives
+// FLT_MIN.
+float ValueAsFloat(const std::string& szValue)
+{
+	if ( szValue.size() == 0 )
+		return FLT_MIN;
+
+	return (float)atof( szValue.c_str() );
+}
+
+// ValueAsBool
+// Converts a value to a bool, as GetBool() does: true if it starts with a 1,
+// or is "true" or "yes", ignoring case.
+bool ValueAsBool(const std::string& szValue)
+{
+	bool bValue = false;
+
+	if ( szValue.find("1") == 0
+		|| CompareNoCase(szValue, "true") == 0
+		|| CompareNoCase(szValue, "yes") == 0)
+	{
+		bValue = true;
+	}
+
+    //if ( szValue.find("1") == 0
+	//	|| CompareNoCase(szValue, "true")
+	//	|| CompareNoCase(szValue, "yes") )
+	//{
+	//	bValue = true;
+	//}
+
+	return bValue;
+}
+
+// IsTrimChar
+// Returns true for the characters that Trim() and TrimRef() remove.
+static bool IsTrimChar(char c)
+{
+	return CharClass.Is(c, CHAR_TRIM);
 }
 
 // Trim
 // Trims whitespace from both sides of a string.
 void Trim(std::string& szStr)
 {
-	std::string szTrimChars = WhiteSpace;
+	t_StrRef szTrimmed = TrimRef(szStr);
+	std::size_t nStart = szTrimmed.pStr - szStr.data();
+
+	szStr.erase(nStart + szTrimmed.nLen);
+	szStr.erase(0, nStart);
+}
+
+// TrimRef
+// Returns the part of the given string that Trim() would leave behind. Nothing
+// is copied; the result refers to the same characters as szStr.
+t_StrRef TrimRef(t_StrRef szStr)
+{
+	const char* pStart = szStr.pStr;
+	const char* pEnd = szStr.pStr + szStr.nLen;
+
+	while ( pStart < pEnd && IsTrimChar(*pStart) )
+		pStart++;
+
+	while ( pEnd > pStart && IsTrimChar(pEnd[-1]) )
+		pEnd--;
+
+	return t_StrRef(pStart, pEnd - pStart);
+}
+
+// FormatStr
+// Formats the given arguments, vsnprintf style, into szOut. Short output is
+// formatted on the stack; anything that doesn't fit in MAX_BUFFER_LEN is
+// measured and formatted again straight into szOut.
+static void FormatStr(std::string& szOut, const char* fmt, va_list args)
+{
+	char buf[MAX_BUFFER_LEN];
+	va_list args2;
 
-	szTrimChars += EqualIndicators;
-	int nPos, rPos;
+	va_copy(args2, args);
+	int nLength = vsnprintf(buf, MAX_BUFFER_LEN, fmt, args);
 
-	// trim left
-	nPos = szStr.find_first_not_of(szTrimChars);
+	if ( nLength >= 0 && nLength < MAX_BUFFER_LEN )
+	{
+		szOut.assign(buf, nLength);
+	}
+	else
+	{
+		va_list args3;
+
+		va_copy(args3, args2);
+#ifdef WIN32
+		nLength = _vscprintf(fmt, args2);
+#else
+		nLength = vsnprintf(NULL, 0, fmt, args2);
+#endif
 
-	if ( nPos > 0 )
-		szStr.erase(0, nPos);
+		if ( nLength < 0 )
+			nLength = 0;
 
-	// trim right and return
-	nPos = szStr.find_last_not_of(szTrimChars);
-	rPos = szStr.find_last_of(szTrimChars);
+		// Format into a buffer one longer than the text, for the terminator,
+		// then drop the terminator.
+		szOut.resize(nLength + 1);
+		vsnprintf(&szOut[0], nLength + 1, fmt, args3);
+		szOut.resize(nLength);
 
-	if ( rPos > nPos && rPos > -1)
-		szStr.erase(rPos, szStr.size()-rPos);
+		va_end(args3);
+	}
+
+	va_end(args2);
 }
 
 // WriteLn
-// Writes the formatted output to the file stream, returning the number of
-// bytes written.
+// Writes the formatted output, followed by a newline, to the file stream,
+// returning the number of bytes written.
 //int WriteLn(fstream& stream, char* fmt, ...)
 int WriteLn(std::fstream& stream, const char* fmt, ...)
 {
-	char buf[MAX_BUFFER_LEN];
-	int nLength;
 	std::string szMsg;
-
-	memset(buf, 0, MAX_BUFFER_LEN);
 	va_list args;
 
 	va_start (args, fmt);
-	  nLength = vsnprintf(buf, MAX_BUFFER_LEN, fmt, args);
+	  FormatStr(szMsg, fmt, args);
 	va_end (args);
 
+	szMsg += '\n';
 
-	if ( buf[nLength] != '\n' && buf[nLength] != '\r' )
-		buf[nLength++] = '\n';
+	stream.write(szMsg.data(), szMsg.size());
 
-
-	stream.write(buf, nLength);
-
-	return nLength;
+	return (int)szMsg.size();
 }
 
+// ReportLevel, pReportSink
+// Set by SetReportLevel and SetReportSink. pReportSink is only used
+// atomically; while it is NULL, messages go to the standard output.
+static std::atomic<int> ReportLevel(E_DEBUG);
+static std::shared_ptr<ReportSink> pReportSink;
+
 // Report
-// A simple reporting function. Outputs the report messages to stdout
+// A simple reporting function. Outputs the report messages to stdout, or to
+// the sink set. Messages below the report level are dropped before anything
+// is formatted, and short ones are formatted on the stack.
 // This is a dumb'd down version of a simmilar function of mine, so if
 // it looks like it should do more than it does, that's why...
 //void Report(e_DebugLevel DebugLevel, char *fmt, ...)
 void Report(e_DebugLevel DebugLevel, const char *fmt, ...)
 {
-	char buf[MAX_BUFFER_LEN];
-	//int nLength;
-	std::string szMsg;
+	if ( DebugLevel < ReportLevel.load(std::memory_order_relaxed) )
+		return;
 
+	char buf[MAX_BUFFER_LEN];
+	const char* szMsg = buf;
+	std::string szLong;
 	va_list args;
-
-	memset(buf, 0, MAX_BUFFER_LEN);
+	va_list args2;
 
 	va_start (args, fmt);
-	  //nLength = vsnprintf(buf, MAX_BUFFER_LEN, fmt, args);
-	  vsnprintf(buf, MAX_BUFFER_LEN, fmt, args);
+	va_copy (args2, args);
+
+	int nLength = vsnprintf(buf, MAX_BUFFER_LEN, fmt, args);
+
+	if ( nLength < 0 || nLength >= MAX_BUFFER_LEN )
+	{
+		FormatStr(szLong, fmt, args2);
+		szMsg = szLong.c_str();
+	}
+
+	va_end (args2);
 	va_end (args);
 
+	std::shared_ptr<ReportSink> pSink = std::atomic_load(&pReportSink);
+
+	if ( pSink )
+	{
+		(*pSink)(DebugLevel, szMsg);
+		return;
+	}
+
+#ifdef WIN32
+	OutputDebugString(ReportTag(DebugLevel));
+	OutputDebugString(szMsg);
+#endif
+
+	// No std::endl: the stream is left to flush itself.
+	std::cout << ReportTag(DebugLevel) << szMsg << '\n';
+}
+
+// SetReportLevel
+// Sets the least level of message Report() lets through.
+void SetReportLevel(e_DebugLevel MinLevel)
+{
+	ReportLevel.store(MinLevel, std::memory_order_relaxed);
+}
+
+// GetReportLevel
+// Returns the level set by SetReportLevel.
+e_DebugLevel GetReportLevel()
+{
+	return (e_DebugLevel)ReportLevel.load(std::memory_order_relaxed);
+}
+
+// IsReported
+// Returns true if Report() would let a message of the level through.
+bool IsReported(e_DebugLevel DebugLevel)
+{
+	return DebugLevel >= ReportLevel.load(std::memory_order_relaxed);
+}
+
+// SetReportSink
+// The sink is held by a shared pointer, so that one being replaced stays good
+// for any Report() still calling it.
+void SetReportSink(ReportSink Sink)
+{
+	std::shared_ptr<ReportSink> pSink;
 
-	//if ( buf[nLength] != '\n' && buf[nLength] != '\r' )
-	//	buf[nLength++] = '\n';
+	if ( Sink )
+		pSink = std::make_shared<ReportSink>( std::move(Sink) );
 
+	std::atomic_store(&pReportSink, pSink);
+}
 
+// ReportTag
+// Returns the tag that marks a message of the level on the standard output.
+const char* ReportTag(e_DebugLevel DebugLevel)
+{
 	switch ( DebugLevel )
 	{
 		case E_DEBUG:
-			szMsg = "<debug> ";
-			break;
+			return "<debug> ";
 		case E_INFO:
-			szMsg = "<info> ";
-			break;
+			return "<info> ";
 		case E_WARN:
-			szMsg = "<warn> ";
-			break;
+			return "<warn> ";
 		case E_ERROR:
-			szMsg = "<error> ";
-			break;
+			return "<error> ";
 		case E_FATAL:
-			szMsg = "<fatal> ";
-			break;
+			return "<fatal> ";
 		case E_CRITICAL:
-			szMsg = "<critical> ";
-			break;
+			return "<critical> ";
+		default:
+			return "";
 	}
+}
 
+#ifndef WIN32
+// SyslogSink
+// Maps our levels onto syslog priorities, one for one.
+ReportSink SyslogSink()
+{
+	return [](e_DebugLevel DebugLevel, const char* szMessage)
+	{
+		static const int Priorities[] = { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERR, LOG_CRIT, LOG_ALERT };
+		int nLevel = std::min<int>(std::max<int>(DebugLevel, E_DEBUG), E_CRITICAL);
+
+		syslog(Priorities[nLevel], "%s", szMessage);
+	};
+}
+#endif
 
-	szMsg += buf;
+// CReportRing
+// Makes an empty ring of room for nCapacity messages (at least one).
+CReportRing::CReportRing(std::size_t nCapacity)
+{
+	m_nCapacity = std::max<std::size_t>(nCapacity, 1);
+	m_nNext = 0;
+	m_nDropped = 0;
+}
 
+// Sink
+// Returns a sink that calls Add, for as long as the ring lives.
+ReportSink CReportRing::Sink()
+{
+	return [this](e_DebugLevel DebugLevel, const char* szMessage) { Add(DebugLevel, szMessage); };
+}
 
-#ifdef WIN32
-	OutputDebugString(szMsg.c_str());
-#endif
+// Add
+// Until the ring is full, messages are simply added to the end. After that
+// each replaces the oldest, at m_nNext, reusing its string.
+void CReportRing::Add(e_DebugLevel DebugLevel, const char* szMessage)
+{
+	std::lock_guard<std::mutex> Guard(m_Mutex);
 
-	//printf(szMsg.c_str());
-	std::cout << szMsg.c_str() << std::endl;
+	if ( m_Messages.size() < m_nCapacity )
+	{
+		m_Messages.push_back( std::string(ReportTag(DebugLevel)) + szMessage );
+		return;
+	}
+
+	m_Messages[m_nNext].assign(ReportTag(DebugLevel));
+	m_Messages[m_nNext].append(szMessage);
+	m_nNext = (m_nNext + 1) % m_nCapacity;
+	m_nDropped++;
+}
+
+// GetMessages
+// Copies the messages out, from the oldest, at m_nNext once full, on.
+std::vector<std::string> CReportRing::GetMessages()
+{
+	std::lock_guard<std::mutex> Guard(m_Mutex);
+	std::vector<std::string> Messages(m_Messages.begin() + m_nNext, m_Messages.end());
+
+	Messages.insert(Messages.end(), m_Messages.begin(), m_Messages.begin() + m_nNext);
+
+	return Messages;
+}
+
+// Dropped
+// Returns the number of messages that have been pushed out by newer ones.
+unsigned long long CReportRing::Dropped()
+{
+	std::lock_guard<std::mutex> Guard(m_Mutex);
+
+	return m_nDropped;
+}
+
+// Clear
+// Empties the ring, leaving the count of dropped messages as it was.
+void CReportRing::Clear()
+{
+	std::lock_guard<std::mutex> Guard(m_Mutex);
 
+	m_Messages.clear();
+	m_nNext = 0;
 }
 
@@ -0,0 +1,922 @@
+//
+// CDataImage Class Implementation
+//
+// Compiles the sections and keys of a CDataFile into a binary image, and
+// reads them back out of one in place. See CDataImage.h for the layout.
+//
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+#include <climits>
+#include <cerrno>
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
+
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "CDataImage.h"
+
+// IMAGE_BYTE_ORDER
+// Written as a std::uint32_t, so that an image written in another byte order
+// reads back as something else.
+#define IMAGE_BYTE_ORDER			0x01020304
+
+
+// AlignImage
+// Rounds an offset within an image up to the next 8 byte boundary.
+static std::uint64_t AlignImage(std::uint64_t nAt)
+{
+	return (nAt + 7) & ~(std::uint64_t)7;
+}
+
+// IsImageString
+// Returns true if a string, and the null after it, lie within the string
+// table.
+static bool IsImageString(const t_ImageString& String, const char* pStrings, std::uint64_t nStringsLen)
+{
+	return String.nAt < nStringsLen && String.nLen < nStringsLen - String.nAt
+		   && pStrings[String.nAt + String.nLen] == '\0';
+}
+
+// AddString
+// Adds szStr to the string table, unless it is there allready, and returns
+// where it is. Pooled maps each string added so far to its place.
+static t_ImageString AddString(std::string& szStrings, std::unordered_map<std::string, t_ImageString>& Pooled,
+							   const std::string& szStr)
+{
+	std::unordered_map<std::string, t_ImageString>::iterator i_pos = Pooled.find(szStr);
+
+	if ( i_pos != Pooled.end() )
+		return (*i_pos).second;
+
+	t_ImageString String;
+
+	String.nAt = (std::uint32_t)szStrings.size();
+	String.nLen = (std::uint32_t)szStr.size();
+
+	szStrings.append(szStr);
+	szStrings.push_back('\0');
+
+	Pooled.insert( std::make_pair(szStr, String) );
+
+	return String;
+}
+
+// ConvertValue
+// Fills in the typed values of a key's image record, converting its value as
+// GetInt(), GetFloat() and GetBool() would.
+static void ConvertValue(const t_Key& Key, t_ImageKey& Image)
+{
+	Image.nHash = HashNoCase(Key.szKey);
+	Image.nInt = ValueAsInt(Key.szValue);
+	Image.fFloat = ValueAsFloat(Key.szValue);
+	Image.bBool = ValueAsBool(Key.szValue);
+	Image.nReserved = 0;
+}
+
+
+// CDataImage
+// Our default constructor. The object starts out closed.
+CDataImage::CDataImage()
+{
+	m_pImage = NULL;
+	m_nSize = 0;
+	m_bMapped = false;
+
+	m_pHeader = NULL;
+	m_pSections = NULL;
+	m_pSectionIndex = NULL;
+	m_pKeys = NULL;
+	m_pKeyIndex = NULL;
+	m_pStrings = NULL;
+}
+
+// ~CDataImage
+// Closes the image, if one is open.
+CDataImage::~CDataImage()
+{
+	Close();
+}
+
+// Open
+// Maps the image into memory, or, should that not be possible, reads it into
+// m_Buffer, and checks it over. Nothing is reported on failure: an image
+// that is missing or out of date is to be expected, and the caller decides
+// what to do about it.
+bool CDataImage::Open(const std::string& szImageFile)
+{
+	Close();
+
+#ifndef WIN32
+	int nFile = open(szImageFile.c_str(), O_RDONLY);
+
+	if ( nFile < 0 )
+		return false;
+
+	MapImage(nFile, false);
+	close(nFile);
+#endif
+
+	if ( m_pImage == NULL )
+	{
+		t_FileStamp Stamp;
+		FILE* pFile;
+
+		if ( !GetFileStamp(szImageFile, Stamp) || (pFile = fopen(szImageFile.c_str(), "rb")) == NULL )
+			return false;
+
+		// Held as 64 bit words, so that the records are aligned as they
+		// would be in a mapping.
+		m_nSize = (std::size_t)Stamp.nSize;
+		m_Buffer.resize( (m_nSize + 7) / 8 + 1 );
+		m_pImage = (const char*)&m_Buffer[0];
+
+		bool bRead = fread(&m_Buffer[0], 1, m_nSize, pFile) == m_nSize;
+
+		fclose(pFile);
+
+		if ( !bRead )
+		{
+			Close();
+			return false;
+		}
+	}
+
+	return Attach();
+}
+
+// OpenShared
+// Maps the image from a shared memory segment. There is nothing to fall back
+// on here, should it not map.
+bool CDataImage::OpenShared(const std::string& szSegment)
+{
+	Close();
+
+#ifdef WIN32
+	(void)szSegment;
+	return false;
+#else
+	int nFile = shm_open(szSegment.c_str(), O_RDONLY, 0);
+
+	if ( nFile < 0 )
+		return false;
+
+	MapImage(nFile, true);
+	close(nFile);
+
+	return Attach();
+#endif
+}
+
+#ifndef WIN32
+// MapImage
+// Maps the open file, if it is big enough to hold an image. Shared memory
+// segments need not look like regular files (bShared), but files must.
+void CDataImage::MapImage(int nFile, bool bShared)
+{
+	struct stat Stat;
+
+	if ( fstat(nFile, &Stat) == 0 && (bShared || S_ISREG(Stat.st_mode))
+		 && (std::size_t)Stat.st_size >= sizeof(t_ImageHeader) )
+	{
+		void* pMap = mmap(NULL, (std::size_t)Stat.st_size, PROT_READ, MAP_PRIVATE, nFile, 0);
+
+		if ( pMap != MAP_FAILED )
+		{
+			m_pImage = (const char*)pMap;
+			m_nSize = (std::size_t)Stat.st_size;
+			m_bMapped = true;
+		}
+	}
+}
+#endif
+
+// Attach
+// Checks over the image now in m_pImage, and finds its parts. Closes it, and
+// returns false, if it is not sound.
+bool CDataImage::Attach()
+{
+	if ( m_nSize < sizeof(t_ImageHeader) )
+	{
+		Close();
+		return false;
+	}
+
+	m_pHeader = (const t_ImageHeader*)m_pImage;
+
+	if ( !Validate() )
+	{
+		Close();
+		return false;
+	}
+
+	m_pSections = (const t_ImageSection*)(m_pImage + m_pHeader->nSectionsAt);
+	m_pSectionIndex = (const std::uint32_t*)(m_pImage + m_pHeader->nSectionIndexAt);
+	m_pKeys = (const t_ImageKey*)(m_pImage + m_pHeader->nKeysAt);
+	m_pKeyIndex = (const std::uint32_t*)(m_pImage + m_pHeader->nKeyIndexAt);
+	m_pStrings = m_pImage + m_pHeader->nStringsAt;
+
+	return true;
+}
+
+// Close
+// Unmaps, or frees, the image.
+void CDataImage::Close()
+{
+#ifndef WIN32
+	if ( m_bMapped )
+		munmap((void*)m_pImage, m_nSize);
+#endif
+
+	std::vector<std::uint64_t>().swap(m_Buffer);
+
+	m_pImage = NULL;
+	m_nSize = 0;
+	m_bMapped = false;
+
+	m_pHeader = NULL;
+	m_pSections = NULL;
+	m_pSectionIndex = NULL;
+	m_pKeys = NULL;
+	m_pKeyIndex = NULL;
+	m_pStrings = NULL;
+}
+
+// IsOpen
+// Returns true if an image is open.
+bool CDataImage::IsOpen() const
+{
+	return m_pStrings != NULL;
+}
+
+// GetSourceStamp
+// Returns the stamp of the file the image was compiled from, all zero if it
+// was not compiled from one (or no image is open).
+t_FileStamp CDataImage::GetSourceStamp() const
+{
+	t_FileStamp Stamp;
+
+	if ( IsOpen() )
+	{
+		Stamp.nSize = m_pHeader->nSourceSize;
+		Stamp.nTime = m_pHeader->nSourceTime;
+		Stamp.nInode = m_pHeader->nSourceInode;
+	}
+
+	return Stamp;
+}
+
+// GetValueRef
+// Returns the value of the key, straight out of the image. Returns an empty
+// value if there is no such key.
+t_StrRef CDataImage::GetValueRef(t_StrRef szKey, t_StrRef szSection) const
+{
+	const t_ImageKey* pKey = FindKey(szKey, szSection);
+
+	if ( pKey == NULL )
+		return t_StrRef();
+
+	return String(pKey->Value);
+}
+
+// GetValue
+// Returns the value of the key, or an empty string if there is no such key.
+std::string CDataImage::GetValue(t_StrRef szKey, t_StrRef szSection) const
+{
+	t_StrRef szValue = GetValueRef(szKey, szSection);
+
+	return std::string(szValue.pStr, szValue.nLen);
+}
+
+// GetString
+// Returns the value of the key, or an empty string if there is no such key.
+std::string CDataImage::GetString(t_StrRef szKey, t_StrRef szSection) const
+{
+	return GetValue(szKey, szSection);
+}
+
+// GetFloat
+// Returns the value of the key as a float, converted when the image was
+// built. Returns FLT_MIN if the key is not found, or has no value.
+float CDataImage::GetFloat(t_StrRef szKey, t_StrRef szSection) const
+{
+	const t_ImageKey* pKey = FindKey(szKey, szSection);
+
+	return (pKey == NULL) ? FLT_MIN : pKey->fFloat;
+}
+
+// GetInt
+// Returns the value of the key as an int, converted when the image was
+// built. Returns INT_MIN if the key is not found, or has no value.
+int CDataImage::GetInt(t_StrRef szKey, t_StrRef szSection) const
+{
+	const t_ImageKey* pKey = FindKey(szKey, szSection);
+
+	return (pKey == NULL) ? INT_MIN : pKey->nInt;
+}
+
+// GetBool
+// Returns the value of the key as a bool, converted when the image was
+// built. Returns false if the key is not found.
+bool CDataImage::GetBool(t_StrRef szKey, t_StrRef szSection) const
+{
+	const t_ImageKey* pKey = FindKey(szKey, szSection);
+
+	return (pKey == NULL) ? false : pKey->bBool != 0;
+}
+
+// CheckSectionName
+// Returns true if the image holds the named section.
+bool CDataImage::CheckSectionName(t_StrRef szSectionName) const
+{
+	return FindSection(szSectionName) != NULL;
+}
+
+// SectionCount
+// Returns the number of sections in the image.
+int CDataImage::SectionCount() const
+{
+	return IsOpen() ? (int)m_pHeader->nSections : 0;
+}
+
+// KeyCount
+// Returns the total number of keys, across all the sections of the image.
+int CDataImage::KeyCount() const
+{
+	return IsOpen() ? (int)m_pHeader->nKeys : 0;
+}
+
+// GetSections
+// Copies every section and key out of the image, in their original order.
+// The typed values converted when the image was built are put straight into
+// each key's cache, so that they need not be converted again.
+void CDataImage::GetSections(SectionList& Sections) const
+{
+	Sections.clear();
+
+	if ( !IsOpen() )
+		return;
+
+	Sections.resize(m_pHeader->nSections);
+
+	for (std::uint32_t nSection = 0; nSection < m_pHeader->nSections; nSection++)
+	{
+		const t_ImageSection& Image = m_pSections[nSection];
+		t_Section& Section = Sections[nSection];
+		t_StrRef szName = String(Image.Name);
+		t_StrRef szComment = String(Image.Comment);
+
+		Section.szName.assign(szName.pStr, szName.nLen);
+		Section.szComment.assign(szComment.pStr, szComment.nLen);
+		Section.Keys.resize(Image.nKeys);
+
+		for (std::uint32_t nKey = 0; nKey < Image.nKeys; nKey++)
+		{
+			const t_ImageKey& KeyImage = m_pKeys[Image.nFirstKey + nKey];
+			t_Key& Key = Section.Keys[nKey];
+			t_StrRef szKey = String(KeyImage.Name);
+			t_StrRef szValue = String(KeyImage.Value);
+			t_StrRef szKeyComment = String(KeyImage.Comment);
+
+			Key.szKey.assign(szKey.pStr, szKey.nLen);
+			Key.szValue.assign(szValue.pStr, szValue.nLen);
+			Key.szComment.assign(szKeyComment.pStr, szKeyComment.nLen);
+
+			// Keys without a value are never converted through the cache.
+			if ( szValue.nLen > 0 )
+			{
+				Key.Cache.nInt.store(KeyImage.nInt, std::memory_order_relaxed);
+				Key.Cache.fFloat.store(KeyImage.fFloat, std::memory_order_relaxed);
+				Key.Cache.bBool.store(KeyImage.bBool != 0, std::memory_order_relaxed);
+				Key.Cache.nValid.store(t_ValueCache::CACHED_INT | t_ValueCache::CACHED_FLOAT
+									   | t_ValueCache::CACHED_BOOL, std::memory_order_relaxed);
+			}
+		}
+	}
+}
+
+// Build
+// Lays the sections and keys out as an image. Each string is only stored
+// once, however many keys share it.
+bool CDataImage::Build(const SectionList& Sections, const t_FileStamp& Source, std::string& szOut)
+{
+	std::vector<t_ImageSection> ImageSections(Sections.size());
+	std::vector<std::uint32_t> SectionIndex(Sections.size());
+	std::vector<t_ImageKey> ImageKeys;
+	std::vector<std::uint32_t> KeyIndex;
+	std::string szStrings;
+	std::unordered_map<std::string, t_ImageString> Pooled;
+	std::size_t nKeys = 0;
+
+	for (std::size_t nSection = 0; nSection < Sections.size(); nSection++)
+		nKeys += Sections[nSection].Keys.size();
+
+	if ( Sections.size() > UINT32_MAX || nKeys > UINT32_MAX )
+	{
+		Report(E_ERROR, "[CDataImage::Build] Too many sections or keys for an image.");
+		return false;
+	}
+
+	ImageKeys.resize(nKeys);
+	KeyIndex.resize(nKeys);
+	nKeys = 0;
+
+	for (std::size_t nSection = 0; nSection < Sections.size(); nSection++)
+	{
+		const t_Section& Section = Sections[nSection];
+		t_ImageSection& Image = ImageSections[nSection];
+
+		Image.nHash = HashNoCase(Section.szName);
+		Image.Name = AddString(szStrings, Pooled, Section.szName);
+		Image.Comment = AddString(szStrings, Pooled, Section.szComment);
+		Image.nFirstKey = (std::uint32_t)nKeys;
+		Image.nKeys = (std::uint32_t)Section.Keys.size();
+
+		for (std::size_t nKey = 0; nKey < Section.Keys.size(); nKey++, nKeys++)
+		{
+			const t_Key& Key = Section.Keys[nKey];
+
+			ConvertValue(Key, ImageKeys[nKeys]);
+			ImageKeys[nKeys].Name = AddString(szStrings, Pooled, Key.szKey);
+			ImageKeys[nKeys].Value = AddString(szStrings, Pooled, Key.szValue);
+			ImageKeys[nKeys].Comment = AddString(szStrings, Pooled, Key.szComment);
+			KeyIndex[nKeys] = (std::uint32_t)nKeys;
+		}
+
+		// Ties are broken by position, so that a lookup finds the first of
+		// any duplicates, as CDataFile does.
+		std::sort(KeyIndex.begin() + Image.nFirstKey, KeyIndex.begin() + nKeys,
+				  [&ImageKeys](std::uint32_t nLeft, std::uint32_t nRight)
+				  {
+					  return ImageKeys[nLeft].nHash < ImageKeys[nRight].nHash
+							 || (ImageKeys[nLeft].nHash == ImageKeys[nRight].nHash && nLeft < nRight);
+				  });
+
+		SectionIndex[nSection] = (std::uint32_t)nSection;
+	}
+
+	std::sort(SectionIndex.begin(), SectionIndex.end(),
+			  [&ImageSections](std::uint32_t nLeft, std::uint32_t nRight)
+			  {
+				  return ImageSections[nLeft].nHash < ImageSections[nRight].nHash
+						 || (ImageSections[nLeft].nHash == ImageSections[nRight].nHash && nLeft < nRight);
+			  });
+
+	if ( szStrings.size() > UINT32_MAX )
+	{
+		Report(E_ERROR, "[CDataImage::Build] Too much text for an image.");
+		return false;
+	}
+
+	t_ImageHeader Header;
+
+	memcpy(Header.szMagic, IMAGE_MAGIC, sizeof(Header.szMagic));
+	Header.nVersion = IMAGE_VERSION;
+	Header.nByteOrder = IMAGE_BYTE_ORDER;
+	Header.nHashSize = sizeof(std::size_t);
+	Header.nSections = (std::uint32_t)ImageSections.size();
+	Header.nKeys = (std::uint32_t)ImageKeys.size();
+	Header.nReserved = 0;
+	Header.nSourceSize = Source.nSize;
+	Header.nSourceTime = Source.nTime;
+	Header.nSourceInode = Source.nInode;
+	Header.nSectionsAt = AlignImage(sizeof(t_ImageHeader));
+	Header.nSectionIndexAt = AlignImage(Header.nSectionsAt + ImageSections.size() * sizeof(t_ImageSection));
+	Header.nKeysAt = AlignImage(Header.nSectionIndexAt + SectionIndex.size() * sizeof(std::uint32_t));
+	Header.nKeyIndexAt = AlignImage(Header.nKeysAt + ImageKeys.size() * sizeof(t_ImageKey));
+	Header.nStringsAt = AlignImage(Header.nKeyIndexAt + KeyIndex.size() * sizeof(std::uint32_t));
+	Header.nStringsLen = szStrings.size();
+	Header.nImageSize = Header.nStringsAt + szStrings.size();
+
+	szOut.assign((std::size_t)Header.nImageSize, '\0');
+
+	memcpy(&szOut[0], &Header, sizeof(Header));
+	if ( ImageSections.size() > 0 )
+	{
+		memcpy(&szOut[Header.nSectionsAt], &ImageSections[0], ImageSections.size() * sizeof(t_ImageSection));
+		memcpy(&szOut[Header.nSectionIndexAt], &SectionIndex[0], SectionIndex.size() * sizeof(std::uint32_t));
+	}
+	if ( ImageKeys.size() > 0 )
+	{
+		memcpy(&szOut[Header.nKeysAt], &ImageKeys[0], ImageKeys.size() * sizeof(t_ImageKey));
+		memcpy(&szOut[Header.nKeyIndexAt], &KeyIndex[0], KeyIndex.size() * sizeof(std::uint32_t));
+	}
+	if ( szStrings.size() > 0 )
+		memcpy(&szOut[Header.nStringsAt], szStrings.data(), szStrings.size());
+
+	return true;
+}
+
+
+// Private Member Functions /////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////
+
+// Validate
+// Checks that the header is one of ours, and that every offset, length and
+// position in the image lies within it, so that nothing read from it later
+// can stray outside it. This is a single pass of comparisons, with nothing
+// parsed or copied. Also checks that the indexes are in order, as the
+// lookups rely on their being so.
+bool CDataImage::Validate() const
+{
+	const t_ImageHeader& Header = *m_pHeader;
+	std::uint64_t nSize = m_nSize;
+
+	if ( memcmp(Header.szMagic, IMAGE_MAGIC, sizeof(Header.szMagic)) != 0
+		 || Header.nVersion != IMAGE_VERSION
+		 || Header.nByteOrder != IMAGE_BYTE_ORDER
+		 || Header.nHashSize != sizeof(std::size_t)
+		 || Header.nImageSize != nSize )
+	{
+		return false;
+	}
+
+	// Each part must start on a boundary and end within the image. The counts
+	// are 32 bit and the records small, so none of this can overflow.
+	struct { std::uint64_t nAt; std::uint64_t nLen; } Parts[] =
+	{
+		{ Header.nSectionsAt, (std::uint64_t)Header.nSections * sizeof(t_ImageSection) },
+		{ Header.nSectionIndexAt, (std::uint64_t)Header.nSections * sizeof(std::uint32_t) },
+		{ Header.nKeysAt, (std::uint64_t)Header.nKeys * sizeof(t_ImageKey) },
+		{ Header.nKeyIndexAt, (std::uint64_t)Header.nKeys * sizeof(std::uint32_t) },
+		{ Header.nStringsAt, Header.nStringsLen }
+	};
+
+	for (std::size_t nPart = 0; nPart < sizeof(Parts) / sizeof(Parts[0]); nPart++)
+	{
+		if ( Parts[nPart].nAt % 8 != 0 || Parts[nPart].nAt < sizeof(t_ImageHeader)
+			 || Parts[nPart].nAt > nSize || Parts[nPart].nLen > nSize - Parts[nPart].nAt )
+		{
+			return false;
+		}
+	}
+
+	const t_ImageSection* pSections = (const t_ImageSection*)(m_pImage + Header.nSectionsAt);
+	const std::uint32_t* pSectionIndex = (const std::uint32_t*)(m_pImage + Header.nSectionIndexAt);
+	const t_ImageKey* pKeys = (const t_ImageKey*)(m_pImage + Header.nKeysAt);
+	const std::uint32_t* pKeyIndex = (const std::uint32_t*)(m_pImage + Header.nKeyIndexAt);
+	const char* pStrings = m_pImage + Header.nStringsAt;
+	std::uint64_t nStringsLen = Header.nStringsLen;
+
+	for (std::uint32_t nSection = 0; nSection < Header.nSections; nSection++)
+	{
+		const t_ImageSection& Section = pSections[nSection];
+		std::uint32_t nIndexed = pSectionIndex[nSection];
+
+		if ( !IsImageString(Section.Name, pStrings, nStringsLen) || !IsImageString(Section.Comment, pStrings, nStringsLen)
+			 || Section.nFirstKey > Header.nKeys || Section.nKeys > Header.nKeys - Section.nFirstKey
+			 || nIndexed >= Header.nSections
+			 || (nSection > 0 && pSections[pSectionIndex[nSection - 1]].nHash > pSections[nIndexed].nHash) )
+		{
+			return false;
+		}
+
+		for (std::uint32_t nKey = Section.nFirstKey; nKey < Section.nFirstKey + Section.nKeys; nKey++)
+		{
+			std::uint32_t nKeyIndexed = pKeyIndex[nKey];
+
+			if ( nKeyIndexed < Section.nFirstKey || nKeyIndexed >= Section.nFirstKey + Section.nKeys
+				 || (nKey > Section.nFirstKey && pKeys[pKeyIndex[nKey - 1]].nHash > pKeys[nKeyIndexed].nHash) )
+			{
+				return false;
+			}
+		}
+	}
+
+	for (std::uint32_t nKey = 0; nKey < Header.nKeys; nKey++)
+	{
+		const t_ImageKey& Key = pKeys[nKey];
+
+		if ( !IsImageString(Key.Name, pStrings, nStringsLen) || !IsImageString(Key.Value, pStrings, nStringsLen)
+			 || !IsImageString(Key.Comment, pStrings, nStringsLen) )
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// String
+// Returns a string of the string table.
+t_StrRef CDataImage::String(const t_ImageString& String) const
+{
+	return t_StrRef(m_pStrings + String.nAt, String.nLen);
+}
+
+// FindSection
+// Binary searches the section index for the section's hash, then confirms
+// the name. Of several sections with the same name, the first is found.
+// Returns NULL if there is no such section.
+const t_ImageSection* CDataImage::FindSection(t_StrRef szSection) const
+{
+	if ( !IsOpen() )
+		return NULL;
+
+	std::uint64_t nHash = HashNoCase(szSection);
+	const std::uint32_t* pEnd = m_pSectionIndex + m_pHeader->nSections;
+	const t_ImageSection* pSections = m_pSections;
+	const std::uint32_t* pPos = std::lower_bound(m_pSectionIndex, pEnd, nHash,
+		[pSections](std::uint32_t nSection, std::uint64_t nWanted) { return pSections[nSection].nHash < nWanted; });
+
+	for (; pPos != pEnd && m_pSections[*pPos].nHash == nHash; pPos++)
+	{
+		if ( CompareNoCase( String(m_pSections[*pPos].Name), szSection ) == 0 )
+			return &m_pSections[*pPos];
+	}
+
+	return NULL;
+}
+
+// FindKey
+// As FindSection, for a key within the named section.
+const t_ImageKey* CDataImage::FindKey(t_StrRef szKey, t_StrRef szSection) const
+{
+	const t_ImageSection* pSection = FindSection(szSection);
+
+	if ( pSection == NULL )
+		return NULL;
+
+	std::uint64_t nHash = HashNoCase(szKey);
+	const std::uint32_t* pBegin = m_pKeyIndex + pSection->nFirstKey;
+	const std::uint32_t* pEnd = pBegin + pSection->nKeys;
+	const t_ImageKey* pKeys = m_pKeys;
+	const std::uint32_t* pPos = std::lower_bound(pBegin, pEnd, nHash,
+		[pKeys](std::uint32_t nKey, std::uint64_t nWanted) { return pKeys[nKey].nHash < nWanted; });
+
+	for (; pPos != pEnd && m_pKeys[*pPos].nHash == nHash; pPos++)
+	{
+		if ( CompareNoCase( String(m_pKeys[*pPos].Name), szKey ) == 0 )
+			return &m_pKeys[*pPos];
+	}
+
+	return NULL;
+}
+
+
+// CSharedImage /////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////
+
+// The generation is read and written through the mapping by every process
+// attached, so it must be a plain word in memory, with no lock on the side.
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "CSharedImage needs lock free 64 bit atomics");
+
+// SharedName
+// POSIX shared memory names start with a '/', so one is added if need be.
+static std::string SharedName(const std::string& szName)
+{
+	return (szName.size() > 0 && szName[0] == '/') ? szName : "/" + szName;
+}
+
+// SegmentName
+// Names the segment holding the given generation published under szName.
+static std::string SegmentName(const std::string& szName, std::uint64_t nGeneration)
+{
+	return SharedName(szName) + "." + std::to_string((unsigned long long)nGeneration);
+}
+
+// CSharedImage
+// Our default constructor. The object starts out detached.
+CSharedImage::CSharedImage()
+	: m_pImage(new CDataImage)
+{
+	m_pControl = NULL;
+	m_nGeneration = 0;
+}
+
+CSharedImage::~CSharedImage()
+{
+	Detach();
+}
+
+// Attach
+// Maps the control segment, and keeps it mapped, shared, so that Refresh()
+// sees each new generation as it is published.
+bool CSharedImage::Attach(const std::string& szName)
+{
+	Detach();
+
+#ifdef WIN32
+	(void)szName;
+	return false;
+#else
+	int nFile = shm_open(SharedName(szName).c_str(), O_RDONLY, 0);
+	struct stat Stat;
+	void* pMap = MAP_FAILED;
+
+	if ( nFile < 0 )
+		return false;
+
+	if ( fstat(nFile, &Stat) == 0 && (std::size_t)Stat.st_size >= sizeof(t_SharedControl) )
+		pMap = mmap(NULL, sizeof(t_SharedControl), PROT_READ, MAP_SHARED, nFile, 0);
+
+	close(nFile);
+
+	if ( pMap == MAP_FAILED )
+		return false;
+
+	m_szName = SharedName(szName);
+	m_pControl = (const t_SharedControl*)pMap;
+
+	if ( memcmp(m_pControl->szMagic, SHARED_MAGIC, sizeof(m_pControl->szMagic)) != 0 || !AttachLatest() )
+	{
+		Detach();
+		return false;
+	}
+
+	return true;
+#endif
+}
+
+// Refresh
+bool CSharedImage::Refresh()
+{
+	if ( m_pControl == NULL || m_pControl->nGeneration.load(std::memory_order_acquire) == m_nGeneration )
+		return false;
+
+	return AttachLatest();
+}
+
+// Detach
+void CSharedImage::Detach()
+{
+#ifndef WIN32
+	if ( m_pControl != NULL )
+		munmap((void*)m_pControl, sizeof(t_SharedControl));
+#endif
+
+	m_pImage->Close();
+	m_pControl = NULL;
+	m_nGeneration = 0;
+	m_szName.clear();
+}
+
+// IsAttached
+bool CSharedImage::IsAttached() const
+{
+	return m_pImage->IsOpen();
+}
+
+// AttachLatest
+// Opens the latest generation into an image of its own, and only once that
+// has worked lets go of the one attached before. Should the generation be
+// replaced, and unlinked, between reading it and opening it, the newer one
+// is tried instead.
+bool CSharedImage::AttachLatest()
+{
+	std::uint64_t nGeneration = m_pControl->nGeneration.load(std::memory_order_acquire);
+
+	while ( nGeneration != 0 )
+	{
+		std::unique_ptr<CDataImage> pImage(new CDataImage);
+
+		if ( pImage->OpenShared(SegmentName(m_szName, nGeneration)) )
+		{
+			m_pImage.swap(pImage);
+			m_nGeneration = nGeneration;
+			return true;
+		}
+
+		std::uint64_t nLatest = m_pControl->nGeneration.load(std::memory_order_acquire);
+
+		if ( nLatest == nGeneration )
+			break;
+
+		nGeneration = nLatest;
+	}
+
+	return false;
+}
+
+// Publish
+// Writes the image into a segment of its own, created read only, under the
+// generation after the latest (or the first after that which is free, should
+// another process be publishing too), and only then makes it the latest. The
+// generation never goes back: a publication overtaken by a later one while
+// it was written is simply unlinked.
+std::uint64_t CSharedImage::Publish(const std::string& szName, const std::string& szImage)
+{
+#ifdef WIN32
+	(void)szName;
+	(void)szImage;
+	return 0;
+#else
+	std::string szShared = SharedName(szName);
+	int nControl = shm_open(szShared.c_str(), O_RDWR | O_CREAT, 0644);
+	struct stat Stat;
+	void* pMap = MAP_FAILED;
+
+	if ( nControl < 0 )
+		return 0;
+
+	// A new control segment reads as all zeros: no magic, and no generation.
+	if ( fstat(nControl, &Stat) == 0
+		 && ((std::size_t)Stat.st_size >= sizeof(t_SharedControl) || ftruncate(nControl, sizeof(t_SharedControl)) == 0) )
+		pMap = mmap(NULL, sizeof(t_SharedControl), PROT_READ | PROT_WRITE, MAP_SHARED, nControl, 0);
+
+	close(nControl);
+
+	if ( pMap == MAP_FAILED )
+		return 0;
+
+	t_SharedControl* pControl = (t_SharedControl*)pMap;
+	static const char szNoMagic[sizeof(pControl->szMagic)] = { 0 };
+
+	if ( memcmp(pControl->szMagic, szNoMagic, sizeof(pControl->szMagic)) == 0 )
+		memcpy(pControl->szMagic, SHARED_MAGIC, sizeof(pControl->szMagic));
+
+	if ( memcmp(pControl->szMagic, SHARED_MAGIC, sizeof(pControl->szMagic)) != 0 )
+	{
+		munmap(pMap, sizeof(t_SharedControl));
+		return 0;
+	}
+
+	std::uint64_t nGeneration = pControl->nGeneration.load(std::memory_order_acquire) + 1;
+	int nFile;
+
+	while ( (nFile = shm_open(SegmentName(szShared, nGeneration).c_str(), O_RDWR | O_CREAT | O_EXCL, 0444)) < 0
+			&& errno == EEXIST )
+		nGeneration++;
+
+	void* pImage = MAP_FAILED;
+
+	if ( nFile >= 0 && ftruncate(nFile, szImage.size()) == 0 )
+		pImage = mmap(NULL, szImage.size(), PROT_READ | PROT_WRITE, MAP_SHARED, nFile, 0);
+
+	if ( nFile >= 0 )
+		close(nFile);
+
+	if ( pImage == MAP_FAILED )
+	{
+		if ( nFile >= 0 )
+			shm_unlink(SegmentName(szShared, nGeneration).c_str());
+
+		munmap(pMap, sizeof(t_SharedControl));
+		return 0;
+	}
+
+	memcpy(pImage, szImage.data(), szImage.size());
+	munmap(pImage, szImage.size());
+
+	std::uint64_t nLast = pControl->nGeneration.load(std::memory_order_acquire);
+
+	while ( nLast < nGeneration
+			&& !pControl->nGeneration.compare_exchange_weak(nLast, nGeneration, std::memory_order_acq_rel) )
+		;
+
+	if ( nLast > nGeneration )
+		shm_unlink(SegmentName(szShared, nGeneration).c_str());
+	else if ( nLast != 0 )
+		shm_unlink(SegmentName(szShared, nLast).c_str());
+
+	munmap(pMap, sizeof(t_SharedControl));
+
+	return nGeneration;
+#endif
+}
+
+// Remove
+bool CSharedImage::Remove(const std::string& szName)
+{
+#ifdef WIN32
+	(void)szName;
+	return false;
+#else
+	std::string szShared = SharedName(szName);
+	int nControl = shm_open(szShared.c_str(), O_RDONLY, 0);
+	struct stat Stat;
+
+	if ( nControl < 0 )
+		return false;
+
+	if ( fstat(nControl, &Stat) == 0 && (std::size_t)Stat.st_size >= sizeof(t_SharedControl) )
+	{
+		void* pMap = mmap(NULL, sizeof(t_SharedControl), PROT_READ, MAP_SHARED, nControl, 0);
+
+		if ( pMap != MAP_FAILED )
+		{
+			std::uint64_t nGeneration = ((const t_SharedControl*)pMap)->nGeneration.load(std::memory_order_acquire);
+
+			if ( nGeneration != 0 )
+				shm_unlink(SegmentName(szShared, nGeneration).c_str());
+
+			munmap(pMap, sizeof(t_SharedControl));
+		}
+	}
+
+	close(nControl);
+
+	return shm_unlink(szShared.c_str()) == 0;
+#endif
+}
@@ -0,0 +1,548 @@
+/// DataFileBench.cpp //////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+//
+// Benchmarks the CDataFile object against synthetic .ini files, so that
+// changes to it can be measured rather than guessed at. For each shape of
+// file asked for (sections, keys per section and value size), a file is
+// generated and then timed through Load, Save, GetValue and GetInt (of keys
+// that are there and keys that are not), SetValue (of existing keys and of
+// new ones), DeleteKey and KeyCount.
+//
+// The results are written as JSON, one object per run, with the throughput
+// of each operation and percentiles of its latency, for scripts to compare.
+//
+// DataFileBench [options]
+//
+//   --sections N     Sections per file          (default: a set of shapes)
+//   --keys N         Keys per section
+//   --value-size N   Characters per value
+//   --ops N          Timed operations per lookup/update benchmark (100000)
+//   --loads N        Timed loads and saves per file (20)
+//   --seed N         Seed for the key choices (1)
+//   --file NAME      The file generated (bench.ini, then removed)
+//   --out NAME       Write the JSON to NAME, rather than stdout
+//   --no-mmap        Load through the stream reader rather than MMAP_LOAD
+//   --parallel       Load with PARALLEL_LOAD
+//
+////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "CDataFile.h"
+
+typedef std::chrono::steady_clock	t_Clock;
+
+// st_shape
+// The shape of a generated file.
+typedef struct st_shape
+{
+	int			nSections;
+	int			nKeys;			// Per section
+	int			nValueSize;
+
+} t_Shape;
+
+// st_options
+// The command line.
+typedef struct st_options
+{
+	std::vector<t_Shape>	Shapes;
+	int			nOps;
+	int			nLoads;
+	unsigned int	nSeed;
+	std::string	szFile;
+	std::string	szOut;
+	long		nFlags;
+
+	st_options()
+	{
+		nOps = 100000;
+		nLoads = 20;
+		nSeed = 1;
+		szFile = "bench.ini";
+		nFlags = AUTOCREATE_SECTIONS | AUTOCREATE_KEYS | MMAP_LOAD;
+	}
+
+} t_Options;
+
+// st_result
+// One operation's timings: the time taken by each of nOps operations, or by
+// each batch of nPerSample of them, where one is too quick to time alone.
+typedef struct st_result
+{
+	std::string	szName;
+	std::vector<double>	Samples;	// Nanoseconds per operation
+	double		fTotalNs;
+	long long	nOps;
+	long long	nBytes;			// Bytes handled, where that means anything
+
+	st_result(const std::string& szResultName)
+	{
+		szName = szResultName;
+		fTotalNs = 0;
+		nOps = 0;
+		nBytes = 0;
+	}
+
+} t_Result;
+
+// CBenchRandom
+// A small, seeded generator (xorshift), so that every run picks the same keys
+// on every platform.
+class CBenchRandom
+{
+public:
+	CBenchRandom(unsigned int nSeed) : m_nState(nSeed * 2654435761u + 1) {}
+
+	unsigned int	Next(unsigned int nRange)
+	{
+		m_nState ^= m_nState << 13;
+		m_nState ^= m_nState >> 17;
+		m_nState ^= m_nState << 5;
+
+		return m_nState % nRange;
+	}
+
+private:
+	unsigned int	m_nState;
+};
+
+// SectionName, KeyName
+// The names the generator gives the nth section and key.
+static std::string SectionName(int nSection)
+{
+	char szName[32];
+
+	snprintf(szName, sizeof(szName), "Section%d", nSection);
+
+	return szName;
+}
+
+static std::string KeyName(int nKey)
+{
+	char szName[32];
+
+	snprintf(szName, sizeof(szName), "Key%d", nKey);
+
+	return szName;
+}
+
+// GenerateFile
+// Writes a file of the given shape to szFile. Each value starts with a number,
+// so that GetInt has something to convert, and is padded out to size. Some
+// sections and keys get comments. Returns the size of the file, or -1.
+static long long GenerateFile(const std::string& szFile, const t_Shape& Shape)
+{
+	FILE* pFile = fopen(szFile.c_str(), "wb");
+	long long nBytes = 0;
+	std::string szLine;
+
+	if ( pFile == NULL )
+		return -1;
+
+	for (int nSection = 0; nSection < Shape.nSections; nSection++)
+	{
+		szLine.clear();
+
+		if ( nSection % 4 == 0 )
+			szLine += "; Comment for " + SectionName(nSection) + "\n";
+
+		szLine += "[" + SectionName(nSection) + "]\n";
+
+		for (int nKey = 0; nKey < Shape.nKeys; nKey++)
+		{
+			char szNumber[32];
+			std::size_t nStart;
+
+			if ( nKey % 8 == 0 )
+				szLine += "; Comment for " + KeyName(nKey) + "\n";
+
+			snprintf(szNumber, sizeof(szNumber), "%d", nSection * Shape.nKeys + nKey);
+
+			szLine += KeyName(nKey) + " = ";
+			nStart = szLine.size();
+			szLine += szNumber;
+
+			while ( szLine.size() - nStart < (std::size_t)Shape.nValueSize )
+				szLine += (char)('a' + (szLine.size() % 26));
+
+			szLine += "\n";
+		}
+
+		szLine += "\n";
+
+		if ( fwrite(szLine.data(), 1, szLine.size(), pFile) != szLine.size() )
+		{
+			fclose(pFile);
+			return -1;
+		}
+
+		nBytes += szLine.size();
+	}
+
+	if ( fclose(pFile) != 0 )
+		return -1;
+
+	return nBytes;
+}
+
+// ElapsedNs
+// Nanoseconds from Start to now.
+static double ElapsedNs(const t_Clock::time_point& Start)
+{
+	return std::chrono::duration<double, std::nano>(t_Clock::now() - Start).count();
+}
+
+// Percentile
+// The fPercent percentile of the sorted samples, nearest rank.
+static double Percentile(const std::vector<double>& Sorted, double fPercent)
+{
+	if ( Sorted.empty() )
+		return 0;
+
+	std::size_t nRank = (std::size_t)(fPercent / 100.0 * Sorted.size());
+
+	return Sorted[std::min(nRank, Sorted.size() - 1)];
+}
+
+// PickNames
+// Chooses nOps (section, key) pairs at random from the shape, with keys that
+// are not there when bMissing is set, and puts them in Sections and Keys.
+static void PickNames(const t_Shape& Shape, int nOps, bool bMissing, CBenchRandom& Random,
+					  std::vector<std::string>& Sections, std::vector<std::string>& Keys)
+{
+	Sections.resize(nOps);
+	Keys.resize(nOps);
+
+	for (int nOp = 0; nOp < nOps; nOp++)
+	{
+		Sections[nOp] = SectionName(Random.Next(Shape.nSections));
+		Keys[nOp] = bMissing ? "Missing" + KeyName(Random.Next(Shape.nKeys))
+							 : KeyName(Random.Next(Shape.nKeys));
+	}
+}
+
+// BATCH_OPS
+// Operations timed together as one sample, which keeps the cost of reading
+// the clock down to a small part of what is measured.
+#define BATCH_OPS					16
+
+// TimeLookups
+// Times Op(nOp) for each pair picked, in batches of BATCH_OPS.
+template <class OP>
+static void TimeLookups(t_Result& Result, int nOps, OP Op)
+{
+	t_Clock::time_point Start = t_Clock::now();
+
+	for (int nOp = 0; nOp < nOps; nOp += BATCH_OPS)
+	{
+		int nBatch = std::min(BATCH_OPS, nOps - nOp);
+		t_Clock::time_point BatchStart = t_Clock::now();
+
+		for (int nPos = nOp; nPos < nOp + nBatch; nPos++)
+			Op(nPos);
+
+		Result.Samples.push_back( ElapsedNs(BatchStart) / nBatch );
+	}
+
+	Result.fTotalNs += ElapsedNs(Start);
+	Result.nOps += nOps;
+}
+
+// RunShape
+// Generates a file of the given shape and times every operation on it.
+static bool RunShape(const t_Options& Options, const t_Shape& Shape, std::vector<t_Result>& Results)
+{
+	long long nFileBytes = GenerateFile(Options.szFile, Shape);
+	std::string szSaveFile = Options.szFile + ".save";
+	std::vector<std::string> Sections;
+	std::vector<std::string> Keys;
+	CBenchRandom Random(Options.nSeed);
+	volatile long long nSink = 0;
+
+	if ( nFileBytes < 0 )
+	{
+		fprintf(stderr, "Unable to write <%s>.\n", Options.szFile.c_str());
+		return false;
+	}
+
+	// Load
+	{
+		t_Result Result("load");
+
+		for (int nLoad = 0; nLoad < Options.nLoads; nLoad++)
+		{
+			CDataFile DataFile;
+			t_Clock::time_point Start = t_Clock::now();
+
+			DataFile.m_Flags = Options.nFlags;
+			if ( !DataFile.Load(Options.szFile) )
+			{
+				fprintf(stderr, "Unable to load <%s>.\n", Options.szFile.c_str());
+				return false;
+			}
+
+			double fNs = ElapsedNs(Start);
+
+			Result.Samples.push_back(fNs);
+			Result.fTotalNs += fNs;
+			Result.nOps++;
+			Result.nBytes += nFileBytes;
+			DataFile.ClearDirty();
+		}
+
+		Results.push_back(Result);
+	}
+
+	CDataFile DataFile;
+
+	DataFile.m_Flags = Options.nFlags;
+	DataFile.Load(Options.szFile);
+	DataFile.ClearDirty();
+
+	// Save
+	{
+		t_Result Result("save");
+
+		DataFile.SetFileName(szSaveFile);
+
+		for (int nSave = 0; nSave < Options.nLoads; nSave++)
+		{
+			t_Clock::time_point Start = t_Clock::now();
+
+			if ( !DataFile.Save() )
+			{
+				fprintf(stderr, "Unable to save <%s>.\n", szSaveFile.c_str());
+				return false;
+			}
+
+			double fNs = ElapsedNs(Start);
+
+			Result.Samples.push_back(fNs);
+			Result.fTotalNs += fNs;
+			Result.nOps++;
+			Result.nBytes += nFileBytes;
+		}
+
+		Results.push_back(Result);
+		remove(szSaveFile.c_str());
+	}
+
+	// GetValue and GetInt, of keys that are there, and keys that are not
+	{
+		t_Result Hit("get_value_hit");
+		t_Result Miss("get_value_miss");
+		t_Result IntHit("get_int_hit");
+		t_Result IntMiss("get_int_miss");
+
+		PickNames(Shape, Options.nOps, false, Random, Sections, Keys);
+		TimeLookups(Hit, Options.nOps, [&](int nOp) { nSink += DataFile.GetValue(Keys[nOp], Sections[nOp]).size(); });
+		TimeLookups(IntHit, Options.nOps, [&](int nOp) { nSink += DataFile.GetInt(Keys[nOp], Sections[nOp]); });
+
+		PickNames(Shape, Options.nOps, true, Random, Sections, Keys);
+		TimeLookups(Miss, Options.nOps, [&](int nOp) { nSink += DataFile.GetValue(Keys[nOp], Sections[nOp]).size(); });
+		TimeLookups(IntMiss, Options.nOps, [&](int nOp) { nSink += DataFile.GetInt(Keys[nOp], Sections[nOp]); });
+
+		Results.push_back(Hit);
+		Results.push_back(Miss);
+		Results.push_back(IntHit);
+		Results.push_back(IntMiss);
+	}
+
+	// SetValue, of keys that are there, and of new keys
+	{
+		t_Result Update("set_value_update");
+		t_Result Insert("set_value_insert");
+		std::string szValue(Shape.nValueSize, 'v');
+
+		PickNames(Shape, Options.nOps, false, Random, Sections, Keys);
+		TimeLookups(Update, Options.nOps, [&](int nOp) { nSink += DataFile.SetValue(Keys[nOp], szValue, "", Sections[nOp]); });
+
+		for (int nOp = 0; nOp < Options.nOps; nOp++)
+			Keys[nOp] = "New" + KeyName(nOp);
+
+		TimeLookups(Insert, Options.nOps, [&](int nOp) { nSink += DataFile.SetValue(Keys[nOp], szValue, "", Sections[nOp]); });
+
+		Results.push_back(Update);
+		Results.push_back(Insert);
+	}
+
+	// KeyCount
+	{
+		t_Result Count("key_count");
+		int nCalls = std::max(1, Options.nOps / 100);
+
+		TimeLookups(Count, nCalls, [&](int) { nSink += DataFile.KeyCount(); });
+		Results.push_back(Count);
+	}
+
+	// DeleteKey, of the keys just inserted
+	{
+		t_Result Delete("delete_key");
+
+		TimeLookups(Delete, Options.nOps, [&](int nOp) { nSink += DataFile.DeleteKey(Keys[nOp], Sections[nOp]); });
+		Results.push_back(Delete);
+	}
+
+	DataFile.ClearDirty();
+	remove(Options.szFile.c_str());
+
+	return true;
+}
+
+// WriteResults
+// Writes one run's results, as a JSON object, to pOut.
+static void WriteResults(FILE* pOut, const t_Options& Options, const t_Shape& Shape,
+						 std::vector<t_Result>& Results, bool bLast)
+{
+	fprintf(pOut, "  {\n");
+	fprintf(pOut, "    \"sections\": %d, \"keys_per_section\": %d, \"value_size\": %d,\n",
+			Shape.nSections, Shape.nKeys, Shape.nValueSize);
+	fprintf(pOut, "    \"ops\": %d, \"loads\": %d, \"seed\": %u, \"flags\": %ld,\n",
+			Options.nOps, Options.nLoads, Options.nSeed, Options.nFlags);
+	fprintf(pOut, "    \"results\": [\n");
+
+	for (std::size_t nResult = 0; nResult < Results.size(); nResult++)
+	{
+		t_Result& Result = Results[nResult];
+		double fSeconds = Result.fTotalNs / 1e9;
+
+		std::sort(Result.Samples.begin(), Result.Samples.end());
+
+		fprintf(pOut, "      {\"name\": \"%s\", \"ops\": %lld, \"seconds\": %.6f, \"ops_per_sec\": %.1f",
+				Result.szName.c_str(), Result.nOps, fSeconds,
+				fSeconds > 0 ? Result.nOps / fSeconds : 0.0);
+
+		if ( Result.nBytes > 0 )
+			fprintf(pOut, ", \"mb_per_sec\": %.1f", fSeconds > 0 ? Result.nBytes / fSeconds / 1e6 : 0.0);
+
+		fprintf(pOut, ", \"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f, \"max_ns\": %.1f}%s\n",
+				Percentile(Result.Samples, 50), Percentile(Result.Samples, 90),
+				Percentile(Result.Samples, 99), Result.Samples.empty() ? 0.0 : Result.Samples.back(),
+				nResult + 1 < Results.size() ? "," : "");
+	}
+
+	fprintf(pOut, "    ]\n");
+	fprintf(pOut, "  }%s\n", bLast ? "" : ",");
+}
+
+// ParseOptions
+// Reads the command line into Options. Returns false, having said why, if it
+// cannot.
+static bool ParseOptions(int argc, char* argv[], t_Options& Options)
+{
+	t_Shape Shape;
+	bool bShape = false;
+
+	Shape.nSections = 100;
+	Shape.nKeys = 100;
+	Shape.nValueSize = 16;
+
+	for (int nArg = 1; nArg < argc; nArg++)
+	{
+		std::string szArg = argv[nArg];
+		bool bValue = nArg + 1 < argc;
+
+		if ( szArg == "--no-mmap" )
+			Options.nFlags &= ~MMAP_LOAD;
+		else if ( szArg == "--parallel" )
+			Options.nFlags |= PARALLEL_LOAD;
+		else if ( szArg == "--sections" && bValue )
+			Shape.nSections = atoi(argv[++nArg]), bShape = true;
+		else if ( szArg == "--keys" && bValue )
+			Shape.nKeys = atoi(argv[++nArg]), bShape = true;
+		else if ( szArg == "--value-size" && bValue )
+			Shape.nValueSize = atoi(argv[++nArg]), bShape = true;
+		else if ( szArg == "--ops" && bValue )
+			Options.nOps = atoi(argv[++nArg]);
+		else if ( szArg == "--loads" && bValue )
+			Options.nLoads = atoi(argv[++nArg]);
+		else if ( szArg == "--seed" && bValue )
+			Options.nSeed = (unsigned int)strtoul(argv[++nArg], NULL, 10);
+		else if ( szArg == "--file" && bValue )
+			Options.szFile = argv[++nArg];
+		else if ( szArg == "--out" && bValue )
+			Options.szOut = argv[++nArg];
+		else
+		{
+			fprintf(stderr, "Unknown option <%s>. See the top of DataFileBench.cpp.\n", szArg.c_str());
+			return false;
+		}
+	}
+
+	if ( Shape.nSections < 1 || Shape.nKeys < 1 || Shape.nValueSize < 1
+		 || Options.nOps < 1 || Options.nLoads < 1 )
+	{
+		fprintf(stderr, "Counts and sizes must be at least 1.\n");
+		return false;
+	}
+
+	if ( bShape )
+	{
+		Options.Shapes.push_back(Shape);
+		return true;
+	}
+
+	// Many small sections, a few big ones, and big values.
+	const t_Shape Defaults[] = { {1000, 10, 16}, {10, 1000, 16}, {100, 100, 1024} };
+
+	Options.Shapes.assign(Defaults, Defaults + sizeof(Defaults) / sizeof(Defaults[0]));
+
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	t_Options Options;
+	std::vector< std::vector<t_Result> > Runs;
+	FILE* pOut = stdout;
+
+	if ( !ParseOptions(argc, argv, Options) )
+		return 2;
+
+	if ( Options.szOut.size() > 0 && (pOut = fopen(Options.szOut.c_str(), "w")) == NULL )
+	{
+		fprintf(stderr, "Unable to write <%s>.\n", Options.szOut.c_str());
+		return 1;
+	}
+
+	// Every shape is run before anything is written, so that a run that
+	// fails part way leaves no partial JSON behind it.
+	for (std::size_t nShape = 0; nShape < Options.Shapes.size(); nShape++)
+	{
+		Runs.push_back( std::vector<t_Result>() );
+
+		if ( !RunShape(Options, Options.Shapes[nShape], Runs.back()) )
+		{
+			if ( pOut != stdout )
+			{
+				fclose(pOut);
+				remove(Options.szOut.c_str());
+			}
+
+			return 1;
+		}
+	}
+
+	fprintf(pOut, "[\n");
+
+	for (std::size_t nShape = 0; nShape < Options.Shapes.size(); nShape++)
+		WriteResults(pOut, Options, Options.Shapes[nShape], Runs[nShape], nShape + 1 == Options.Shapes.size());
+
+	fprintf(pOut, "]\n");
+
+	if ( pOut != stdout && fclose(pOut) != 0 )
+	{
+		fprintf(stderr, "Unable to write <%s>.\n", Options.szOut.c_str());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,1613 @@
+/// DataFileCheck.cpp //////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+//
+// Checks the CDataFile object against what it promises, so that a change to
+// it that breaks something is caught before it ships. Each check builds or
+// loads files of its own, does something to them, and compares the result
+// with what it should be; the shipped .ini files are read too, so run it from
+// the top of the tree. Every check is run, and each failure is reported with
+// its line. The exit status is the number of checks that failed (0 if none).
+//
+// DataFileCheck [name ...]
+//
+//   name             Run only the checks named (default: all of them)
+//
+////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstdlib>
+#include <cfloat>
+#include <climits>
+#include <cstring>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#ifndef WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "CDataFile.h"
+#include "CDataImage.h"
+
+// CHECK
+// Records a failure of the check being run, with its line, if the
+// expression is false.
+#define CHECK(expr)			Check((expr), #expr, __LINE__)
+
+// CHECK_SAME
+// As CHECK, for two strings that should be the same, showing both if not.
+#define CHECK_SAME(a, b)	CheckSame((a), (b), #a, #b, __LINE__)
+
+typedef void (*CheckFunction)();
+
+// st_check
+// A check, by name.
+typedef struct st_check
+{
+	const char*		szName;
+	CheckFunction	pCheck;
+
+} t_Check;
+
+// The failures of the check being run.
+static int g_nFailures = 0;
+
+// Check
+// Reports, and counts, a failed expression.
+static void Check(bool bOk, const char* szExpr, int nLine)
+{
+	if ( bOk )
+		return;
+
+	printf("    line %d: CHECK(%s) failed\n", nLine, szExpr);
+	g_nFailures++;
+}
+
+// CheckSame
+// Reports, and counts, two strings that differ.
+static void CheckSame(const std::string& szA, const std::string& szB, const char* szExprA,
+					  const char* szExprB, int nLine)
+{
+	if ( szA == szB )
+		return;
+
+	printf("    line %d: %s differs from %s\n--- %s\n%s\n--- %s\n%s\n", nLine, szExprA, szExprB,
+		   szExprA, szA.c_str(), szExprB, szB.c_str());
+	g_nFailures++;
+}
+
+// WriteFile
+// Replaces the named file with szText. Returns false if it cannot.
+static bool WriteFile(const std::string& szFile, const std::string& szText)
+{
+	FILE* pFile = fopen(szFile.c_str(), "wb");
+
+	if ( pFile == NULL )
+		return false;
+
+	bool bOk = fwrite(szText.data(), 1, szText.size(), pFile) == szText.size();
+
+	return fclose(pFile) == 0 && bOk;
+}
+
+// ReadFile
+// Returns the contents of the named file, or an empty string.
+static std::string ReadFile(const std::string& szFile)
+{
+	FILE* pFile = fopen(szFile.c_str(), "rb");
+	std::string szText;
+	char szBuffer[4096];
+	std::size_t nRead;
+
+	if ( pFile == NULL )
+		return szText;
+
+	while ( (nRead = fread(szBuffer, 1, sizeof(szBuffer), pFile)) > 0 )
+		szText.append(szBuffer, nRead);
+
+	fclose(pFile);
+
+	return szText;
+}
+
+// CountOf
+// The number of times szWhat appears in szText.
+static int CountOf(const std::string& szText, const std::string& szWhat)
+{
+	int nCount = 0;
+
+	for (std::size_t nPos = szText.find(szWhat); nPos != std::string::npos; nPos = szText.find(szWhat, nPos + 1))
+		nCount++;
+
+	return nCount;
+}
+
+// Dump
+// Renders every section and key of the file, with their comments as Save()
+// would write them, one to a line, so that two files can be compared as
+// strings.
+static std::string Dump(CDataFile& File)
+{
+	std::string szOut;
+
+	for (CSectionView Section : File.Sections())
+	{
+		szOut += "[" + std::string(Section.Name().pStr, Section.Name().nLen) + "] {";
+		AppendComment(szOut, Section.Comment());
+		szOut += "}\n";
+
+		for (CKeyView Key : Section.Keys())
+		{
+			szOut += "  " + std::string(Key.Name().pStr, Key.Name().nLen);
+			szOut += "=" + std::string(Key.Value().pStr, Key.Value().nLen) + " {";
+			AppendComment(szOut, Key.Comment());
+			szOut += "}\n";
+		}
+	}
+
+	return szOut;
+}
+
+// LoadDump
+// Loads the named file with the given flags, and returns Dump() of it, or
+// "<not loaded>".
+static std::string LoadDump(const std::string& szFile, long nFlags)
+{
+	CDataFile File;
+
+	File.m_Flags = nFlags;
+
+	if ( !File.Load(szFile) )
+		return "<not loaded>";
+
+	std::string szOut = Dump(File);
+
+	File.ClearDirty();
+
+	return szOut;
+}
+
+/// Checks /////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////
+
+// CheckLoaders
+// MMAP_LOAD and the stream reader give the same sections, keys and comments,
+// for the shipped files and for one full of awkward lines.
+static void CheckLoaders()
+{
+	const long nStream = AUTOCREATE_SECTIONS | AUTOCREATE_KEYS;
+	const char* Files[] = { "CrapSim.ini", "win.ini", "new.ini", "check_loaders.ini" };
+
+	// A line longer than the stream reader reads at a time, to be reassembled.
+	std::string szLong = "long = " + std::string(LOAD_CHUNK_LEN + 100, 'x') + "\n";
+
+	CHECK( WriteFile("check_loaders.ini",
+		"top = before any section\r\n"
+		"; comment for the first section\n"
+		"# in two styles\n"
+		"[First]\n"
+		"   spaced   =   out value   \t\n"
+		"colon : separated\n"
+		"=no key\n"
+		"no value =\n"
+		"no separator at all\n"
+		"\n"
+		"; comment for a key\n"
+		"with = equals = inside\n"
+		+ szLong +
+		"[Unclosed\n"
+		"key = in unclosed\n"
+		"[Bracket]ed]\n"
+		"key = in bracketed\n"
+		"[  Padded  ]\n"
+		"; left dangling at the end\n"
+		"last = no newline") );
+
+	for (std::size_t nFile = 0; nFile < sizeof(Files) / sizeof(Files[0]); nFile++)
+	{
+		std::string szMapped = LoadDump(Files[nFile], nStream | MMAP_LOAD);
+		std::string szStream = LoadDump(Files[nFile], nStream);
+
+		CHECK( szMapped != "<not loaded>" );
+		CHECK_SAME( szMapped, szStream );
+	}
+
+	// The default constructor maps, and gives the same again.
+	CDataFile File;
+
+	CHECK( (File.m_Flags & MMAP_LOAD) == MMAP_LOAD );
+	CHECK( File.Load("check_loaders.ini") );
+	CHECK_SAME( Dump(File), LoadDump("check_loaders.ini", nStream) );
+	// Values keep the blanks after the separator, as they always have.
+	CHECK( File.GetValue("spaced", "First") == "   out value" );
+	CHECK( File.GetValue("colon", "First") == " separated" );
+	CHECK( File.GetValue("with", "First") == " equals = inside" );
+	CHECK( File.GetValue("key", "Unclosed") == " in unclosed" );
+	CHECK( File.GetValue("long", "First").size() == LOAD_CHUNK_LEN + 101 );
+	CHECK( File.GetValue("last", "  Padded  ") == " no newline" );
+	File.ClearDirty();
+
+	remove("check_loaders.ini");
+}
+
+// CheckIncremental
+// INCREMENTAL_SAVE appends updated and new keys, and new sections, and the
+// file reloads to just what is in memory. Deletes, and appended blocks
+// that outgrow the file, have it rewritten in full instead.
+static void CheckIncremental()
+{
+	const std::string szBase =
+		"[Alpha]\n"
+		"one=1\n"
+		"; two's comment\n"
+		"two=2\n"
+		"\n"
+		"[Beta]\n"
+		"three=3\n"
+		"four=4\n";
+	CDataFile File;
+	std::string szText;
+	std::string szPadding = "\n[Padding]\n";
+
+	// Enough that the first few blocks are appended, rather than outgrowing
+	// the file.
+	for (int nKey = 0; nKey < 50; nKey++)
+		szPadding += "pad" + std::to_string(nKey) + "=" + std::string(10, 'p') + "\n";
+
+	CHECK( WriteFile("check_incremental.ini", szBase + szPadding) );
+
+	File.m_Flags |= INCREMENTAL_SAVE;
+	File.SetFileName("check_incremental.ini");
+	CHECK( File.Load("check_incremental.ini") );
+
+	// An update
+	CHECK( File.SetValue("one", "uno", "", "Alpha") );
+	CHECK( File.Save() );
+	szText = ReadFile("check_incremental.ini");
+	CHECK( szText.compare(0, szBase.size(), szBase) == 0 );
+	CHECK( CountOf(szText, "[Alpha]") == 2 );
+	CHECK_SAME( LoadDump("check_incremental.ini", File.m_Flags), Dump(File) );
+
+	// A new key, with a comment, and an update of a key with one
+	CHECK( File.SetValue("five", "5", "new key", "Beta") );
+	CHECK( File.SetValue("two", "dos", "", "Alpha") );
+	CHECK( File.Save() );
+	szText = ReadFile("check_incremental.ini");
+	CHECK( szText.compare(0, szBase.size(), szBase) == 0 );
+	CHECK( CountOf(szText, "[Beta]") == 2 );
+	CHECK_SAME( LoadDump("check_incremental.ini", File.m_Flags), Dump(File) );
+
+	// A new section, with a comment
+	CHECK( File.CreateSection("Gamma", "new section") );
+	CHECK( File.SetValue("six", "6", "", "Gamma") );
+	CHECK( File.Save() );
+	szText = ReadFile("check_incremental.ini");
+	CHECK( szText.compare(0, szBase.size(), szBase) == 0 );
+	CHECK( CountOf(szText, "[Gamma]") == 1 );
+	CHECK_SAME( LoadDump("check_incremental.ini", File.m_Flags), Dump(File) );
+
+	// Nothing changed: nothing appended
+	std::string szBefore = ReadFile("check_incremental.ini");
+
+	CHECK( File.Save() );
+	CHECK( ReadFile("check_incremental.ini") == szBefore );
+
+	// A deleted key has the file rewritten, with each section once
+	CHECK( File.DeleteKey("three", "Beta") );
+	CHECK( File.Save() );
+	szText = ReadFile("check_incremental.ini");
+	CHECK( CountOf(szText, "[Alpha]") == 1 && CountOf(szText, "[Beta]") == 1 );
+	CHECK( CountOf(szText, "three") == 0 );
+	CHECK_SAME( LoadDump("check_incremental.ini", File.m_Flags), Dump(File) );
+
+	// Appending works again after the rewrite
+	CHECK( File.SetValue("four", "cuatro", "", "Beta") );
+	CHECK( File.Save() );
+	szText = ReadFile("check_incremental.ini");
+	CHECK( CountOf(szText, "[Beta]") == 2 );
+	CHECK_SAME( LoadDump("check_incremental.ini", File.m_Flags), Dump(File) );
+
+	// So does a deleted section
+	CHECK( File.DeleteSection("Gamma") );
+	CHECK( File.Save() );
+	szText = ReadFile("check_incremental.ini");
+	CHECK( CountOf(szText, "[Gamma]") == 0 && CountOf(szText, "[Beta]") == 1 );
+	CHECK_SAME( LoadDump("check_incremental.ini", File.m_Flags), Dump(File) );
+
+	// Blocks are appended until they would outgrow the file they follow, and
+	// then it is rewritten.
+	std::string szBig( ReadFile("check_incremental.ini").size() / 2, 'x' );
+
+	CHECK( File.SetValue("big", szBig, "", "Alpha") );
+	CHECK( File.Save() );
+	CHECK( CountOf(ReadFile("check_incremental.ini"), "[Alpha]") == 2 );
+	CHECK_SAME( LoadDump("check_incremental.ini", File.m_Flags), Dump(File) );
+
+	szBig[0] = 'y';
+	CHECK( File.SetValue("big", szBig, "", "Alpha") );
+	CHECK( File.Save() );
+	szText = ReadFile("check_incremental.ini");
+	CHECK( CountOf(szText, "[Alpha]") == 1 );
+	CHECK( CountOf(szText, "=x") == 0 );
+	CHECK_SAME( LoadDump("check_incremental.ini", File.m_Flags), Dump(File) );
+
+	remove("check_incremental.ini");
+}
+
+// CheckLoaded
+// What Load() brings in is clean, whatever the object held before and
+// whether or not it has a file name: no key or section of it is dirty, and
+// loading alone leaves the destructor nothing to save. Changes made before
+// the load stay dirty. Loading another file into an object that has its own
+// has the next incremental save rewrite the file whole, so nothing loaded is
+// left out of it.
+static void CheckLoaded()
+{
+	const std::string szText = "top=level\n[Table]\nType=Craps\nMinBet=5\n[Player]\nName=Gary\n";
+	const long Loaders[] = { 0, MMAP_LOAD, MMAP_LOAD | PARALLEL_LOAD, MMAP_LOAD | LAZY_LOAD };
+
+	CHECK( WriteFile("check_loaded.ini", szText) );
+	remove("check_loaded_out.ini");
+
+	for (std::size_t nLoader = 0; nLoader < sizeof(Loaders) / sizeof(Loaders[0]); nLoader++)
+	{
+		// Into a new object, with no file name
+		{
+			CDataFile File;
+
+			File.m_Flags = AUTOCREATE_SECTIONS | AUTOCREATE_KEYS | Loaders[nLoader];
+			CHECK( File.Load("check_loaded.ini") );
+			CHECK( File.GetDirtySections().empty() );
+			CHECK( !File.IsKeyDirty("Type", "Table") );
+			CHECK( !File.IsSectionDirty("Player") );
+			CHECK( !File.IsKeyDirty("top") );
+			File.SetFileName("check_loaded_out.ini");
+		}
+
+		CHECK( ReadFile("check_loaded_out.ini").empty() );
+
+		// Into one with changes of its own
+		{
+			CDataFile File;
+
+			File.m_Flags = AUTOCREATE_SECTIONS | AUTOCREATE_KEYS | Loaders[nLoader];
+			CHECK( File.SetValue("mine", "1", "", "Own") );
+			CHECK( File.SetValue("MinBet", "10", "", "Table") );
+			CHECK( File.Load("check_loaded.ini") );
+			CHECK( File.GetInt("MinBet", "Table") == 5 );
+			CHECK( File.IsKeyDirty("mine", "Own") );
+			CHECK( !File.IsKeyDirty("MinBet", "Table") );
+			CHECK( !File.IsKeyDirty("Type", "Table") );
+			CHECK( !File.IsSectionDirty("Player") );
+			File.ClearDirty();
+		}
+
+		// Into one with nothing to save, with no file name
+		{
+			CDataFile File;
+
+			File.m_Flags = AUTOCREATE_SECTIONS | AUTOCREATE_KEYS | Loaders[nLoader];
+			CHECK( File.CreateSection("Empty", "") );
+			File.ClearDirty();
+			CHECK( File.Load("check_loaded.ini") );
+			CHECK( File.GetDirtySections().empty() );
+			File.SetFileName("check_loaded_out.ini");
+		}
+
+		CHECK( ReadFile("check_loaded_out.ini").empty() );
+	}
+
+	// Another file into one that has its own
+	{
+		CDataFile File;
+
+		CHECK( WriteFile("check_loaded_out.ini", "[Own]\nmine=1\n") );
+		File.m_Flags |= INCREMENTAL_SAVE;
+		File.SetFileName("check_loaded_out.ini");
+		CHECK( File.Load("check_loaded_out.ini") );
+		CHECK( File.Load("check_loaded.ini") );
+		CHECK( File.GetDirtySections().empty() );
+		CHECK( File.SetValue("mine", "2", "", "Own") );
+		CHECK( File.Save() );
+		CHECK_SAME( LoadDump("check_loaded_out.ini", File.m_Flags), Dump(File) );
+	}
+
+	remove("check_loaded.ini");
+	remove("check_loaded_out.ini");
+}
+
+
+// SameImage
+// Returns true if every key of the file reads back the same from the image,
+// as text and converted, and the image holds nothing else.
+static bool SameImage(CDataFile& File, const CDataImage& Image)
+{
+	int nKeys = 0;
+
+	for (CSectionView Section : File.Sections())
+	{
+		std::string szSection(Section.Name().pStr, Section.Name().nLen);
+
+		if ( !Image.CheckSectionName(szSection) )
+			return false;
+
+		for (CKeyView Key : Section.Keys())
+		{
+			std::string szKey(Key.Name().pStr, Key.Name().nLen);
+			std::string szValue(Key.Value().pStr, Key.Value().nLen);
+
+			if ( Image.GetValue(szKey, szSection) != szValue
+				 || Image.GetInt(szKey, szSection) != ValueAsInt(szValue)
+				 || Image.GetFloat(szKey, szSection) != ValueAsFloat(szValue)
+				 || Image.GetBool(szKey, szSection) != ValueAsBool(szValue) )
+			{
+				printf("    <%s> of [%s] differs\n", szKey.c_str(), szSection.c_str());
+				return false;
+			}
+
+			nKeys++;
+		}
+	}
+
+	return Image.KeyCount() == nKeys && Image.SectionCount() == (int)File.Sections().Size();
+}
+
+// Corrupt
+// Returns szImage with nLen bytes at nAt replaced by those at pBytes.
+static std::string Corrupt(const std::string& szImage, std::size_t nAt, const void* pBytes, std::size_t nLen)
+{
+	std::string szCorrupt(szImage);
+
+	if ( nAt + nLen <= szCorrupt.size() )
+		memcpy(&szCorrupt[nAt], pBytes, nLen);
+
+	return szCorrupt;
+}
+
+// OpensAs
+// Writes szImage to the named file and returns whether it opens.
+static bool OpensAs(const std::string& szFile, const std::string& szImage)
+{
+	CDataImage Image;
+
+	return WriteFile(szFile, szImage) && Image.Open(szFile);
+}
+
+// CheckImage
+// A compiled image reads back every key just as the file it was compiled
+// from does, converted values included, and one that has been damaged is
+// refused rather than read.
+static void CheckImage()
+{
+	const char* Files[] = { "CrapSim.ini", "win.ini", "new.ini" };
+
+	for (std::size_t nFile = 0; nFile < sizeof(Files) / sizeof(Files[0]); nFile++)
+	{
+		CDataFile File;
+		CDataFile Loaded;
+		CDataImage Image;
+
+		CHECK( File.Load(Files[nFile]) );
+		CHECK( File.SaveImage("check_image.cdi") );
+		CHECK( Image.Open("check_image.cdi") );
+		CHECK( SameImage(File, Image) );
+
+		CHECK( Loaded.LoadImage("check_image.cdi") );
+		CHECK_SAME( Dump(Loaded), Dump(File) );
+
+		File.ClearDirty();
+		Loaded.ClearDirty();
+	}
+
+	// Values that convert in every way, and a section named twice over.
+	SectionList Sections(3);
+	const char* Values[] = { "12abc", "-7", " 3", "1.5e2", "TRUE", "Yes", "10", "0", "yes please", "x" };
+
+	Sections[1].szName = "Values";
+	Sections[1].szComment = "; converted";
+	Sections[2].szName = "values";
+
+	for (std::size_t nValue = 0; nValue < sizeof(Values) / sizeof(Values[0]); nValue++)
+		Sections[1].Keys.push_back( t_Key("v" + std::to_string(nValue), Values[nValue]) );
+
+	Sections[2].Keys.push_back( t_Key("shadowed", "by the first") );
+
+	std::string szImage;
+	CDataImage Image;
+
+	CHECK( CDataImage::Build(Sections, t_FileStamp(), szImage) );
+	CHECK( OpensAs("check_image.cdi", szImage) );
+	CHECK( Image.Open("check_image.cdi") );
+	CHECK( Image.SectionCount() == 3 && Image.KeyCount() == (int)Sections[1].Keys.size() + 1 );
+	CHECK( Image.GetValue("shadowed", "Values") == "" );
+
+	for (std::size_t nValue = 0; nValue < sizeof(Values) / sizeof(Values[0]); nValue++)
+	{
+		std::string szKey = "v" + std::to_string(nValue);
+
+		CHECK( Image.GetValue(szKey, "VALUES") == Values[nValue] );
+		CHECK( Image.GetInt(szKey, "Values") == ValueAsInt(Values[nValue]) );
+		CHECK( Image.GetFloat(szKey, "Values") == ValueAsFloat(Values[nValue]) );
+		CHECK( Image.GetBool(szKey, "Values") == ValueAsBool(Values[nValue]) );
+	}
+
+	CHECK( Image.GetInt("missing", "Values") == INT_MIN );
+	CHECK( Image.GetFloat("missing", "Values") == FLT_MIN );
+	CHECK( !Image.GetBool("missing", "Values") );
+	Image.Close();
+
+	// Damage to the header, the offsets, the records and the strings.
+	t_ImageHeader Header;
+	const char szMagic[] = "CDFIMAGX";
+	std::uint32_t nBig = 0xffffff00;
+	std::uint32_t nKeys = 100;
+	std::uint64_t nOdd;
+
+	memcpy(&Header, szImage.data(), sizeof(Header));
+
+	CHECK( !OpensAs("check_image.cdi", szImage.substr(0, szImage.size() - 8)) );
+	CHECK( !OpensAs("check_image.cdi", szImage + std::string(8, '\0')) );
+	CHECK( !OpensAs("check_image.cdi", szImage.substr(0, sizeof(Header) - 1)) );
+	CHECK( !OpensAs("check_image.cdi", Corrupt(szImage, offsetof(t_ImageHeader, szMagic), szMagic, 8)) );
+
+	std::uint32_t nVersion = Header.nVersion + 1;
+	CHECK( !OpensAs("check_image.cdi", Corrupt(szImage, offsetof(t_ImageHeader, nVersion), &nVersion, 4)) );
+
+	std::uint32_t nByteOrder = 0x04030201;
+	CHECK( !OpensAs("check_image.cdi", Corrupt(szImage, offsetof(t_ImageHeader, nByteOrder), &nByteOrder, 4)) );
+
+	nOdd = Header.nStringsAt + 1;
+	CHECK( !OpensAs("check_image.cdi", Corrupt(szImage, offsetof(t_ImageHeader, nStringsAt), &nOdd, 8)) );
+
+	nOdd = Header.nImageSize;
+	CHECK( !OpensAs("check_image.cdi", Corrupt(szImage, offsetof(t_ImageHeader, nKeysAt), &nOdd, 8)) );
+
+	CHECK( !OpensAs("check_image.cdi", Corrupt(szImage, offsetof(t_ImageHeader, nKeys), &nKeys, 4)) );
+
+	// The first key's name, and the second section's key count
+	CHECK( !OpensAs("check_image.cdi", Corrupt(szImage, Header.nKeysAt + offsetof(t_ImageKey, Name), &nBig, 4)) );
+	CHECK( !OpensAs("check_image.cdi", Corrupt(szImage, Header.nSectionsAt + sizeof(t_ImageSection)
+											   + offsetof(t_ImageSection, nKeys), &nKeys, 4)) );
+
+	// A key index entry out of its section, and the null after the last string
+	CHECK( !OpensAs("check_image.cdi", Corrupt(szImage, Header.nKeyIndexAt, &nBig, 4)) );
+	CHECK( !OpensAs("check_image.cdi", Corrupt(szImage, Header.nStringsAt + Header.nStringsLen - 1, "x", 1)) );
+
+	// Every byte of the header, and of the records after it, changed in turn:
+	// whatever opens must still be read safely.
+	for (std::size_t nAt = 0; nAt < Header.nStringsAt; nAt++)
+	{
+		std::string szCorrupt(szImage);
+
+		szCorrupt[nAt] ^= 0x5a;
+
+		if ( OpensAs("check_image.cdi", szCorrupt) )
+		{
+			CDataImage Damaged;
+			SectionList Read;
+
+			CHECK( Damaged.Open("check_image.cdi") );
+			Damaged.GetSections(Read);
+
+			for (std::size_t nValue = 0; nValue < sizeof(Values) / sizeof(Values[0]); nValue++)
+				Damaged.GetValue("v" + std::to_string(nValue), "Values");
+		}
+	}
+
+	remove("check_image.cdi");
+}
+
+// CChunkedFile
+// A CDataFile that parses text in as many chunks as it is told to, as
+// PARALLEL_LOAD parses a big file on a machine with that many threads.
+class CChunkedFile : public CDataFile
+{
+public:
+	void		LoadText(const std::string& szText, std::size_t nChunks)
+	{
+		LoadChunks(szText.data(), szText.data() + szText.size(), nChunks);
+	}
+};
+
+// CheckParallel
+// A file parsed in chunks, as PARALLEL_LOAD parses it, gives just what a
+// single pass does. Every section header has comments ahead of it, which
+// a split there leaves at the end of the chunk before. Some headers are
+// indented, some name a section from an earlier chunk, and some keys are set
+// again. The file is split every way from 2 to 40 chunks.
+static void CheckParallel()
+{
+	const long nFlags = AUTOCREATE_SECTIONS | AUTOCREATE_KEYS | MMAP_LOAD;
+	std::string szText = "; before everything\ntop=level\n";
+
+	for (int nSection = 0; nSection < 200; nSection++)
+	{
+		std::string szName = (nSection % 5 == 0) ? "Shared" + std::to_string(nSection % 35)
+												  : "Section" + std::to_string(nSection);
+
+		szText += "; comment for " + szName + " as section " + std::to_string(nSection) + "\n";
+		if ( nSection % 2 == 0 )
+			szText += "# and a second line\n\n";
+		szText += (nSection % 3 == 0 ? "  [" : "[") + szName + "]\n";
+
+		for (int nKey = 0; nKey < nSection % 9; nKey++)
+		{
+			if ( nKey % 4 == 0 )
+				szText += "; key comment " + std::to_string(nSection) + "\n";
+
+			szText += "key" + std::to_string(nKey) + " = " + std::to_string(nSection * 20 + nKey) + "\n";
+		}
+
+		// Left for the next header to pick up
+		szText += "; trailing " + std::to_string(nSection) + "\n";
+	}
+
+	szText += "; dangling at the end\n";
+
+	CHECK( WriteFile("check_parallel.ini", szText) );
+
+	std::string szSerial = LoadDump("check_parallel.ini", nFlags);
+
+	for (std::size_t nChunks = 2; nChunks <= 40; nChunks++)
+	{
+		CChunkedFile File;
+
+		File.LoadText(szText, nChunks);
+		CHECK_SAME( Dump(File), szSerial );
+		File.ClearDirty();
+	}
+
+	// Through Load(), whether or not this machine has threads to split it for
+	CHECK_SAME( LoadDump("check_parallel.ini", nFlags | PARALLEL_LOAD), szSerial );
+
+	remove("check_parallel.ini");
+}
+
+// InFragment
+// Whether fragment nFragment of CheckLoadFiles names section nSection. Each
+// names a different mix, and no one of them names them all.
+static bool InFragment(int nFragment, int nSection)
+{
+	return (nSection * 7 + nFragment * 3) % 5 < 3;
+}
+
+// CheckLoadFiles
+// LoadFiles() on 1, 2 and 4 threads gives just what loading the files one
+// after another does: overlapping fragments set the same keys, with the last
+// file's value winning, and name the same sections with comments of their
+// own, with the first file's comment kept. A file that cannot be read makes
+// it return false, and the rest are loaded regardless. LoadDirectory() loads
+// the files with the suffix in order of name, whatever order they were
+// written in.
+static void CheckLoadFiles()
+{
+	const long nFlags = AUTOCREATE_SECTIONS | AUTOCREATE_KEYS | MMAP_LOAD;
+	const int nFragments = 7;
+	std::vector<std::string> Files;
+	std::string szSerial;
+
+	// Written last to first, so that the directory does not list them in order
+	for (int nFragment = nFragments - 1; nFragment >= 0; nFragment--)
+	{
+		std::string szText = "shared=" + std::to_string(nFragment) + "\n";
+
+		for (int nSection = 0; nSection < 12; nSection++)
+		{
+			if ( !InFragment(nFragment, nSection) )
+				continue;
+
+			szText += "; section " + std::to_string(nSection) + " from fragment " + std::to_string(nFragment) + "\n";
+			szText += "[Section" + std::to_string(nSection) + "]\n";
+			szText += "from=" + std::to_string(nFragment) + "\n";
+			szText += "; only in " + std::to_string(nFragment) + "\n";
+			szText += "key" + std::to_string(nFragment) + "=" + std::to_string(nSection) + "\n";
+		}
+
+		CHECK( WriteFile("check_files" + std::to_string(nFragment) + ".frag", szText) );
+	}
+
+	for (int nFragment = 0; nFragment < nFragments; nFragment++)
+		Files.push_back("check_files" + std::to_string(nFragment) + ".frag");
+
+	{
+		CDataFile File;
+
+		File.m_Flags = nFlags;
+		for (std::size_t nFile = 0; nFile < Files.size(); nFile++)
+			CHECK( File.Load(Files[nFile]) );
+
+		CHECK( File.GetInt("shared") == nFragments - 1 );
+
+		for (int nSection = 0; nSection < 12; nSection++)
+		{
+			std::string szSection = "Section" + std::to_string(nSection);
+			int nFirst = -1;
+			int nLast = -1;
+
+			for (int nFragment = 0; nFragment < nFragments; nFragment++)
+			{
+				if ( InFragment(nFragment, nSection) )
+				{
+					nFirst = (nFirst < 0) ? nFragment : nFirst;
+					nLast = nFragment;
+				}
+			}
+
+			CHECK( File.GetInt("from", szSection) == nLast );
+
+			for (CSectionView Section : File.Sections())
+			{
+				if ( CompareNoCase(Section.Name(), szSection) == 0 )
+					CHECK_SAME( std::string(Section.Comment().pStr, Section.Comment().nLen),
+								"\n; section " + std::to_string(nSection) + " from fragment " + std::to_string(nFirst) );
+			}
+		}
+
+		szSerial = Dump(File);
+	}
+
+	for (unsigned int nThreads = 1; nThreads <= 4; nThreads *= 2)
+	{
+		CDataFile File;
+		std::vector<std::string> Unreadable = Files;
+
+		File.m_Flags = nFlags;
+		CHECK( File.LoadFiles(Files, nThreads) );
+		CHECK_SAME( Dump(File), szSerial );
+
+		// With one that is not there, in the middle
+		Unreadable.insert(Unreadable.begin() + 3, "check_files_missing.frag");
+
+		CDataFile Partial;
+
+		Partial.m_Flags = nFlags;
+		CHECK( !Partial.LoadFiles(Unreadable, nThreads) );
+		CHECK_SAME( Dump(Partial), szSerial );
+	}
+
+	{
+		CDataFile File;
+
+		File.m_Flags = nFlags;
+		CHECK( File.LoadDirectory(".", ".frag", 2) );
+		CHECK_SAME( Dump(File), szSerial );
+	}
+
+	for (std::size_t nFile = 0; nFile < Files.size(); nFile++)
+		remove(Files[nFile].c_str());
+}
+
+// CheckDetached
+// Objects destroyed with ASYNC_SAVE set, on several threads at once, have
+// their files written by the detached writer, and of several destroyed in
+// turn with changes to the same file, the last one's changes are written.
+static void CheckDetached()
+{
+	const int nThreads = 4;
+	const int nFiles = 25;
+	std::vector<std::thread> Threads;
+
+	for (int nThread = 0; nThread < nThreads; nThread++)
+	{
+		Threads.push_back( std::thread([nThread]()
+		{
+			for (int nFile = 0; nFile < nFiles; nFile++)
+			{
+				CDataFile File;
+
+				File.m_Flags |= ASYNC_SAVE;
+				File.SetFileName("check_detached" + std::to_string(nThread * nFiles + nFile) + ".ini");
+				File.SetValue("file", std::to_string(nThread * nFiles + nFile), "", "Detached");
+			}
+		}) );
+	}
+
+	for (int nValue = 0; nValue < 10; nValue++)
+	{
+		CDataFile File;
+
+		File.m_Flags |= ASYNC_SAVE;
+		File.SetFileName("check_detached.ini");
+		File.SetValue("last", std::to_string(nValue), "", "Detached");
+	}
+
+	for (std::size_t nThread = 0; nThread < Threads.size(); nThread++)
+		Threads[nThread].join();
+
+	// The writer is in the background, so give it a while.
+	std::chrono::steady_clock::time_point Until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	int nWritten = 0;
+
+	while ( nWritten < nThreads * nFiles + 1 && std::chrono::steady_clock::now() < Until )
+	{
+		nWritten = LoadDump("check_detached.ini", AUTOCREATE_SECTIONS | AUTOCREATE_KEYS)
+				   == "[] {}\n[Detached] {}\n  last=9 {}\n" ? 1 : 0;
+
+		for (int nFile = 0; nFile < nThreads * nFiles; nFile++)
+		{
+			std::string szFile = "check_detached" + std::to_string(nFile) + ".ini";
+
+			if ( ReadFile(szFile) == "\n[Detached]\nfile=" + std::to_string(nFile) + "\n" )
+				nWritten++;
+		}
+
+		if ( nWritten < nThreads * nFiles + 1 )
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	CHECK( nWritten == nThreads * nFiles + 1 );
+
+	remove("check_detached.ini");
+	for (int nFile = 0; nFile < nThreads * nFiles; nFile++)
+		remove(("check_detached" + std::to_string(nFile) + ".ini").c_str());
+}
+// CheckBatch
+// Committing a CDataBatch leaves a file just as setting each of its values
+// in turn with SetValue() does, down to the dirty sections, the counts and
+// what is returned. The batches repeat keys in differing case ("b" then
+// "B"), empty values (of keys there before the batch, of keys it added, and
+// of keys not there at all), and go back and forth between sections, some
+// new; some are run without AUTOCREATE_KEYS or AUTOCREATE_SECTIONS.
+static void CheckBatch()
+{
+	const char* Keys[] = { "a", "A", "b", "B", "Key", "kEY", "new", "NEW" };
+	const char* Sections[] = { "", "One", "ONE", "Two", "Fresh", "fresh" };
+	const std::size_t nKeys = sizeof(Keys) / sizeof(Keys[0]);
+	const std::size_t nSections = sizeof(Sections) / sizeof(Sections[0]);
+	unsigned int nRandom = 88172645u;
+
+	for (int nTrial = 0; nTrial < 500; nTrial++)
+	{
+		CDataFile Batched;
+		CDataFile Serial;
+		CDataBatch Batch(Batched);
+		bool bSerial = true;
+
+		nRandom ^= nRandom << 13;
+		nRandom ^= nRandom >> 17;
+		nRandom ^= nRandom << 5;
+
+		for (CDataFile* pFile : { &Batched, &Serial })
+		{
+			pFile->SetValue("a", "base", "", "One");
+			pFile->SetValue("Key", "base", "base comment", "One");
+			pFile->SetValue("b", "base", "", "Two");
+			pFile->SetValue("key", "base", "", "");
+			pFile->m_Flags &= ~(nRandom % 4 == 1 ? AUTOCREATE_KEYS : nRandom % 4 == 2 ? AUTOCREATE_SECTIONS : 0);
+			pFile->ClearDirty();
+			pFile->Sections();
+		}
+
+		int nValues = 1 + (nRandom >> 4) % 30;
+
+		for (int nValue = 0; nValue < nValues; nValue++)
+		{
+			nRandom ^= nRandom << 13;
+			nRandom ^= nRandom >> 17;
+			nRandom ^= nRandom << 5;
+
+			const char* szKey = Keys[nRandom % nKeys];
+			const char* szSection = Sections[(nRandom >> 4) % nSections];
+			std::string szValue = ((nRandom >> 8) % 4 == 0) ? "" : std::to_string(nTrial * 100 + nValue);
+			std::string szComment = ((nRandom >> 12) % 3 == 0) ? "comment " + std::to_string(nValue) : "";
+
+			Batch.SetValue(szKey, szValue, szComment, szSection);
+			bSerial = Serial.SetValue(szKey, szValue, szComment, szSection) && bSerial;
+		}
+
+		CHECK( Batch.Commit() == bSerial );
+		CHECK( Batched.KeyCount() == Serial.KeyCount() );
+		CHECK( Batched.SectionCount() == Serial.SectionCount() );
+		CHECK( Batched.GetDirtySections() == Serial.GetDirtySections() );
+		CHECK_SAME( Dump(Batched), Dump(Serial) );
+
+		Batched.ClearDirty();
+		Serial.ClearDirty();
+
+		if ( g_nFailures > 0 )
+		{
+			printf("  (in trial %d)\n", nTrial);
+			break;
+		}
+	}
+}
+
+
+// CheckLazy
+// A file loaded with LAZY_LOAD gives just what a full load does, however its
+// sections come to be parsed: by threads reading different sections at once
+// with THREAD_SAFE set (while another asks which sections are dirty, which
+// must stay none throughout), or after the file has been rewritten in place,
+// shorter and with other keys, once only some of its sections were read.
+static void CheckLazy()
+{
+	const long nFlags = AUTOCREATE_SECTIONS | AUTOCREATE_KEYS | MMAP_LOAD;
+	const int nSections = 40;
+	const int nThreads = 4;
+	std::string szText = "; before everything\ntop=level\n";
+
+	for (int nSection = 0; nSection < nSections; nSection++)
+	{
+		szText += "; comment for section " + std::to_string(nSection) + "\n";
+		szText += "[Section" + std::to_string(nSection) + "]\n";
+
+		for (int nKey = 0; nKey < 20; nKey++)
+			szText += "key" + std::to_string(nKey) + " = " + std::to_string(nSection * 100 + nKey) + "\n";
+	}
+
+	CHECK( WriteFile("check_lazy.ini", szText) );
+
+	std::string szFull = LoadDump("check_lazy.ini", nFlags);
+
+	{
+		CDataFile File;
+		std::vector<std::thread> Threads;
+		std::vector<int> Wrong(nThreads + 1, 0);
+
+		File.m_Flags = nFlags | LAZY_LOAD | THREAD_SAFE;
+		File.SetFileName("check_lazy.ini");
+		CHECK( File.Load("check_lazy.ini") );
+
+		for (int nThread = 0; nThread < nThreads; nThread++)
+		{
+			Threads.push_back( std::thread([&File, &Wrong, nThread]()
+			{
+				for (int nSection = nThread; nSection < nSections; nSection += nThreads)
+				{
+					for (int nKey = 0; nKey < 20; nKey++)
+					{
+						if ( File.GetInt("key" + std::to_string(nKey), "Section" + std::to_string(nSection))
+							 != nSection * 100 + nKey )
+							Wrong[nThread]++;
+					}
+				}
+			}) );
+		}
+
+		Threads.push_back( std::thread([&File, &Wrong]()
+		{
+			for (int nTry = 0; nTry < 200; nTry++)
+				Wrong[nThreads] += (int)File.GetDirtySections().size();
+		}) );
+
+		for (std::size_t nThread = 0; nThread < Threads.size(); nThread++)
+			Threads[nThread].join();
+
+		for (int nThread = 0; nThread <= nThreads; nThread++)
+			CHECK( Wrong[nThread] == 0 );
+
+		CHECK( File.KeyCount() == nSections * 20 + 1 );
+		CHECK( File.GetDirtySections().empty() );
+		CHECK_SAME( Dump(File), szFull );
+		File.ClearDirty();
+	}
+
+	{
+		CDataFile File;
+
+		File.m_Flags = nFlags | LAZY_LOAD;
+		CHECK( File.Load("check_lazy.ini") );
+		CHECK( File.GetInt("key3", "Section5") == 503 );
+
+		// Written over where it stands, rather than replaced
+		CHECK( WriteFile("check_lazy.ini", "[Section9]\nother=1\n") );
+
+		CHECK( File.GetInt("key3", "Section9") == 903 );
+		CHECK_SAME( File.GetValue("other", "Section9"), "" );
+		CHECK_SAME( Dump(File), szFull );
+		File.ClearDirty();
+	}
+
+	remove("check_lazy.ini");
+}
+
+// CheckShared
+// An image published in shared memory is read by another process: a forked
+// reader attaches to it and reads it, and once the file has been changed
+// and published again, moves on to the new one with Refresh(). The reader's
+// exit status is the number of things it found wrong. Once the name is
+// removed nothing more can attach to it. Without shared memory (on Windows)
+// nothing can be published at all.
+static void CheckShared()
+{
+	CDataFile File;
+	std::string szName = "/DataFileCheck.shared";
+
+	File.SetValue("value", "1", "", "Shared");
+
+#ifdef WIN32
+	CHECK( !File.PublishShared(szName) );
+#else
+	int Ready[2];
+	int Published[2];
+	char cByte = 0;
+
+	szName += "." + std::to_string((long)getpid());
+
+	CHECK( File.PublishShared(szName) );
+	CHECK( pipe(Ready) == 0 && pipe(Published) == 0 );
+
+	pid_t nReader = fork();
+
+	if ( nReader == 0 )
+	{
+		CSharedImage Shared;
+		int nWrong = 0;
+
+		nWrong += Shared.Attach(szName) ? 0 : 1;
+		nWrong += Shared.IsAttached() && Shared.Image().GetInt("value", "Shared") == 1 ? 0 : 1;
+		nWrong += write(Ready[1], &cByte, 1) == 1 ? 0 : 1;
+		nWrong += read(Published[0], &cByte, 1) == 1 ? 0 : 1;
+		nWrong += Shared.Refresh() ? 0 : 1;
+		nWrong += Shared.IsAttached() && Shared.Image().GetInt("value", "Shared") == 2 ? 0 : 1;
+		nWrong += Shared.Image().GetValue("added", "Shared") == "yes" ? 0 : 1;
+		nWrong += Shared.Refresh() ? 1 : 0;
+
+		_exit(nWrong);
+	}
+
+	CHECK( nReader > 0 );
+
+	if ( nReader > 0 )
+	{
+		int nStatus = -1;
+
+		CHECK( read(Ready[0], &cByte, 1) == 1 );
+
+		File.SetValue("value", "2", "", "Shared");
+		File.SetValue("added", "yes", "", "Shared");
+		CHECK( File.PublishShared(szName) );
+		CHECK( write(Published[1], &cByte, 1) == 1 );
+
+		CHECK( waitpid(nReader, &nStatus, 0) == nReader );
+		CHECK( WIFEXITED(nStatus) && WEXITSTATUS(nStatus) == 0 );
+	}
+
+	close(Ready[0]);
+	close(Ready[1]);
+	close(Published[0]);
+	close(Published[1]);
+
+	CSharedImage Shared;
+
+	CHECK( CSharedImage::Remove(szName) );
+	CHECK( !Shared.Attach(szName) );
+#endif
+
+	File.ClearDirty();
+}
+
+// CheckCounts
+// KeyCount() and SectionCount(), kept up as things change rather than
+// counted, agree with a walk of Sections() every so often through a long run
+// of random sets (some of them emptying values), deletes, batches, section
+// creation, loads (lazy and not), saves, reloads and LoadFiles() calls, on
+// names that differ only in case.
+static void CheckCounts()
+{
+	const char* Keys[] = { "a", "A", "b", "Key", "KEY", "c", "d" };
+	const char* Sections[] = { "", "One", "one", "Two", "THREE", "Four" };
+	const std::size_t nKeys = sizeof(Keys) / sizeof(Keys[0]);
+	const std::size_t nSections = sizeof(Sections) / sizeof(Sections[0]);
+	std::vector<std::string> Fragments;
+	unsigned int nRandom = 2463534242u;
+	CDataFile File;
+
+	for (int nFragment = 0; nFragment < 3; nFragment++)
+	{
+		std::string szName = "check_counts" + std::to_string(nFragment) + ".ini";
+		std::string szText = "a=top" + std::to_string(nFragment) + "\n";
+
+		for (std::size_t nSection = 1; nSection < nSections; nSection += 1 + nFragment)
+		{
+			szText += "[" + std::string(Sections[nSection]) + "]\n";
+
+			for (std::size_t nKey = nFragment; nKey < nKeys; nKey += 2)
+				szText += std::string(Keys[nKey]) + "=" + std::to_string(nFragment) + "\n";
+		}
+
+		CHECK( WriteFile(szName, szText) );
+		Fragments.push_back(szName);
+	}
+
+	File.SetFileName("check_counts.ini");
+
+	for (int nStep = 0; nStep < 20000; nStep++)
+	{
+		nRandom ^= nRandom << 13;
+		nRandom ^= nRandom >> 17;
+		nRandom ^= nRandom << 5;
+
+		const char* szKey = Keys[(nRandom >> 4) % nKeys];
+		const char* szSection = Sections[(nRandom >> 8) % nSections];
+		std::string szValue = ((nRandom >> 12) % 5 == 0) ? "" : std::to_string(nStep);
+
+		switch ( nRandom % 16 )
+		{
+		case 0: case 1: case 2: case 3: case 4:
+			File.SetValue(szKey, szValue, "", szSection);
+			break;
+
+		case 5: case 6:
+			File.DeleteKey(szKey, szSection);
+			break;
+
+		case 7:
+			File.DeleteSection(szSection);
+			break;
+
+		case 8:
+			File.CreateSection(szSection, "");
+			break;
+
+		case 9: case 10:
+		{
+			CDataBatch Batch(File);
+
+			for (int nValue = 0; nValue < 6; nValue++)
+				Batch.SetValue(Keys[(nRandom >> (nValue + 3)) % nKeys], nValue == 2 ? "" : szValue, "",
+							   Sections[(nRandom >> (nValue + 7)) % nSections]);
+
+			// False when an empty value was for a key that is not there
+			Batch.Commit();
+			break;
+		}
+
+		case 11:
+			File.m_Flags ^= LAZY_LOAD;
+			CHECK( File.Load(Fragments[(nRandom >> 16) % Fragments.size()]) );
+			break;
+
+		case 12:
+			CHECK( File.Save() );
+			break;
+
+		case 13:
+			if ( ReadFile("check_counts.ini").size() > 0 )
+				CHECK( File.Reload() );
+			break;
+
+		case 14:
+			CHECK( File.LoadFiles(Fragments, 1 + (nRandom >> 16) % 3) );
+			break;
+
+		default:
+			CHECK( File.Load(Fragments[(nRandom >> 16) % Fragments.size()]) );
+			break;
+		}
+
+		// Sections() compacts, so it is only walked now and then, leaving
+		// tombstones for the steps in between.
+		if ( nStep % 10 != 9 )
+			continue;
+
+		int nCounted = 0;
+		int nSectionCount = File.SectionCount();
+		int nKeyCount = File.KeyCount();
+		int nSectionsSeen = 0;
+
+		for (CSectionView Section : File.Sections())
+		{
+			nSectionsSeen++;
+
+			for (CKeyView Key : Section.Keys())
+			{
+				(void)Key;
+				nCounted++;
+			}
+		}
+
+		CHECK( nSectionCount == nSectionsSeen );
+		CHECK( nKeyCount == nCounted );
+
+		if ( g_nFailures > 0 )
+		{
+			printf("  (at step %d)\n", nStep);
+			break;
+		}
+	}
+
+	File.ClearDirty();
+
+	remove("check_counts.ini");
+	for (std::size_t nFragment = 0; nFragment < Fragments.size(); nFragment++)
+		remove(Fragments[nFragment].c_str());
+}
+
+
+// Names
+// The names of the views, one to a line.
+template <class VIEWS>
+static std::string Names(const VIEWS& Views)
+{
+	std::string szOut;
+
+	for (std::size_t nView = 0; nView < Views.size(); nView++)
+		szOut += std::string(Views[nView].Name().pStr, Views[nView].Name().nLen) + "\n";
+
+	return szOut;
+}
+
+// Matching
+// The names that a query for the prefix, or the pattern, should give, found
+// the slow way: every name tried with MatchNoCase, and the matches sorted by
+// name, ignoring case.
+static std::string Matching(std::vector<std::string> Names, bool bPattern, const std::string& szWhat)
+{
+	std::vector<std::string> Found;
+	std::string szOut;
+
+	for (std::size_t nName = 0; nName < Names.size(); nName++)
+	{
+		bool bMatches = bPattern ? MatchNoCase(szWhat, Names[nName])
+								 : Names[nName].size() >= szWhat.size()
+								   && CompareNoCase(Names[nName].substr(0, szWhat.size()), szWhat) == 0;
+
+		if ( bMatches )
+			Found.push_back(Names[nName]);
+	}
+
+	std::stable_sort(Found.begin(), Found.end(), [](const std::string& szLeft, const std::string& szRight)
+					 { return CompareNoCase(szLeft, szRight) < 0; });
+
+	for (std::size_t nName = 0; nName < Found.size(); nName++)
+		szOut += Found[nName] + "\n";
+
+	return szOut;
+}
+
+// CheckQueryResults
+// Every query of the sections, and of the keys of each section named, gives
+// what trying every name the slow way does. The queries are all made before
+// the names are gathered through Sections(), and the keys' before the
+// sections', since both of those compact everything, so that the key
+// queries see whatever tombstones there are.
+static void CheckQueryResults(CDataFile& File, const char* const* SectionNames, std::size_t nSectionNames)
+{
+	const char* Patterns[] = { "*", "?", "**", "", "Player*", "*1", "*er*", "p?ay*", "PLAYER?",
+							   "?*", "*?", "T*E*", "x*z", "*.*", "play", "a*b*c", "*a?b*" };
+	const char* Prefixes[] = { "", "p", "PLAY", "Player1", "zz", "t", "Alpha*", "key" };
+	const std::size_t nPatterns = sizeof(Patterns) / sizeof(Patterns[0]);
+	const std::size_t nPrefixes = sizeof(Prefixes) / sizeof(Prefixes[0]);
+	std::vector<std::string> Found;
+	std::vector<std::string> Sections;
+	std::size_t nFound = 0;
+
+	for (std::size_t nSection = 0; nSection < nSectionNames; nSection++)
+	{
+		for (std::size_t nPattern = 0; nPattern < nPatterns; nPattern++)
+			Found.push_back( Names(File.FindKeys(Patterns[nPattern], SectionNames[nSection])) );
+
+		for (std::size_t nPrefix = 0; nPrefix < nPrefixes; nPrefix++)
+			Found.push_back( Names(File.KeysWithPrefix(Prefixes[nPrefix], SectionNames[nSection])) );
+	}
+
+	for (std::size_t nPattern = 0; nPattern < nPatterns; nPattern++)
+		Found.push_back( Names(File.FindSections(Patterns[nPattern])) );
+
+	for (std::size_t nPrefix = 0; nPrefix < nPrefixes; nPrefix++)
+		Found.push_back( Names(File.SectionsWithPrefix(Prefixes[nPrefix])) );
+
+	for (CSectionView Section : File.Sections())
+		Sections.push_back( std::string(Section.Name().pStr, Section.Name().nLen) );
+
+	for (std::size_t nSection = 0; nSection < nSectionNames; nSection++)
+	{
+		std::vector<std::string> Keys;
+
+		for (CSectionView Section : File.Sections())
+		{
+			if ( CompareNoCase(Section.Name(), SectionNames[nSection]) != 0 )
+				continue;
+
+			for (CKeyView Key : Section.Keys())
+				Keys.push_back( std::string(Key.Name().pStr, Key.Name().nLen) );
+		}
+
+		for (std::size_t nPattern = 0; nPattern < nPatterns; nPattern++)
+			CHECK_SAME( Found[nFound++], Matching(Keys, true, Patterns[nPattern]) );
+
+		for (std::size_t nPrefix = 0; nPrefix < nPrefixes; nPrefix++)
+			CHECK_SAME( Found[nFound++], Matching(Keys, false, Prefixes[nPrefix]) );
+	}
+
+	for (std::size_t nPattern = 0; nPattern < nPatterns; nPattern++)
+		CHECK_SAME( Found[nFound++], Matching(Sections, true, Patterns[nPattern]) );
+
+	for (std::size_t nPrefix = 0; nPrefix < nPrefixes; nPrefix++)
+		CHECK_SAME( Found[nFound++], Matching(Sections, false, Prefixes[nPrefix]) );
+}
+
+// CheckQueries
+// The prefix and pattern queries of sections and keys find what trying each
+// name the slow way does, for names that differ only in case, that contain
+// the wildcards themselves, or that share prefixes, and go on doing so after
+// keys and sections are deleted and then set again.
+static void CheckQueries()
+{
+	const char* Words[] = { "Player1", "player2", "PLAYER10", "Players", "Play", "Table", "table.Extra",
+							"X", "xyz", "Alpha*Beta", "a?b", "abc", "ABD", "key", "Keys", "T" };
+	const std::size_t nWords = sizeof(Words) / sizeof(Words[0]);
+	CDataFile File;
+
+	// The slow way leans on MatchNoCase, so it is checked first.
+	CHECK( MatchNoCase("*", "") && MatchNoCase("**", "abc") && MatchNoCase("", "") );
+	CHECK( !MatchNoCase("", "a") && !MatchNoCase("?", "") && MatchNoCase("?", "Q") );
+	CHECK( MatchNoCase("pLaY*", "Player10") && !MatchNoCase("Play?", "Player10") );
+	CHECK( MatchNoCase("*10", "PLAYER10") && !MatchNoCase("*10", "Player1") );
+	CHECK( MatchNoCase("a*b*c", "AxxBxxC") && !MatchNoCase("a*b*c", "axxcxxb") );
+	CHECK( MatchNoCase("*a?b*", "Alpha*Beta") && MatchNoCase("a?b", "a?b") && MatchNoCase("a?b", "axb") );
+
+	for (std::size_t nSection = 0; nSection < nWords; nSection++)
+	{
+		for (std::size_t nKey = 0; nKey < nWords; nKey++)
+		{
+			if ( (nSection + nKey) % 3 != 0 )
+				CHECK( File.SetValue(Words[nKey], std::to_string(nKey), "", Words[nSection]) );
+		}
+	}
+
+	CheckQueryResults(File, Words, nWords);
+
+	// Fewer than half of each section's keys, so that they are left as
+	// tombstones for the queries to skip.
+	for (std::size_t nSection = 0; nSection < nWords; nSection += 2)
+	{
+		for (std::size_t nKey = nSection % 4; nKey < nWords; nKey += 3)
+			File.DeleteKey(Words[nKey], Words[nSection]);
+	}
+
+	CHECK( File.DeleteSection("Players") );
+	CHECK( File.DeleteSection("abc") );
+	CHECK( File.DeleteSection("x") );
+	CheckQueryResults(File, Words, nWords);
+
+	CHECK( File.SetValue("Players", "back", "", "player2") );
+	CHECK( File.SetValue("PLAYERS", "again", "", "Player1") );
+	CHECK( File.SetValue("abc", "back", "", "abc") );
+	CHECK( File.CreateSection("Players", "") );
+	CheckQueryResults(File, Words, nWords);
+
+	File.ClearDirty();
+}
+
+
+// t_ModelSection
+// A section as CheckTombstones expects to find it: its name and its keys
+// with their values, in order.
+typedef struct st_modelsection
+{
+	std::string		szName;
+	std::vector<std::pair<std::string, std::string> > Keys;
+} t_ModelSection;
+
+// ModelDump
+// Renders the model as Dump() renders the object it should match.
+static std::string ModelDump(const std::vector<t_ModelSection>& Model)
+{
+	std::string szOut;
+
+	for (std::size_t nSection = 0; nSection < Model.size(); nSection++)
+	{
+		szOut += "[" + Model[nSection].szName + "] {}\n";
+
+		for (std::size_t nKey = 0; nKey < Model[nSection].Keys.size(); nKey++)
+			szOut += "  " + Model[nSection].Keys[nKey].first + "=" + Model[nSection].Keys[nKey].second + " {}\n";
+	}
+
+	return szOut;
+}
+
+// ModelValue
+// Returns the model's value for the key, or "" if it has none.
+static std::string ModelValue(const std::vector<t_ModelSection>& Model, const std::string& szKey,
+							  const std::string& szSection)
+{
+	for (std::size_t nSection = 0; nSection < Model.size(); nSection++)
+	{
+		if ( Model[nSection].szName != szSection )
+			continue;
+
+		for (std::size_t nKey = 0; nKey < Model[nSection].Keys.size(); nKey++)
+		{
+			if ( Model[nSection].Keys[nKey].first == szKey )
+				return Model[nSection].Keys[nKey].second;
+		}
+	}
+
+	return "";
+}
+
+// CheckTombstones
+// Keys and sections deleted, set again, and deleted in bulk, so that
+// DeleteKey() leaves tombstones and compacts a section once half its keys
+// are gone, and DeleteSection() compacts everything once half the sections
+// are. After every step the counts and values, through names and through
+// handles taken at the start, match a model of what the file should hold;
+// every so often Dump() (which compacts what is left) is compared in full.
+static void CheckTombstones()
+{
+	const int nSections = 6;
+	const int nKeys = 12;
+	CDataFile File;
+	std::vector<t_ModelSection> Model(1);
+	std::vector<t_KeyHandle> Handles;
+	unsigned int nRandom = 12345;
+
+	for (int nSection = 0; nSection < nSections; nSection++)
+	{
+		for (int nKey = 0; nKey < nKeys; nKey++)
+			Handles.push_back( File.GetHandle("K" + std::to_string(nKey), "S" + std::to_string(nSection)) );
+	}
+
+	for (int nStep = 0; nStep < 4000; nStep++)
+	{
+		nRandom ^= nRandom << 13;
+		nRandom ^= nRandom >> 17;
+		nRandom ^= nRandom << 5;
+
+		int nOp = nRandom % 16;
+		std::string szSection = "S" + std::to_string((nRandom >> 4) % nSections);
+		std::string szKey = "K" + std::to_string((nRandom >> 8) % nKeys);
+		std::string szValue = std::to_string(nStep);
+		std::size_t nAt = 0;
+
+		while ( nAt < Model.size() && Model[nAt].szName != szSection )
+			nAt++;
+
+		if ( nOp < 8 )
+		{
+			// Set the key, through its name or its handle, adding it (and
+			// its section) at the end if it is not there.
+			if ( nOp < 4 )
+				CHECK( File.SetValue(szKey, szValue, "", szSection) );
+			else
+				CHECK( File.SetValue(Handles[((nRandom >> 4) % nSections) * nKeys + (nRandom >> 8) % nKeys], szValue) );
+
+			if ( nAt == Model.size() )
+			{
+				Model.push_back( t_ModelSection() );
+				Model.back().szName = szSection;
+			}
+
+			std::size_t nKey = 0;
+
+			while ( nKey < Model[nAt].Keys.size() && Model[nAt].Keys[nKey].first != szKey )
+				nKey++;
+
+			if ( nKey == Model[nAt].Keys.size() )
+				Model[nAt].Keys.push_back( std::make_pair(szKey, szValue) );
+			else
+				Model[nAt].Keys[nKey].second = szValue;
+		}
+		else if ( nOp < 14 )
+		{
+			// Delete the key, or a run of keys in the section
+			int nCount = (nOp == 13) ? nKeys / 2 : 1;
+
+			for (int nKey = 0; nKey < nCount; nKey++)
+			{
+				std::string szName = "K" + std::to_string(((nRandom >> 8) + nKey) % nKeys);
+				bool bThere = false;
+
+				for (std::size_t nIn = 0; nAt < Model.size() && nIn < Model[nAt].Keys.size(); nIn++)
+				{
+					if ( Model[nAt].Keys[nIn].first == szName )
+					{
+						Model[nAt].Keys.erase(Model[nAt].Keys.begin() + nIn);
+						bThere = true;
+						break;
+					}
+				}
+
+				CHECK( File.DeleteKey(szName, szSection) == bThere );
+			}
+		}
+		else if ( nOp == 14 )
+		{
+			CHECK( File.DeleteSection(szSection) == (nAt < Model.size()) );
+
+			if ( nAt < Model.size() )
+				Model.erase(Model.begin() + nAt);
+		}
+		else
+		{
+			CHECK( File.CreateSection(szSection, "") == (nAt == Model.size()) );
+
+			if ( nAt == Model.size() )
+			{
+				Model.push_back( t_ModelSection() );
+				Model.back().szName = szSection;
+			}
+		}
+
+		int nModelKeys = 0;
+
+		for (std::size_t nSection = 0; nSection < Model.size(); nSection++)
+			nModelKeys += (int)Model[nSection].Keys.size();
+
+		CHECK( File.SectionCount() == (int)Model.size() );
+		CHECK( File.KeyCount() == nModelKeys );
+
+		for (int nSection = 0; nSection < nSections; nSection++)
+		{
+			for (int nKey = 0; nKey < nKeys; nKey++)
+			{
+				std::string szName = "K" + std::to_string(nKey);
+				std::string szIn = "S" + std::to_string(nSection);
+				std::string szWant = ModelValue(Model, szName, szIn);
+
+				CHECK_SAME( File.GetValue(szName, szIn), szWant );
+				CHECK_SAME( File.GetValue(Handles[nSection * nKeys + nKey]), szWant );
+				CHECK( File.GetInt(Handles[nSection * nKeys + nKey]) == (szWant.empty() ? INT_MIN : atoi(szWant.c_str())) );
+			}
+		}
+
+		if ( nStep % 250 == 249 )
+			CHECK_SAME( Dump(File), ModelDump(Model) );
+
+		if ( g_nFailures > 0 )
+		{
+			printf("  (at step %d)\n", nStep);
+			break;
+		}
+	}
+
+	File.ClearDirty();
+}
+
+
+// The checks, in the order they are run.
+static const t_Check Checks[] =
+{
+	{ "loaders", CheckLoaders },
+	{ "incremental", CheckIncremental },
+	{ "loaded", CheckLoaded },
+	{ "image", CheckImage },
+	{ "parallel", CheckParallel },
+	{ "files", CheckLoadFiles },
+	{ "detached", CheckDetached },
+	{ "batch", CheckBatch },
+	{ "lazy", CheckLazy },
+	{ "shared", CheckShared },
+	{ "counts", CheckCounts },
+	{ "queries", CheckQueries },
+	{ "tombstones", CheckTombstones },
+};
+
+int main(int argc, char* argv[])
+{
+	int nFailed = 0;
+	int nRun = 0;
+
+	SetReportLevel(E_ERROR);
+
+	for (std::size_t nCheck = 0; nCheck < sizeof(Checks) / sizeof(Checks[0]); nCheck++)
+	{
+		bool bWanted = argc < 2;
+
+		for (int nArg = 1; nArg < argc; nArg++)
+			bWanted = bWanted || strcmp(argv[nArg], Checks[nCheck].szName) == 0;
+
+		if ( !bWanted )
+			continue;
+
+		g_nFailures = 0;
+		Checks[nCheck].pCheck();
+		nRun++;
+
+		printf("%-20s %s\n", Checks[nCheck].szName, g_nFailures == 0 ? "ok" : "FAILED");
+
+		if ( g_nFailures > 0 )
+			nFailed++;
+	}
+
+	printf("%d of %d checks passed\n", nRun - nFailed, nRun);
+
+	return nFailed;
+}